@@ -0,0 +1,422 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QThread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+
+#include "decoders/decoder.h"
+#include "image/calibration.h"
+#include "image/compositor.h"
+#include "map.h"
+#include "protocol/ccsds/deframer.h"
+#include "protocol/ccsds/demuxer.h"
+#include "protocol/deframer.h"
+#include "protocol/lrpt/huffman.h"
+#include "protocol/lrpt/jpeg.h"
+#include "protocol/repack.h"
+#include "synth.h"
+
+namespace {
+class Bench {
+   public:
+    struct Result {
+        double seconds;
+        size_t bytes;
+        size_t lines;
+
+        double mb_per_s() const { return bytes / seconds / 1e6; }
+        double lines_per_s() const { return lines / seconds; }
+    };
+
+    Bench(size_t repeat, QRegularExpression filter) : d_repeat(repeat), d_filter(filter) {}
+
+    /// If a benchmark will be run
+    bool enabled(const std::string &name) const { return d_filter.match(QString::fromStdString(name)).hasMatch(); }
+
+    /**
+     * Time a stage, the fastest of all repetitions is kept
+     *
+     * @param bytes Number of bytes going into the stage
+     * @param work Runs the stage, returns the number of lines produced
+     * @param setup Called before every repetition, not timed
+     */
+    void run(const std::string &name, size_t bytes, std::function<size_t()> work, std::function<void()> setup = {}) {
+        if (!enabled(name)) return;
+
+        Result result = {std::numeric_limits<double>::infinity(), bytes, 0};
+        for (size_t i = 0; i < d_repeat; i++) {
+            if (setup) setup();
+            auto start = std::chrono::steady_clock::now();
+            result.lines = work();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            result.seconds = std::min(result.seconds, elapsed.count());
+        }
+
+        std::printf("%-28s %10.3f ms %10.1f MB/s %12.0f lines/s\n", name.c_str(), result.seconds * 1000.0, result.mb_per_s(),
+                    result.lines_per_s());
+        std::fflush(stdout);
+        d_results[name] = result;
+    }
+    /// Like `run()`, but the stage is still run (once) when it is filtered out, for stages that later ones depend on
+    void require(const std::string &name, size_t bytes, std::function<size_t()> work) {
+        if (enabled(name)) {
+            run(name, bytes, work);
+        } else {
+            work();
+        }
+    }
+
+    const std::map<std::string, Result> &results() const { return d_results; }
+
+   private:
+    size_t d_repeat;
+    QRegularExpression d_filter;
+    std::map<std::string, Result> d_results;
+};
+
+/// Feed `data` through a deframer in the same sized chunks as the decoders, returns the number of frames
+template <typename T>
+size_t deframe(T &deframer, const std::vector<uint8_t> &data, uint8_t *frame,
+               std::function<void(const uint8_t *)> callback = {}) {
+    size_t frames = 0;
+    for (size_t i = 0; i < data.size(); i += BUFFER_SIZE) {
+        if (deframer.work(&data[i], frame, std::min<size_t>(BUFFER_SIZE, data.size() - i))) {
+            if (callback) callback(frame);
+            frames++;
+        }
+    }
+    return frames;
+}
+
+using POESDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 110900>;
+using GACDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 33270>;
+using GACReverseDeframer = ArbitraryDeframer<uint64_t, 0b010011001111000011111001001010011011001001001000101010011110, 60, 33270>;
+using VIRRDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 208400>;
+
+// Protocol layers: deframing, repacking, demuxing and decompression
+void bench_protocol(Bench &bench, const std::vector<synth::Recording> &recordings) {
+    const synth::Recording &hrpt = synth::find(recordings, "noaa_hrpt");
+    const synth::Recording &gac = synth::find(recordings, "noaa_gac");
+    const synth::Recording &gac_reverse = synth::find(recordings, "noaa_gac_reverse");
+    const synth::Recording &meteor = synth::find(recordings, "meteor_hrpt");
+    const synth::Recording &ahrpt = synth::find(recordings, "metop_ahrpt");
+    const synth::Recording &lrpt = synth::find(recordings, "meteor_lrpt");
+    const synth::Recording &virr = synth::find(recordings, "fengyun_virr");
+    std::vector<uint8_t> frame(208400 / 8 + 1);
+
+    bench.run("deframe/noaa_hrpt", hrpt.data.size(), [&] {
+        POESDeframer deframer(8, true);
+        return deframe(deframer, hrpt.data, frame.data());
+    });
+    bench.run("deframe/noaa_gac", gac.data.size(), [&] {
+        GACDeframer deframer(8, true);
+        return deframe(deframer, gac.data, frame.data());
+    });
+    bench.run("deframe/noaa_gac_reverse", gac_reverse.data.size(), [&] {
+        GACReverseDeframer deframer(8, true);
+        return deframe(deframer, gac_reverse.data, frame.data());
+    });
+    bench.run("deframe/meteor_hrpt", meteor.data.size(), [&] {
+        // Lines of MSU-MR, each transport frame carries 948 bytes of a 11850 byte frame
+        ccsds::Deframer deframer;
+        return deframe(deframer, meteor.data, frame.data()) * 948 / 11850;
+    });
+    std::vector<uint8_t> virr_stream = synth::mpdus(virr.data, 5);
+    bench.run("deframe/fengyun_virr", virr_stream.size(), [&] {
+        VIRRDeframer deframer(8, false);
+        return deframe(deframer, virr_stream, frame.data());
+    });
+
+    // Repacking and RawImage, from already deframed lines
+    std::vector<uint8_t> hrpt_frames;
+    {
+        POESDeframer deframer(8, true);
+        deframe(deframer, hrpt.data, frame.data(),
+                [&](const uint8_t *f) { hrpt_frames.insert(hrpt_frames.end(), f, &f[13862]); });
+    }
+    size_t hrpt_lines = hrpt_frames.size() / 13862;
+    std::vector<uint16_t> hrpt_words(hrpt_lines * 11090);
+    bench.run("repack10", hrpt_frames.size(), [&] {
+        for (size_t i = 0; i < hrpt_lines; i++) {
+            repack10(&hrpt_frames[i * 13862], &hrpt_words[i * 11090], 11090 - 3);
+        }
+        return hrpt_lines;
+    });
+    bench.run("rawimage/push16", hrpt_lines * 2048 * 5 * 2, [&] {
+        RawImage image(2048, 5);
+        for (size_t i = 0; i < hrpt_lines; i++) {
+            image.push16Bit(&hrpt_words[i * 11090], 750, 64);
+        }
+        return image.rows();
+    });
+
+    std::vector<uint8_t> virr_frames;
+    {
+        VIRRDeframer deframer(8, false);
+        deframe(deframer, virr_stream, frame.data(),
+                [&](const uint8_t *f) { virr_frames.insert(virr_frames.end(), f, &f[26050]); });
+    }
+    bench.run("rawimage/push10", virr_frames.size() / 26050 * 2048 * 10 * 10 / 8, [&] {
+        RawImage image(2048, 10);
+        for (size_t i = 0; i < virr_frames.size() / 26050; i++) {
+            image.push10Bit(&virr_frames[i * 26050], 349);
+        }
+        return image.rows();
+    });
+
+    // Demuxing
+    bench.run("demux/metop_ahrpt", ahrpt.data.size(), [&] {
+        ccsds::SimpleDemuxer demux;
+        size_t lines = 0;
+        for (size_t i = 0; i + 1024 <= ahrpt.data.size(); i += 1024) {
+            if ((ahrpt.data[i + 5] & 0b111111) != 9) continue;
+            lines += demux.work(&ahrpt.data[i]).size() == 12966;
+        }
+        return lines;
+    });
+    std::vector<std::vector<uint8_t>> lrpt_packets;
+    bench.require("demux/meteor_lrpt", lrpt.data.size(), [&] {
+        ccsds::Demuxer demux;
+        lrpt_packets.clear();
+        for (size_t i = 0; i + 1024 <= lrpt.data.size(); i += 1024) {
+            if ((lrpt.data[i + 5] & 0b111111) != 5) continue;
+            for (std::vector<uint8_t> &packet : demux.work(&lrpt.data[i])) {
+                ccsds::CPPDUHeader header(packet);
+                if (header.apid < 64 || header.apid > 69) continue;
+                // Packets come out of the demuxer in its (64KiB) buffer
+                packet.resize(6 + header.length);
+                lrpt_packets.push_back(std::move(packet));
+            }
+        }
+        // 14 packets of each of the 3 channels make up 8 lines
+        return lrpt_packets.size() / 42 * 8;
+    });
+    if (lrpt_packets.empty()) return;
+
+    // JPEG decompression
+    size_t lrpt_bytes = 0;
+    for (const std::vector<uint8_t> &packet : lrpt_packets) {
+        lrpt_bytes += packet.size();
+    }
+    std::vector<std::array<std::array<int16_t, 64>, MCU_PER_PACKET>> coefficients(lrpt_packets.size());
+    bench.require("huffman", lrpt_bytes, [&] {
+        size_t decoded = 0;
+        for (size_t i = 0; i < lrpt_packets.size(); i++) {
+            const std::vector<uint8_t> &packet = lrpt_packets[i];
+            decoded += huffman_decode(&packet[20], coefficients[i], MCU_PER_PACKET, ccsds::CPPDUHeader(packet).length - 6);
+        }
+        return decoded / 42 * 8;
+    });
+    std::vector<jpeg::block<uint8_t>> blocks(MCU_PER_PACKET);
+    bench.run("idct", coefficients.size() * MCU_PER_PACKET * 64, [&] {
+        for (const auto &packet : coefficients) {
+            for (size_t i = 0; i < MCU_PER_PACKET; i++) {
+                jpeg::decode_block(packet[i], blocks[i], 80);
+            }
+        }
+        return coefficients.size() / 42 * 8;
+    });
+}
+
+// Whole decoders and everything after them, for each imager
+void bench_decode(Bench &bench, const std::vector<synth::Recording> &recordings) {
+    std::map<std::string, std::unique_ptr<Decoder>> decoders;
+
+    for (const synth::Recording &recording : recordings) {
+        auto decode = [&] {
+            decoders[recording.name] = synth::decode(recording);
+            return decoders[recording.name]->get().imagers.at(recording.imager)->rows();
+        };
+
+        bench.require("decode/" + recording.name, recording.data.size(), decode);
+    }
+
+    // One recording per imager
+    for (std::string name : {"noaa_hrpt", "meteor_hrpt", "fengyun_virr"}) {
+        const synth::Recording &recording = synth::find(recordings, name);
+        Data data = decoders.at(name)->get();
+        RawImage *raw = data.imagers.at(recording.imager);
+        size_t width = raw->width();
+        size_t height = raw->rows();
+        size_t bytes = width * height * raw->channels() * sizeof(uint16_t);
+        if (height < 2) continue;
+
+        std::vector<QImage> channels;
+        bench.run(
+            "calibrate/" + name, bytes,
+            [&] {
+                Calibrator(data.caldata, data.ch3a).calibrate(recording.sat, recording.imager, channels);
+                return height;
+            },
+            [&] {
+                channels.assign(raw->channels(), QImage());
+                for (size_t i = 0; i < raw->channels(); i++) {
+                    channels[i] = QImage(width, height, QImage::Format_Grayscale16);
+                    for (size_t y = 0; y < height; y++) {
+                        std::memcpy(channels[i].scanLine(y), &raw->getChannel(i)[y * width], width * sizeof(uint16_t));
+                    }
+                }
+            });
+
+        ImageCompositor compositor;
+        compositor.ch3a = data.ch3a;
+        bench.require("import/" + name, bytes, [&] {
+            compositor.import(raw, recording.sat, recording.imager, data.caldata);
+            return height;
+        });
+
+        QImage composite;
+        bench.require("composite/" + name, width * height * 3 * sizeof(uint16_t), [&] {
+            compositor.getComposite(composite, {2, 2, 1});
+            return height;
+        });
+
+        QImage equalised;
+        bench.run(
+            "equalise/" + name, composite.sizeInBytes(),
+            [&] {
+                ImageCompositor::equalise(equalised, Equalization::Histogram, 1.0f, false);
+                return height;
+            },
+            [&] { equalised = composite.copy(); });
+
+        // 1km/px, the same as the CLI
+        auto points = synth::gcps(width, height);
+        QRectF bounds = map::bounds_crs(points, transform::CRS::Equirectangular);
+        double scale = EARTH_CIRCUMFERENCE / 1.0;
+        QSize size(bounds.width() * scale, bounds.height() * scale / 2.0);
+        bench.run("project/" + name, composite.sizeInBytes(), [&] {
+            map::Projection projection(composite, points, 31, size, transform::CRS::Equirectangular, bounds);
+            projection.render();
+            return height;
+        });
+    }
+}
+
+QJsonObject to_json(const std::map<std::string, Bench::Result> &results, size_t lines) {
+    QJsonObject benchmarks;
+    for (const auto &result : results) {
+        QJsonObject benchmark;
+        benchmark["seconds"] = result.second.seconds;
+        benchmark["bytes"] = (double)result.second.bytes;
+        benchmark["lines"] = (double)result.second.lines;
+        benchmark["mb_per_s"] = result.second.mb_per_s();
+        benchmark["lines_per_s"] = result.second.lines_per_s();
+        benchmarks[QString::fromStdString(result.first)] = benchmark;
+    }
+
+    return QJsonObject{{"lines", (double)lines}, {"threads", QThread::idealThreadCount()}, {"results", benchmarks}};
+}
+
+/// Compare throughput against a baseline, returns false if anything got slower by more than `tolerance`
+bool compare(const std::map<std::string, Bench::Result> &results, const QJsonObject &baseline, double tolerance) {
+    bool ok = true;
+    QJsonObject previous = baseline["results"].toObject();
+
+    std::printf("\n%-28s %12s %12s %8s\n", "Comparison", "Baseline", "Current", "Change");
+    for (const auto &result : results) {
+        QString name = QString::fromStdString(result.first);
+        if (!previous.contains(name)) continue;
+
+        double before = previous[name].toObject()["mb_per_s"].toDouble();
+        double after = result.second.mb_per_s();
+        if (before <= 0.0) continue;
+
+        double change = after / before - 1.0;
+        bool regression = change < -tolerance;
+        std::printf("%-28s %7.1f MB/s %7.1f MB/s %+7.1f%%%s\n", result.first.c_str(), before, after, change * 100.0,
+                    regression ? "  REGRESSION" : "");
+        ok &= !regression;
+    }
+
+    return ok;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("LeanHRPT Benchmarks");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks every stage of LeanHRPT with synthetic recordings");
+    parser.addHelpOption();
+    parser.addOption({"lines", "Number of lines in each recording (default 1000)", "n"});
+    parser.addOption({"repeat", "Number of times each benchmark is run, the fastest is kept (default 5)", "n"});
+    parser.addOption({"seed", "Seed of the synthetic recordings (default 1)", "n"});
+    parser.addOption({"filter", "Only run benchmarks matching a regular expression, e.g. \"^deframe/\"", "regex"});
+    parser.addOption({"output", "Write the results as JSON", "file"});
+    parser.addOption({"baseline", "Compare the results against a previous JSON output", "file"});
+    parser.addOption({"tolerance", "Slowdown in percent allowed before a benchmark is a regression (default 10)", "percent"});
+    parser.process(app);
+
+    size_t lines = parser.isSet("lines") ? parser.value("lines").toULong() : 1000;
+    size_t repeat = parser.isSet("repeat") ? parser.value("repeat").toULong() : 5;
+    uint32_t seed = parser.isSet("seed") ? parser.value("seed").toUInt() : 1;
+    double tolerance = parser.isSet("tolerance") ? parser.value("tolerance").toDouble() / 100.0 : 0.1;
+    QRegularExpression filter(parser.value("filter"));
+    if (lines < 8 || repeat == 0 || !filter.isValid()) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 1;
+    }
+
+    QJsonObject baseline;
+    if (parser.isSet("baseline")) {
+        QFile file(parser.value("baseline"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::cerr << "Could not open baseline" << std::endl;
+            return 1;
+        }
+        baseline = QJsonDocument::fromJson(file.readAll()).object();
+    }
+
+    std::cout << "Generating " << lines << " lines of every protocol" << std::endl;
+    std::vector<synth::Recording> recordings = synth::recordings(lines, seed);
+
+    Bench bench(repeat, filter);
+    bench_protocol(bench, recordings);
+    bench_decode(bench, recordings);
+
+    if (parser.isSet("output")) {
+        QSaveFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(to_json(bench.results(), lines)).toJson()) == -1 ||
+            !file.commit()) {
+            std::cerr << "Could not write results" << std::endl;
+            return 1;
+        }
+    }
+
+    if (parser.isSet("baseline")) {
+        return compare(bench.results(), baseline, tolerance) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "reference.h"
+
+#include <zlib.h>
+
+#include <QPolygonF>
+#include <QTransform>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+namespace reference {
+void repack10(const uint8_t *in, uint16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = 0;
+        for (size_t j = i * 10; j < i * 10 + 10; j++) {
+            out[i] = out[i] << 1 | ((in[j / 8] >> (7 - j % 8)) & 1);
+        }
+    }
+}
+
+void decode_block(const std::array<int16_t, 64> &in, jpeg::block<uint8_t> &out, uint8_t q) {
+    // Anything outside of this is ignored by the decoder
+    if (q < 20 || q > 100) return;
+
+    // clang-format off
+    const int qtable[8][8] = {
+        { 16, 11, 10, 16, 24,  40,  51,  61  },
+        { 12, 12, 14, 19, 26,  58,  60,  55  },
+        { 14, 13, 16, 24, 40,  57,  69,  56  },
+        { 14, 17, 22, 29, 51,  87,  80,  62  },
+        { 18, 22, 37, 56, 68,  109, 103, 77  },
+        { 24, 35, 55, 64, 81,  104, 113, 92  },
+        { 49, 64, 78, 87, 103, 121, 120, 101 },
+        { 72, 92, 95, 98, 112, 100, 103, 99  }
+    };
+    const int zigzag[8][8] = {
+        {  0,  1,  5,  6, 14, 15, 27, 28 },
+        {  2,  4,  7, 13, 16, 26, 29, 42 },
+        {  3,  8, 12, 17, 25, 30, 41, 43 },
+        {  9, 11, 18, 24, 31, 40, 44, 53 },
+        { 10, 19, 23, 32, 39, 45, 52, 54 },
+        { 20, 22, 33, 38, 46, 51, 55, 60 },
+        { 21, 34, 37, 47, 50, 56, 59, 61 },
+        { 35, 36, 48, 49, 57, 58, 62, 63 }
+    };
+    // clang-format on
+
+    // Unzigzag and dequantize, https://web.archive.org/web/20150223223556/http://meteor.robonuka.ru/for-experts/soft/
+    float f = q < 50 ? 5000.0f / q : 200.0f - 2.0f * q;
+    int16_t coefficients[8][8];
+    for (size_t v = 0; v < 8; v++) {
+        for (size_t u = 0; u < 8; u++) {
+            int factor = std::max<int>(std::round(f / 100.0f * qtable[v][u]), 1);
+            coefficients[v][u] = in[zigzag[v][u]] * factor;
+        }
+    }
+
+    // https://en.wikipedia.org/wiki/JPEG#Decoding
+    for (size_t y = 0; y < 8; y++) {
+        for (size_t x = 0; x < 8; x++) {
+            double sum = 0.0;
+            for (size_t v = 0; v < 8; v++) {
+                for (size_t u = 0; u < 8; u++) {
+                    double cu = u == 0 ? M_SQRT1_2 : 1.0;
+                    double cv = v == 0 ? M_SQRT1_2 : 1.0;
+                    sum += cu * cv * coefficients[v][u] * std::cos((2.0 * x + 1.0) * u * M_PI / 16.0) *
+                           std::cos((2.0 * y + 1.0) * v * M_PI / 16.0);
+                }
+            }
+
+            out[y][x] = std::min(std::max(sum / 4.0 + 128.0, 0.0), 255.0);
+        }
+    }
+}
+
+std::vector<std::vector<uint8_t>> deframe(const std::vector<uint8_t> &data, uint64_t sync, size_t sync_size, size_t frame_size) {
+    std::vector<std::vector<uint8_t>> frames;
+    uint64_t mask = sync_size == 64 ? UINT64_MAX : (uint64_t(1) << sync_size) - 1;
+    uint64_t shifter = 0;
+    size_t bits = data.size() * 8;
+    // Sync words inside of a frame are ignored
+    size_t next = sync_size - 1;
+
+    for (size_t i = 0; i < bits; i++) {
+        shifter = shifter << 1 | ((data[i / 8] >> (7 - i % 8)) & 1);
+        if (i < next || (shifter & mask) != sync) continue;
+
+        // The sync word ends at bit `i`
+        size_t start = i + 1 - sync_size;
+        if (start + frame_size > bits) break;
+
+        std::vector<uint8_t> frame(frame_size / 8);
+        for (size_t j = 0; j < frame.size() * 8; j++) {
+            size_t x = start + j;
+            frame[j / 8] = frame[j / 8] << 1 | ((data[x / 8] >> (7 - x % 8)) & 1);
+        }
+        frames.push_back(std::move(frame));
+        next = start + frame_size;
+    }
+
+    return frames;
+}
+
+double solar_zenith(double latitude, double longitude, const std::array<double, 3> &sun) {
+    std::array<double, 3> normal = {std::cos(latitude) * std::cos(longitude), std::cos(latitude) * std::sin(longitude),
+                                    std::sin(latitude)};
+    std::array<double, 3> cross = {normal[1] * sun[2] - normal[2] * sun[1], normal[2] * sun[0] - normal[0] * sun[2],
+                                   normal[0] * sun[1] - normal[1] * sun[0]};
+    double dot = normal[0] * sun[0] + normal[1] * sun[1] + normal[2] * sun[2];
+    return std::atan2(std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]), dot);
+}
+
+std::vector<QLineF> query(const std::vector<QLineF> &segments, const QRectF &rect) {
+    std::vector<QLineF> found;
+    for (const QLineF &segment : segments) {
+        if (std::min(segment.x1(), segment.x2()) <= rect.right() && std::max(segment.x1(), segment.x2()) >= rect.left() &&
+            std::min(segment.y1(), segment.y2()) <= rect.bottom() && std::max(segment.y1(), segment.y2()) >= rect.top()) {
+            found.push_back(segment);
+        }
+    }
+    return found;
+}
+
+// Bilinearly sample an RGBA64 image, anything outside of the image or partially transparent is transparent
+static QRgba64 sample(const QImage &image, QPointF point) {
+    double x = point.x();
+    double y = point.y();
+    if (!(x >= 0.0 && y >= 0.0 && x <= image.width() - 1 && y <= image.height() - 1)) return QRgba64::fromRgba64(0);
+
+    int x0 = std::floor(x);
+    int y0 = std::floor(y);
+    int xs[2] = {x0, std::min(x0 + 1, image.width() - 1)};
+    int ys[2] = {y0, std::min(y0 + 1, image.height() - 1)};
+    double wx[2] = {1.0 - (x - x0), x - x0};
+    double wy[2] = {1.0 - (y - y0), y - y0};
+
+    double c[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t j = 0; j < 2; j++) {
+        for (size_t i = 0; i < 2; i++) {
+            QRgba64 pixel = ((const QRgba64 *)image.constScanLine(ys[j]))[xs[i]];
+            double w = wx[i] * wy[j];
+            c[0] += pixel.red() * w;
+            c[1] += pixel.green() * w;
+            c[2] += pixel.blue() * w;
+            c[3] += pixel.alpha() * w;
+        }
+    }
+    if (std::lround(c[3]) != 65535) return QRgba64::fromRgba64(0);
+
+    return QRgba64::fromRgba64(std::lround(c[0]), std::lround(c[1]), std::lround(c[2]), 65535);
+}
+
+QImage project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
+               transform::CRS crs, QRectF bounds) {
+    QImage source = image.convertToFormat(QImage::Format_RGBA64);
+    QImage projected(resolution, QImage::Format_RGBA64);
+    projected.fill(Qt::transparent);
+    if (xn < 2 || points.size() < xn * 2) return projected;
+
+    size_t yn = points.size() / xn;
+    for (size_t y = 0; y < yn - 1; y++) {
+        for (size_t x = 0; x < xn - 1; x++) {
+            size_t vertices[4] = {y * xn + x, y * xn + x + 1, (y + 1) * xn + x + 1, (y + 1) * xn + x};
+
+            QPolygonF geo, px;
+            for (size_t vertex : vertices) {
+                geo << QPointF(points[vertex].second.longitude, points[vertex].second.latitude);
+                px << QPointF(points[vertex].first.first, points[vertex].first.second);
+            }
+            if (geo.boundingRect().width() > M_PI) {
+                for (QPointF &corner : geo) {
+                    if (corner.x() < 0.0) corner.rx() += 2.0 * M_PI;
+                }
+            }
+
+            // Corners in output pixels, with pixel centers on integers
+            QPolygonF quad;
+            for (const QPointF &corner : geo) {
+                transform::XY point = transform::forward(corner, crs);
+                quad << QPointF((point.x() - bounds.x()) / bounds.width() * resolution.width() - 0.5,
+                                (point.y() - bounds.y()) / bounds.height() * resolution.height() - 0.5);
+            }
+            QRectF box = quad.boundingRect();
+            QTransform trans;
+            if (!std::isfinite(box.width()) || !std::isfinite(box.height()) || !QTransform::quadToQuad(quad, px, trans)) {
+                continue;
+            }
+
+            int top = std::max(std::floor(box.top()), 0.0);
+            int bottom = std::min(std::ceil(box.bottom()), resolution.height() - 1.0);
+            int left = std::max(std::floor(box.left()), 0.0);
+            int right = std::min(std::ceil(box.right()), resolution.width() - 1.0);
+            for (int i = top; i <= bottom; i++) {
+                for (int j = left; j <= right; j++) {
+                    QPointF point(j, i);
+                    if (quad.containsPoint(point, Qt::OddEvenFill)) {
+                        ((QRgba64 *)projected.scanLine(i))[j] = sample(source, trans.map(point));
+                    }
+                }
+            }
+        }
+    }
+
+    return projected;
+}
+
+// Little endian integers from a file
+static uint64_t get_le(const std::vector<uint8_t> &file, uint64_t offset, size_t bytes) {
+    uint64_t x = 0;
+    for (size_t i = 0; i < bytes && offset + i < file.size(); i++) {
+        x |= (uint64_t)file[offset + i] << (i * 8);
+    }
+    return x;
+}
+
+std::vector<QImage> read_tiff(const std::string &filename) {
+    std::ifstream stream(filename, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if (file.size() < 16 || file[0] != 'I' || file[1] != 'I') return {};
+
+    bool bigtiff = get_le(file, 2, 2) == 43;
+    if (!bigtiff && get_le(file, 2, 2) != 42) return {};
+    size_t count_size = bigtiff ? 8 : 2;
+    size_t entry_size = bigtiff ? 20 : 12;
+    size_t value_size = bigtiff ? 8 : 4;
+    uint64_t ifd = bigtiff ? get_le(file, 8, 8) : get_le(file, 4, 4);
+
+    std::vector<QImage> images;
+    // Overviews halve the size every time, so there are never this many
+    while (ifd != 0 && images.size() < 64) {
+        if (ifd + count_size > file.size()) return {};
+        uint64_t entries = get_le(file, ifd, count_size);
+        if (ifd + count_size + entries * entry_size + value_size > file.size()) return {};
+
+        // Every integer value of every tag
+        std::map<uint16_t, std::vector<uint64_t>> tags;
+        for (uint64_t i = 0; i < entries; i++) {
+            uint64_t entry = ifd + count_size + i * entry_size;
+            uint16_t tag = get_le(file, entry, 2);
+            uint16_t type = get_le(file, entry + 2, 2);
+            uint64_t count = get_le(file, entry + 4, value_size);
+
+            size_t size = type == 3 ? 2 : (type == 4 ? 4 : (type == 16 ? 8 : 0));
+            if (size == 0) continue;
+            uint64_t offset = count * size > value_size ? get_le(file, entry + 4 + value_size, value_size)
+                                                        : entry + 4 + value_size;
+            if (offset + count * size > file.size()) return {};
+            for (uint64_t j = 0; j < count; j++) {
+                tags[tag].push_back(get_le(file, offset + j * size, size));
+            }
+        }
+        ifd = get_le(file, ifd + count_size + entries * entry_size, value_size);
+
+        for (uint16_t tag : {256, 257, 258, 259, 277, 317, 322, 323, 324, 325}) {
+            if (tags[tag].empty()) return {};
+        }
+        size_t width = tags[256][0];
+        size_t height = tags[257][0];
+        size_t bits = tags[258][0];
+        size_t tile_width = tags[322][0];
+        size_t tile_height = tags[323][0];
+        if (tags[259][0] != 8 || tags[277][0] != 4 || tags[317][0] != 2 || (bits != 8 && bits != 16)) return {};
+
+        size_t across = (width + tile_width - 1) / tile_width;
+        size_t down = (height + tile_height - 1) / tile_height;
+        if (tags[324].size() != across * down || tags[325].size() != across * down) return {};
+
+        QImage image(width, height, QImage::Format_RGBA64);
+        std::vector<uint8_t> raw(tile_width * tile_height * 4 * bits / 8);
+        for (size_t t = 0; t < across * down; t++) {
+            uint64_t offset = tags[324][t];
+            uint64_t size = tags[325][t];
+            uLongf length = raw.size();
+            if (offset + size > file.size() || uncompress(raw.data(), &length, &file[offset], size) != Z_OK ||
+                length != raw.size()) {
+                return {};
+            }
+
+            size_t tx = t % across * tile_width;
+            size_t ty = t / across * tile_height;
+            for (size_t y = 0; y < tile_height && ty + y < height; y++) {
+                // Undo the horizontal differencing
+                uint16_t samples[4] = {0, 0, 0, 0};
+                QRgba64 *line = (QRgba64 *)image.scanLine(ty + y);
+                for (size_t x = 0; x < tile_width; x++) {
+                    for (size_t c = 0; c < 4; c++) {
+                        size_t i = (y * tile_width + x) * 4 + c;
+                        samples[c] += bits == 8 ? raw[i] : get_le(raw, i * 2, 2);
+                        if (bits == 8) samples[c] &= 0xFF;
+                    }
+                    if (tx + x >= width) continue;
+
+                    int scale = bits == 8 ? 257 : 1;
+                    line[tx + x] = QRgba64::fromRgba64(samples[0] * scale, samples[1] * scale, samples[2] * scale,
+                                                       samples[3] * scale);
+                }
+            }
+        }
+        images.push_back(image);
+    }
+
+    return images;
+}
+}  // namespace reference
@@ -0,0 +1,85 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_BENCHMARKS_REFERENCE_H_
+#define LEANHRPT_BENCHMARKS_REFERENCE_H_
+
+#include <QImage>
+#include <QLineF>
+#include <QRectF>
+#include <QSize>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geo/crs.h"
+#include "projection.h"
+#include "protocol/lrpt/jpeg.h"
+
+/**
+ * Straightforward (slow) implementations of the kernels in the decoding chain
+ *
+ * These are written for readability rather than speed, and are what the
+ * real kernels are checked against by `LeanHRPT-Verify`.
+ */
+namespace reference {
+/// Unpack 10 bit words one bit at a time, see `repack10()`
+void repack10(const uint8_t *in, uint16_t *out, size_t n);
+
+/// Decode a JPEG block with a textbook double precision IDCT, see `jpeg::decode_block()`
+void decode_block(const std::array<int16_t, 64> &in, jpeg::block<uint8_t> &out, uint8_t q);
+
+/**
+ * Find every frame that starts with an exact copy of a sync word
+ *
+ * Frames are `frame_size` bits long (including the sync word), only the
+ * whole bytes of each frame are returned, the same as `ArbitraryDeframer`.
+ */
+std::vector<std::vector<uint8_t>> deframe(const std::vector<uint8_t> &data, uint64_t sync, size_t sync_size, size_t frame_size);
+
+/// Solar zenith angle (in radians) of a point on the ground, from the angle between its normal and the sun
+double solar_zenith(double latitude, double longitude, const std::array<double, 3> &sun);
+
+/// Every segment whose bounding box overlaps `rect`, checked one by one, see `map::SegmentIndex::query()`
+std::vector<QLineF> query(const std::vector<QLineF> &segments, const QRectF &rect);
+
+/**
+ * Project a pass by testing every pixel in the bounding box of each cell with `QPolygonF::containsPoint()`
+ *
+ * This is how passes were rendered before `map::Projection` rasterized
+ * cells with scanlines. Only cells that are drawn directly are supported,
+ * so the pass has to stay away from the poles (and the far side of polar
+ * projections).
+ */
+QImage project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
+               transform::CRS crs, QRectF bounds);
+
+/**
+ * Read every image (the full resolution image and then its overviews) of a tiled TIFF as RGBA64
+ *
+ * Only what `GeoTiffWriter` writes is supported: little endian (Big)TIFF
+ * with 8 or 16 bit RGBA tiles, DEFLATE compressed with horizontal
+ * differencing. Nothing is returned if the file can't be read.
+ */
+std::vector<QImage> read_tiff(const std::string &filename);
+}  // namespace reference
+
+#endif
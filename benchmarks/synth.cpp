@@ -0,0 +1,571 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "synth.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <random>
+#include <streambuf>
+
+#include "decoders/noaa_gac.h"
+#include "protocol/lrpt/packet.h"
+
+namespace synth {
+namespace {
+const uint64_t POES_ASM = 0b101000010001011011111101011100011001110110000011110010010101;
+const uint64_t POES_ASM_REVERSE = 0b010011001111000011111001001010011011001001001000101010011110;
+const uint32_t CCSDS_ASM = 0x1ACFFC1D;
+const uint64_t MSUMR_ASM = 0x0218A7A392DD9ABF;
+
+const size_t CADU_SIZE = 1024;
+const size_t MPDU_SIZE = 882;
+
+// Start of every pass, 12:00 UTC
+const uint32_t START_MS = 12 * 3600 * 1000;
+
+/// Exposes a block of memory as a stream, so decoders can read it without a copy
+class MemoryBuffer : public std::streambuf {
+   public:
+    MemoryBuffer(const std::vector<uint8_t> &data) {
+        char *begin = (char *)data.data();
+        setg(begin, begin, begin + data.size());
+    }
+
+   protected:
+    // Only telling the position, which the decoders use to count bytes
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::in)) return pos_type(off_type(-1));
+        return pos_type(off_type(gptr() - eback()));
+    }
+};
+
+/// Writes bits (MSB first) onto the end of a vector
+class BitWriter {
+   public:
+    BitWriter(std::vector<uint8_t> &out) : d_out(out) {}
+
+    /// Push the lowest `bits` bits of `value`
+    void push(uint64_t value, size_t bits) {
+        for (size_t i = bits; i-- > 0;) {
+            push_bit((value >> i) & 1);
+        }
+    }
+    void push_bit(bool bit) {
+        d_byte = d_byte << 1 | bit;
+        if (++d_bits == 8) {
+            d_out.push_back(d_byte);
+            d_byte = 0;
+            d_bits = 0;
+        }
+    }
+    /// Pad with zeros up to the next byte boundary
+    void flush() {
+        while (d_bits != 0) push_bit(false);
+    }
+
+   private:
+    std::vector<uint8_t> &d_out;
+    uint8_t d_byte = 0;
+    size_t d_bits = 0;
+};
+
+/// Overwrite `bits` bits starting at bit `pos`
+void set_bits(uint8_t *data, size_t pos, uint64_t value, size_t bits) {
+    for (size_t i = 0; i < bits; i++) {
+        size_t x = pos + i;
+        bool bit = (value >> (bits - 1 - i)) & 1;
+        data[x / 8] = (data[x / 8] & ~(0x80 >> x % 8)) | (bit << (7 - x % 8));
+    }
+}
+
+/// 10 bit imagery that vaguely resembles a scene (so equalization and compression have something to work with)
+class Scene {
+   public:
+    Scene(uint32_t seed) : rng(seed) {}
+
+    uint16_t operator()(size_t x, size_t y, size_t ch) {
+        double value = 512.0 + 320.0 * std::sin(x / 97.0 + ch) * std::cos(y / 53.0 - ch * 0.5) + noise(rng);
+        return std::min(std::max(value, 0.0), 1023.0);
+    }
+    /// A random number in [0, n)
+    uint32_t random(uint32_t n) { return rng() % n; }
+
+   private:
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> noise{-24.0, 24.0};
+};
+
+/**
+ * A NOAA HRPT/GAC frame of 10 bit words (without randomization)
+ *
+ * @param size Number of words in a frame
+ * @param minor_frames Number of TIP/AIP minor frames
+ * @param avhrr Offset of the AVHRR data
+ * @param width Width of the AVHRR data
+ */
+std::vector<uint16_t> poes_frame(Scene &scene, size_t line, double interval, size_t size, size_t minor_frames, size_t avhrr,
+                                 size_t width) {
+    std::vector<uint16_t> frame(size);
+    for (size_t i = 0; i < 6; i++) {
+        frame[i] = (POES_ASM >> (50 - i * 10)) & 0x3FF;
+    }
+
+    // Frame type (alternating TIP and AIP), channel 3B
+    frame[6] = (line % 2 ? 3 : 1) << 7;
+
+    // Day of year and millisecond of day
+    uint32_t ms = START_MS + line * interval * 1000.0;
+    frame[8] = 200 << 1;
+    frame[9] = (ms >> 20) & 0x7F;
+    frame[10] = (ms >> 10) & 0x3FF;
+    frame[11] = ms & 0x3FF;
+
+    // PRTs, internal target and space view
+    for (size_t i = 0; i < 3; i++) {
+        frame[17 + i] = 400 + scene.random(8);
+    }
+    for (size_t i = 0; i < 30; i++) {
+        frame[22 + i] = 600 + scene.random(16);
+    }
+    for (size_t i = 0; i < 50; i++) {
+        frame[52 + i] = (i % 5 < 2 ? 40 : 980) + scene.random(4);
+    }
+
+    // TIP/AIP minor frames, 8 bit words with even parity
+    for (size_t i = 0; i < minor_frames; i++) {
+        for (size_t j = 0; j < 104; j++) {
+            uint8_t byte = j == 4 ? (line * minor_frames + i) % 80 : scene.random(256);
+            bool parity = std::bitset<8>(byte).count() % 2;
+            frame[103 + i * 104 + j] = byte << 2 | parity << 1;
+        }
+    }
+
+    for (size_t x = 0; x < width; x++) {
+        for (size_t ch = 0; ch < 5; ch++) {
+            frame[avhrr + x * 5 + ch] = scene(x, line, ch);
+        }
+    }
+
+    return frame;
+}
+
+/// Write a CCSDS source packet header, `size` includes the header
+void packet_header(uint8_t *packet, uint16_t apid, uint16_t counter, size_t size) {
+    // Version 0, telemetry, secondary header present (apart from idle packets)
+    packet[0] = (apid == 2047 ? 0x00 : 0x08) | apid >> 8;
+    packet[1] = apid & 0xFF;
+    // Unsegmented
+    packet[2] = 0b11 << 6 | (counter >> 8 & 0x3F);
+    packet[3] = counter & 0xFF;
+    packet[4] = (size - 7) >> 8;
+    packet[5] = (size - 7) & 0xFF;
+}
+
+/// A CADU with an (empty) insert zone and a M_PDU
+void cadu(std::vector<uint8_t> &out, uint8_t scid, uint8_t vcid, uint32_t counter, uint16_t fhp, const uint8_t *mpdu) {
+    size_t offset = out.size();
+    out.resize(offset + CADU_SIZE);
+    uint8_t *ptr = &out[offset];
+
+    for (size_t i = 0; i < 4; i++) {
+        ptr[i] = CCSDS_ASM >> (24 - i * 8);
+    }
+    ptr[4] = 0b01 << 6 | scid >> 2;
+    ptr[5] = (scid & 0b11) << 6 | vcid;
+    ptr[6] = counter >> 16;
+    ptr[7] = counter >> 8;
+    ptr[8] = counter;
+    ptr[12] = fhp >> 8 & 0b111;
+    ptr[13] = fhp & 0xFF;
+    std::memcpy(&ptr[14], mpdu, MPDU_SIZE);
+}
+
+/// Pack source packets back to back into CADUs
+std::vector<uint8_t> packetize(const std::vector<std::vector<uint8_t>> &packets, uint8_t scid, uint8_t vcid) {
+    std::vector<uint8_t> stream;
+    std::vector<size_t> starts;
+    for (const std::vector<uint8_t> &packet : packets) {
+        starts.push_back(stream.size());
+        stream.insert(stream.end(), packet.begin(), packet.end());
+    }
+
+    // Fill the last frame with an idle packet, the demuxers only finish a packet once the next one starts
+    size_t fill = MPDU_SIZE - stream.size() % MPDU_SIZE;
+    if (fill < 7) fill += MPDU_SIZE;
+    starts.push_back(stream.size());
+    stream.resize(stream.size() + fill);
+    packet_header(&stream[starts.back()], 2047, 0, fill);
+
+    std::vector<uint8_t> out;
+    out.reserve(stream.size() / MPDU_SIZE * CADU_SIZE);
+    auto start = starts.begin();
+    for (size_t i = 0; i < stream.size() / MPDU_SIZE; i++) {
+        start = std::lower_bound(start, starts.end(), i * MPDU_SIZE);
+        uint16_t fhp = (start != starts.end() && *start < (i + 1) * MPDU_SIZE) ? *start - i * MPDU_SIZE : 2047;
+        cadu(out, scid, vcid, i, fhp, &stream[i * MPDU_SIZE]);
+    }
+
+    return out;
+}
+
+/// Pack a bitstream (such as VIRR or MSU-MR frames) into CADUs
+std::vector<uint8_t> cadus(const std::vector<uint8_t> &stream, uint8_t scid, uint8_t vcid) {
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> mpdu(MPDU_SIZE);
+    for (size_t i = 0; i < stream.size(); i += MPDU_SIZE) {
+        size_t n = std::min(MPDU_SIZE, stream.size() - i);
+        std::fill(mpdu.begin(), mpdu.end(), 0);
+        std::memcpy(mpdu.data(), &stream[i], n);
+        cadu(out, scid, vcid, i / MPDU_SIZE, 2047, mpdu.data());
+    }
+    return out;
+}
+
+/// Huffman encode 14 MCUs of a single LRPT channel, see `huffman_decode()`
+void lrpt_mcus(BitWriter &w, Scene &scene, size_t x, size_t y, size_t ch) {
+    int dc = 0;
+    for (size_t i = 0; i < MCU_PER_PACKET; i++) {
+        // Move the DC coefficient towards the scene, at most 3 steps per block
+        int target = (scene((x + i) * 8, y, ch) - 512) / 16;
+        int diff = std::min(std::max(target - dc, -3), 3);
+        dc += diff;
+        if (diff == 0) {
+            w.push(0b00, 2);
+        } else if (std::abs(diff) == 1) {
+            w.push(0b010, 3);
+            w.push(diff > 0, 1);
+        } else {
+            w.push(0b011, 3);
+            w.push(diff > 0 ? diff : diff + 3, 2);
+        }
+
+        // Some small AC coefficients (categories 1 to 3 with no zero run), then EOB
+        size_t n = scene.random(24);
+        for (size_t j = 0; j < n; j++) {
+            switch (scene.random(3)) {
+                case 0:
+                    w.push(0b00, 2);
+                    w.push(scene.random(2), 1);
+                    break;
+                case 1:
+                    w.push(0b01, 2);
+                    w.push(scene.random(4), 2);
+                    break;
+                default:
+                    w.push(0b100, 3);
+                    w.push(scene.random(8), 3);
+                    break;
+            }
+        }
+        w.push(0b1010, 4);
+    }
+}
+}  // namespace
+
+std::vector<uint8_t> noaa_hrpt(size_t lines, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<uint8_t> out;
+    out.reserve(lines * 110900 / 8 + 1);
+    BitWriter w(out);
+
+    for (size_t line = 0; line < lines; line++) {
+        for (uint16_t word : poes_frame(scene, line, 1.0 / 6.0, 11090, 5, 750, 2048)) {
+            w.push(word, 10);
+        }
+    }
+    w.flush();
+
+    return out;
+}
+
+std::vector<uint8_t> noaa_gac(size_t lines, bool reverse, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<uint8_t> out;
+    out.reserve(lines * 33270 / 8 + 1);
+    BitWriter w(out);
+
+    // Two bits of padding, so that the frame can be reversed in whole bytes (see `NOAAGACDecoder::work()`)
+    std::vector<bool> frame(33272);
+    for (size_t line = 0; line < lines; line++) {
+        std::vector<uint16_t> words = poes_frame(scene, line, 0.5, 3327, 10, 1182, 409);
+        for (size_t i = 0; i < 33270; i++) {
+            frame[i] = (words[i / 10] >> (9 - i % 10)) & 1;
+        }
+        // Everything after the sync word is XORed with a PN sequence
+        for (size_t i = 60; i < 33270; i++) {
+            size_t j = (i - 60) % 1023;
+            frame[i] = frame[i] ^ std::bitset<8>(gac_pattern[j / 8]).test(7 - j % 8);
+        }
+
+        if (reverse) {
+            w.push(POES_ASM_REVERSE, 60);
+            for (size_t i = 60; i < 33270; i++) {
+                w.push_bit(frame[33271 - i]);
+            }
+        } else {
+            for (size_t i = 0; i < 33270; i++) {
+                w.push_bit(frame[i]);
+            }
+        }
+    }
+    w.flush();
+
+    return out;
+}
+
+std::vector<uint8_t> metop_ahrpt(size_t lines, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<std::vector<uint8_t>> packets;
+
+    std::vector<uint16_t> words(10355);
+    for (size_t line = 0; line < lines; line++) {
+        std::vector<uint8_t> packet(20);
+        packet.reserve(12966);
+
+        // Days since 01/01/2000 and millisecond of day
+        uint32_t ms = START_MS + line * 1000 / 6;
+        packet[6] = 8600 >> 8;
+        packet[7] = 8600 & 0xFF;
+        for (size_t i = 0; i < 4; i++) {
+            packet[8 + i] = ms >> (24 - i * 8);
+        }
+
+        // Space view, earth view, PRTs and back scan
+        std::fill(words.begin(), words.end(), 0);
+        for (size_t i = 0; i < 50; i++) {
+            words[i] = (i % 5 < 2 ? 40 : 980) + scene.random(4);
+        }
+        for (size_t x = 0; x < 2048; x++) {
+            for (size_t ch = 0; ch < 5; ch++) {
+                words[55 + x * 5 + ch] = scene(x, line, ch);
+            }
+        }
+        for (size_t i = 0; i < 3; i++) {
+            words[10297 + i] = 400 + scene.random(8);
+        }
+        for (size_t i = 0; i < 50; i++) {
+            words[10305 + i] = 600 + scene.random(16);
+        }
+
+        BitWriter w(packet);
+        for (uint16_t word : words) {
+            w.push(word, 10);
+        }
+        w.flush();
+        packet.resize(12966);
+
+        // Channel 3B
+        packet_header(packet.data(), 104, line, packet.size());
+        packets.push_back(std::move(packet));
+    }
+
+    return packetize(packets, 12, 9);
+}
+
+std::vector<uint8_t> meteor_hrpt(size_t lines, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<uint8_t> msumr;
+    msumr.reserve(lines * 11850);
+    BitWriter w(msumr);
+
+    for (size_t line = 0; line < lines; line++) {
+        size_t start = msumr.size();
+        w.push(MSUMR_ASM, 64);
+
+        // Time of day in Moscow time
+        uint32_t seconds = START_MS / 1000 + 3 * 3600 + line / 6;
+        w.push(seconds / 3600 % 24, 8);
+        w.push(seconds / 60 % 60, 8);
+        w.push(seconds % 60, 8);
+        msumr.resize(start + 35);
+
+        // Calibration, white/black levels of the visible channels and space/blackbody of the IR channels
+        for (size_t i = 0; i < 12; i++) {
+            w.push((i < 6 ? (i % 2 ? 40 : 900) : (i % 2 ? 300 : 1000)) + scene.random(4), 10);
+        }
+
+        // Interleaved in chunks of 4 pixels
+        for (size_t x = 0; x < 1572; x += 4) {
+            for (size_t ch = 0; ch < 6; ch++) {
+                for (size_t i = 0; i < 4; i++) {
+                    w.push(scene(x + i, line, ch), 10);
+                }
+            }
+        }
+        msumr.resize(start + 11850);
+    }
+
+    // Each transport frame carries 948 bytes of MSU-MR data, split into 4 parts (see `MeteorHRPTDecoder::frame_work()`)
+    const size_t offsets[4] = {22, 278, 534, 790};
+    const size_t sizes[4] = {238, 238, 238, 234};
+    std::vector<uint8_t> out;
+    out.reserve((msumr.size() / 948 + 1) * CADU_SIZE);
+    for (size_t i = 0; i < msumr.size(); i += 948) {
+        size_t offset = out.size();
+        out.resize(offset + CADU_SIZE);
+        uint8_t *ptr = &out[offset];
+        for (size_t j = 0; j < 4; j++) {
+            ptr[j] = CCSDS_ASM >> (24 - j * 8);
+        }
+
+        size_t pos = i;
+        for (size_t j = 0; j < 4 && pos < msumr.size(); j++) {
+            size_t n = std::min(sizes[j], msumr.size() - pos);
+            std::memcpy(&ptr[offsets[j]], &msumr[pos], n);
+            pos += n;
+        }
+    }
+
+    return out;
+}
+
+std::vector<uint8_t> meteor_lrpt(size_t lines, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<std::vector<uint8_t>> packets;
+    uint16_t counter = 0;
+
+    auto calibration = [&](uint32_t ms) {
+        std::vector<uint8_t> packet(49);
+        for (size_t i = 0; i < 4; i++) {
+            packet[6 + 2 + i] = ms >> (24 - i * 8);
+        }
+        BitWriter w(packet);
+        for (size_t i = 0; i < 12; i++) {
+            w.push((i < 6 ? (i % 2 ? 40 : 900) : (i % 2 ? 300 : 1000)) + scene.random(4), 10);
+        }
+        packet_header(packet.data(), 70, counter++ & 0x3FFF, packet.size());
+        packets.push_back(std::move(packet));
+    };
+
+    // The decoder starts counting lines from the first APID 70 packet
+    calibration(START_MS);
+    for (size_t y = 0; y < lines; y += 8) {
+        uint32_t ms = START_MS + y / 8 * 1640;
+        for (size_t ch = 0; ch < 3; ch++) {
+            for (size_t mcu = 0; mcu < 196; mcu += MCU_PER_PACKET) {
+                std::vector<uint8_t> packet(20);
+                for (size_t i = 0; i < 4; i++) {
+                    packet[6 + 2 + i] = ms >> (24 - i * 8);
+                }
+                packet[6 + 8] = mcu;
+                packet[6 + 13] = 80;
+
+                BitWriter w(packet);
+                lrpt_mcus(w, scene, mcu, y, ch);
+                w.flush();
+                // The Huffman decoder reads up to 32 bits ahead
+                packet.resize(packet.size() + 4);
+
+                packet_header(packet.data(), 64 + ch, counter++ & 0x3FFF, packet.size());
+                packets.push_back(std::move(packet));
+            }
+        }
+        calibration(ms);
+    }
+
+    return packetize(packets, 5, 5);
+}
+
+std::vector<uint8_t> fengyun_virr(size_t lines, uint32_t seed) {
+    Scene scene(seed);
+    std::vector<uint8_t> virr;
+    virr.reserve(lines * 26050);
+    BitWriter w(virr);
+
+    for (size_t line = 0; line < lines; line++) {
+        size_t start = virr.size();
+        w.push(POES_ASM, 60);
+        for (size_t i = 6; i < 349; i++) {
+            w.push(0, 10);
+        }
+        for (size_t x = 0; x < 2048; x++) {
+            for (size_t ch = 0; ch < 10; ch++) {
+                w.push(scene(x, line, ch), 10);
+            }
+        }
+        w.flush();
+        virr.resize(start + 26050);
+
+        // Days since launch and millisecond of day (offset by 12 hours), see `FengyunHRPTDecoder::frame_work()`
+        uint32_t ms = line * 1000 / 6;
+        set_bits(&virr[start], 26041 * 8 + 2 + 14, 3000, 12);
+        set_bits(&virr[start], 26041 * 8 + 2 + 30, ms, 26);
+    }
+
+    return cadus(virr, 12, 5);
+}
+
+std::vector<Recording> recordings(size_t lines, uint32_t seed) {
+    return {
+        {"noaa_hrpt", Protocol::HRPT, SatID::NOAA19, FileType::Raw, Imager::AVHRR, lines, noaa_hrpt(lines, seed)},
+        {"noaa_gac", Protocol::GAC, SatID::NOAA19, FileType::Raw, Imager::AVHRR, lines, noaa_gac(lines, false, seed)},
+        {"noaa_gac_reverse", Protocol::GACReverse, SatID::NOAA19, FileType::Raw, Imager::AVHRR, lines,
+         noaa_gac(lines, true, seed)},
+        {"metop_ahrpt", Protocol::AHRPT, SatID::MetOpB, FileType::CADU, Imager::AVHRR, lines, metop_ahrpt(lines, seed)},
+        {"meteor_hrpt", Protocol::MeteorHRPT, SatID::MeteorM22, FileType::Raw, Imager::MSUMR, lines, meteor_hrpt(lines, seed)},
+        {"meteor_lrpt", Protocol::LRPT, SatID::MeteorM22, FileType::CADU, Imager::MSUMR, (lines + 7) / 8 * 8,
+         meteor_lrpt(lines, seed)},
+        {"fengyun_virr", Protocol::FengYunHRPT, SatID::FengYun3C, FileType::CADU, Imager::VIRR, lines,
+         fengyun_virr(lines, seed)},
+    };
+}
+
+const Recording &find(const std::vector<Recording> &recordings, const std::string &name) {
+    return *std::find_if(recordings.begin(), recordings.end(), [&](const Recording &r) { return r.name == name; });
+}
+
+std::unique_ptr<Decoder> decode(const Recording &recording) {
+    std::unique_ptr<Decoder> decoder(Decoder::make(recording.protocol, recording.sat));
+    MemoryBuffer buffer(recording.data);
+    std::istream stream(&buffer);
+    decoder->decodeStream(stream, recording.type);
+    return decoder;
+}
+
+std::vector<uint8_t> mpdus(const std::vector<uint8_t> &cadus, uint8_t vcid) {
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i + CADU_SIZE <= cadus.size(); i += CADU_SIZE) {
+        if ((cadus[i + 5] & 0b111111) == vcid) out.insert(out.end(), &cadus[i + 14], &cadus[i + 14 + MPDU_SIZE]);
+    }
+    return out;
+}
+
+std::vector<std::pair<xy, Geodetic>> gcps(size_t width, size_t height, size_t xn, size_t yn) {
+    std::vector<std::pair<xy, Geodetic>> points;
+    points.reserve(xn * yn);
+
+    for (size_t j = 0; j < yn; j++) {
+        double v = (double)j / (double)(yn - 1);
+        double lat = 62.0 - 26.0 * v;
+        double lon = 12.0 - 6.0 * v;
+        for (size_t i = 0; i < xn; i++) {
+            double u = (double)i / (double)(xn - 1);
+            // About 2900km across
+            double scan = (u - 0.5) * 26.0;
+            Geodetic geo((lat - scan * 0.2) * DEG2RAD, (lon + scan / std::cos(lat * DEG2RAD)) * DEG2RAD, 0.0);
+            points.push_back({{u * (width - 1), v * (height - 1)}, geo});
+        }
+    }
+
+    return points;
+}
+}  // namespace synth
@@ -0,0 +1,79 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_BENCHMARKS_SYNTH_H_
+#define LEANHRPT_BENCHMARKS_SYNTH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoders/decoder.h"
+#include "projection.h"
+#include "satinfo.h"
+
+/**
+ * Synthetic recordings of every protocol
+ *
+ * Frames are built from the same sync words, randomization and packet
+ * layouts that the decoders expect, filled with (seeded) random imagery and
+ * plausible timestamps and calibration data. Everything that is generated
+ * decodes, so no captured files are needed to exercise the decoders.
+ */
+namespace synth {
+/// NOAA HRPT, a raw bitstream of 11090 word frames
+std::vector<uint8_t> noaa_hrpt(size_t lines, uint32_t seed = 1);
+/// NOAA GAC, a raw bitstream of randomized 3327 word frames, optionally in the reversed (playback) order
+std::vector<uint8_t> noaa_gac(size_t lines, bool reverse, uint32_t seed = 1);
+/// MetOp AHRPT, CADUs carrying AVHRR source packets on VCID 9
+std::vector<uint8_t> metop_ahrpt(size_t lines, uint32_t seed = 1);
+/// Meteor HRPT, a raw stream of CADUs carrying MSU-MR frames
+std::vector<uint8_t> meteor_hrpt(size_t lines, uint32_t seed = 1);
+/// Meteor LRPT, CADUs carrying JPEG compressed MSU-MR packets on VCID 5 (`lines` is rounded up to a multiple of 8)
+std::vector<uint8_t> meteor_lrpt(size_t lines, uint32_t seed = 1);
+/// FengYun HRPT, CADUs carrying VIRR frames on VCID 5
+std::vector<uint8_t> fengyun_virr(size_t lines, uint32_t seed = 1);
+
+/// A generated recording and how to decode it
+struct Recording {
+    std::string name;
+    Protocol protocol;
+    SatID sat;
+    FileType type;
+    Imager imager;
+    size_t lines;
+    std::vector<uint8_t> data;
+};
+
+/// One recording of every protocol
+std::vector<Recording> recordings(size_t lines, uint32_t seed = 1);
+
+/// Find a recording by name, it has to exist
+const Recording &find(const std::vector<Recording> &recordings, const std::string &name);
+/// Decode a recording from memory
+std::unique_ptr<Decoder> decode(const Recording &recording);
+/// The M_PDU zones of every CADU on a VCID, which is how VIRR frames are carried
+std::vector<uint8_t> mpdus(const std::vector<uint8_t> &cadus, uint8_t vcid);
+
+/// A GCP grid of `yn` by `xn` points for an image of `width` by `height`, a descending pass over Europe
+std::vector<std::pair<xy, Geodetic>> gcps(size_t width, size_t height, size_t xn = 31, size_t yn = 31);
+}  // namespace synth
+
+#endif
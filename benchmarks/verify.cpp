@@ -0,0 +1,1082 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "archive.h"
+#include "decoders/decoder.h"
+#include "decoders/stream.h"
+#include "ephemeris.h"
+#include "geo/geolocation.h"
+#include "image/calibration.h"
+#include "image/compositor.h"
+#include "image/geotiff.h"
+#include "image/png.h"
+#include "image/sunz.h"
+#include "map.h"
+#include "projection.h"
+#include "protocol/ccsds/deframer.h"
+#include "protocol/deframer.h"
+#include "protocol/lrpt/jpeg.h"
+#include "protocol/repack.h"
+#include "reference.h"
+#include "synth.h"
+
+namespace {
+/**
+ * An expected output
+ *
+ * Values always have to be within `tolerance`, the hash only has to match
+ * for exact fixtures (ones without a tolerance).
+ */
+struct Fixture {
+    std::string hash;
+    std::vector<double> values;
+    double tolerance = 0.0;
+};
+using Fixtures = std::map<std::string, Fixture>;
+
+// About 0.1% of full scale, enough to absorb rounding changes in a handful of pixels per block
+const double IMAGE_TOLERANCE = 64.0;
+// Degrees
+const double GCP_TOLERANCE = 1e-6;
+
+// NOAA 19 with an epoch of 2022-01-01 12:00 UTC, fixed so that GCPs don't depend on the current date
+const std::pair<std::string, std::string> NOAA19_TLE = {
+    "1 33591U 09005A   22001.50000000  .00000050  00000-0  52000-4 0  9991",
+    "2 33591  99.1500  30.0000 0014000 100.0000 260.2000 14.12500000669998"};
+const double TLE_EPOCH = 1641038400.0;
+
+/// Prints the result of every check and counts failures
+class Report {
+   public:
+    void result(const std::string &name, bool ok, const std::string &detail = "") {
+        std::printf("%-36s %s%s%s\n", name.c_str(), ok ? "PASS" : "FAIL", detail.empty() ? "" : "  ", detail.c_str());
+        std::fflush(stdout);
+        d_failures += !ok;
+    }
+    size_t failures() const { return d_failures; }
+
+   private:
+    size_t d_failures = 0;
+};
+
+/// 64 bit FNV-1a
+uint64_t fnv1a(const void *data, size_t len, uint64_t hash = 0xcbf29ce484222325) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+std::string hex(uint64_t hash) {
+    char str[17];
+    std::snprintf(str, sizeof(str), "%016llx", (unsigned long long)hash);
+    return str;
+}
+
+/// Small errors are rounded to 0 by `std::to_string()`
+std::string scientific(double x) {
+    char str[32];
+    std::snprintf(str, sizeof(str), "%.3g", x);
+    return str;
+}
+
+/// A hash of every pixel along with the mean brightness of a 16x16 grid of blocks
+Fixture image_fixture(const QImage &image) {
+    Fixture fixture;
+    fixture.tolerance = IMAGE_TOLERANCE;
+
+    uint64_t hash = fnv1a(nullptr, 0);
+    size_t row_bytes = image.width() * image.depth() / 8;
+    for (int y = 0; y < image.height(); y++) {
+        hash = fnv1a(image.constScanLine(y), row_bytes, hash);
+    }
+    fixture.hash = hex(hash);
+
+    QImage rgb = image.convertToFormat(QImage::Format_RGBA64);
+    std::vector<double> sums(16 * 16, 0.0);
+    std::vector<size_t> counts(16 * 16, 0);
+    for (int y = 0; y < rgb.height(); y++) {
+        const QRgba64 *line = (const QRgba64 *)rgb.constScanLine(y);
+        for (int x = 0; x < rgb.width(); x++) {
+            size_t block = (size_t)y * 16 / rgb.height() * 16 + (size_t)x * 16 / rgb.width();
+            sums[block] += (line[x].red() + line[x].green() + line[x].blue()) / 3.0;
+            counts[block]++;
+        }
+    }
+    for (size_t i = 0; i < sums.size(); i++) {
+        fixture.values.push_back(counts[i] ? sums[i] / counts[i] : 0.0);
+    }
+
+    return fixture;
+}
+
+/// Compare fixtures against a golden file, every fixture has to be in both
+void compare(Report &report, const Fixtures &expected, const Fixtures &actual) {
+    for (const auto &entry : expected) {
+        const std::string &name = entry.first;
+        const Fixture &want = entry.second;
+        if (!actual.count(name)) {
+            report.result(name, false, "missing");
+            continue;
+        }
+        const Fixture &got = actual.at(name);
+
+        if (want.values.size() != got.values.size()) {
+            report.result(name, false,
+                          "expected " + std::to_string(want.values.size()) + " values, got " + std::to_string(got.values.size()));
+            continue;
+        }
+        double error = 0.0;
+        for (size_t i = 0; i < want.values.size(); i++) {
+            error = std::max(error, std::abs(want.values[i] - got.values[i]));
+        }
+        // NaN is never within tolerance
+        if (!(error <= want.tolerance)) {
+            report.result(name, false, "maximum error " + std::to_string(error));
+            continue;
+        }
+
+        if (want.hash != got.hash) {
+            if (want.tolerance == 0.0) {
+                report.result(name, false, "hash " + got.hash + ", expected " + want.hash);
+            } else {
+                report.result(name, true, "within tolerance, maximum error " + std::to_string(error));
+            }
+            continue;
+        }
+        report.result(name, true);
+    }
+
+    // Otherwise outputs added without re-recording would never be checked
+    for (const auto &entry : actual) {
+        if (!expected.count(entry.first)) report.result(entry.first, false, "not in the golden outputs");
+    }
+}
+
+// Golden outputs: every recording is decoded, calibrated and projected, then hashed
+
+void raw_fixtures(Fixtures &fixtures, const synth::Recording &recording, Data &data) {
+    RawImage *raw = data.imagers.at(recording.imager);
+    fixtures["raw/" + recording.name].values = {(double)raw->width(), (double)raw->rows(), (double)raw->channels()};
+    for (size_t i = 0; i < raw->channels(); i++) {
+        fixtures["raw/" + recording.name + "/" + std::to_string(i + 1)].hash =
+            hex(fnv1a(raw->getChannel(i), raw->width() * raw->rows() * sizeof(uint16_t)));
+    }
+
+    // Absolute timestamps depend on the current date, so only the differences are stable
+    const std::vector<double> &timestamps = data.timestamps.at(recording.imager);
+    std::vector<int64_t> relative;
+    double first = 0.0;
+    for (double timestamp : timestamps) {
+        if (timestamp == 0.0 || !std::isfinite(timestamp)) {
+            relative.push_back(-1);
+            continue;
+        }
+        if (first == 0.0) first = timestamp;
+        relative.push_back(std::llround((timestamp - first) * 1000.0));
+    }
+    Fixture &fixture = fixtures["timestamps/" + recording.name];
+    fixture.hash = hex(fnv1a(relative.data(), relative.size() * sizeof(int64_t)));
+    fixture.values = {(double)timestamps.size()};
+
+    for (const auto &value : data.caldata) {
+        fixtures["caldata/" + recording.name + "/" + value.first].values = {value.second};
+    }
+}
+
+void image_fixtures(Fixtures &fixtures, const synth::Recording &recording, Data &data) {
+    RawImage *raw = data.imagers.at(recording.imager);
+    size_t width = raw->width();
+    size_t height = raw->rows();
+
+    std::vector<QImage> channels(raw->channels());
+    for (size_t i = 0; i < raw->channels(); i++) {
+        channels[i] = QImage(width, height, QImage::Format_Grayscale16);
+        for (size_t y = 0; y < height; y++) {
+            std::memcpy(channels[i].scanLine(y), &raw->getChannel(i)[y * width], width * sizeof(uint16_t));
+        }
+    }
+    Calibrator(data.caldata, data.ch3a).calibrate(recording.sat, recording.imager, channels);
+    for (size_t i = 0; i < channels.size(); i++) {
+        fixtures["calibrated/" + recording.name + "/" + std::to_string(i + 1)] = image_fixture(channels[i]);
+    }
+
+    ImageCompositor compositor;
+    compositor.ch3a = data.ch3a;
+    compositor.import(raw, recording.sat, recording.imager, data.caldata);
+    QImage composite;
+    compositor.getComposite(composite, {2, 2, 1});
+    fixtures["composite/" + recording.name] = image_fixture(composite);
+
+    // 4km/px, small enough to be quick
+    auto points = synth::gcps(width, height);
+    QRectF bounds = map::bounds_crs(points, transform::CRS::Equirectangular);
+    double scale = EARTH_CIRCUMFERENCE / 4.0;
+    QSize size(bounds.width() * scale, bounds.height() * scale / 2.0);
+    QImage projected = map::Projection(composite, points, 31, size, transform::CRS::Equirectangular, bounds).render();
+    fixtures["projected/" + recording.name] = image_fixture(projected);
+}
+
+void gcp_fixtures(Fixtures &fixtures) {
+    // Two minutes of lines at the HRPT line rate
+    std::vector<double> timestamps;
+    for (size_t i = 0; i < 720; i++) {
+        timestamps.push_back(TLE_EPOCH + 1800.0 + i / 6.0);
+    }
+
+    Projector projector(NOAA19_TLE);
+    for (auto imager : {std::make_pair(Imager::AVHRR, SatID::NOAA19), std::make_pair(Imager::MSUMR, SatID::MeteorM22),
+                        std::make_pair(Imager::VIRR, SatID::FengYun3C)}) {
+        size_t width = sensor_info.at(imager.first).width;
+        Fixture &fixture = fixtures["gcps/" + sensor_info.at(imager.first).name];
+        fixture.tolerance = GCP_TOLERANCE;
+
+        for (const auto &point : projector.calculate_gcps(timestamps, 11, 11, imager.first, imager.second, width)) {
+            fixture.values.push_back(point.first.first);
+            fixture.values.push_back(point.first.second);
+            fixture.values.push_back(point.second.latitude * RAD2DEG);
+            fixture.values.push_back(point.second.longitude * RAD2DEG);
+        }
+    }
+}
+
+Fixtures golden(size_t lines, uint32_t seed) {
+    Fixtures fixtures;
+
+    for (const synth::Recording &recording : synth::recordings(lines, seed)) {
+        std::unique_ptr<Decoder> decoder = synth::decode(recording);
+        Data data = decoder->get();
+        raw_fixtures(fixtures, recording, data);
+
+        // One recording per imager
+        if (recording.name == "noaa_hrpt" || recording.name == "meteor_hrpt" || recording.name == "fengyun_virr") {
+            image_fixtures(fixtures, recording, data);
+        }
+    }
+    gcp_fixtures(fixtures);
+
+    return fixtures;
+}
+
+QJsonObject to_json(const Fixtures &fixtures, size_t lines, uint32_t seed) {
+    QJsonObject objects;
+    for (const auto &entry : fixtures) {
+        QJsonObject object;
+        if (!entry.second.hash.empty()) object["hash"] = QString::fromStdString(entry.second.hash);
+        if (!entry.second.values.empty()) {
+            QJsonArray values;
+            for (double value : entry.second.values) values.append(value);
+            object["values"] = values;
+        }
+        if (entry.second.tolerance != 0.0) object["tolerance"] = entry.second.tolerance;
+        objects[QString::fromStdString(entry.first)] = object;
+    }
+
+    return QJsonObject{{"lines", (double)lines}, {"seed", (double)seed}, {"fixtures", objects}};
+}
+
+Fixtures from_json(const QJsonObject &json) {
+    Fixtures fixtures;
+    QJsonObject objects = json["fixtures"].toObject();
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        QJsonObject object = it.value().toObject();
+        Fixture &fixture = fixtures[it.key().toStdString()];
+        fixture.hash = object["hash"].toString().toStdString();
+        for (const QJsonValue &value : object["values"].toArray()) fixture.values.push_back(value.toDouble());
+        fixture.tolerance = object["tolerance"].toDouble();
+    }
+    return fixtures;
+}
+
+// Differential checks: the real kernels against the ones in reference.cpp on random inputs
+
+void check_repack10(Report &report, std::mt19937 &rng, size_t iterations) {
+    std::uniform_int_distribution<size_t> length(1, 4096);
+    size_t failures = 0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        size_t n = length(rng);
+        std::vector<uint8_t> in(n * 10 / 8 + 2);
+        for (uint8_t &byte : in) byte = rng();
+
+        std::vector<uint16_t> out(n), expected(n);
+        repack10(in.data(), out.data(), n);
+        reference::repack10(in.data(), expected.data(), n);
+        failures += out != expected;
+    }
+
+    report.result("repack10", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+void check_push10(Report &report, std::mt19937 &rng, size_t iterations) {
+    std::uniform_int_distribution<size_t> width(1, 256), channels(1, 10), offset(0, 400);
+    size_t failures = 0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        size_t w = width(rng), c = channels(rng), o = offset(rng);
+        size_t words = o + w * c;
+        std::vector<uint8_t> row(words * 10 / 8 + 8);
+        for (uint8_t &byte : row) byte = rng();
+
+        std::vector<uint16_t> expected(words);
+        reference::repack10(row.data(), expected.data(), words);
+
+        RawImage image(w, c);
+        image.push10Bit(row.data(), o);
+        for (size_t ch = 0; ch < c; ch++) {
+            for (size_t x = 0; x < w; x++) {
+                if (image.getChannel(ch)[x] != expected[o + x * c + ch] * 64) {
+                    failures++;
+                    ch = c;
+                    break;
+                }
+            }
+        }
+    }
+
+    report.result("rawimage/push10", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+void check_idct(Report &report, std::mt19937 &rng, size_t iterations) {
+    // Sparse coefficients like real imagery, most of the energy in DC and the first few AC terms
+    std::uniform_int_distribution<int> q(20, 100), dc(-128, 127), ac(-31, 31), sparse(0, 3);
+    int error = 0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        std::array<int16_t, 64> in = {};
+        in[0] = dc(rng);
+        for (size_t j = 1; j < 64; j++) {
+            if (sparse(rng) == 0) in[j] = ac(rng) / (int)(j / 16 + 1);
+        }
+
+        uint8_t quality = q(rng);
+        jpeg::block<uint8_t> out, expected;
+        jpeg::decode_block(in, out, quality);
+        reference::decode_block(in, expected, quality);
+        for (size_t y = 0; y < 8; y++) {
+            for (size_t x = 0; x < 8; x++) {
+                error = std::max(error, std::abs(out[y][x] - expected[y][x]));
+            }
+        }
+    }
+
+    // The real IDCT is single precision, which can round the other way
+    report.result("idct", error <= 1, "maximum error " + std::to_string(error));
+}
+
+/// Shift a stream by a random number of (random) bits, optionally inverting it
+std::vector<uint8_t> shift(const std::vector<uint8_t> &data, std::mt19937 &rng, bool invert) {
+    size_t offset = rng() % 256;
+    std::vector<uint8_t> out(data.size() + offset / 8 + 2);
+    for (uint8_t &byte : out) byte = rng();
+
+    for (size_t i = 0; i < data.size() * 8; i++) {
+        size_t x = i + offset;
+        bool bit = ((data[i / 8] >> (7 - i % 8)) & 1) ^ invert;
+        out[x / 8] = (out[x / 8] & ~(0x80 >> x % 8)) | (bit << (7 - x % 8));
+    }
+
+    return out;
+}
+
+template <typename T>
+std::vector<std::vector<uint8_t>> run_deframer(T &deframer, const std::vector<uint8_t> &data, size_t frame_size) {
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<uint8_t> frame(frame_size / 8);
+    for (size_t i = 0; i < data.size(); i += BUFFER_SIZE) {
+        if (deframer.work(&data[i], frame.data(), std::min<size_t>(BUFFER_SIZE, data.size() - i))) frames.push_back(frame);
+    }
+    return frames;
+}
+
+using POESDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 110900>;
+using GACDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 33270>;
+using GACReverseDeframer = ArbitraryDeframer<uint64_t, 0b010011001111000011111001001010011011001001001000101010011110, 60, 33270>;
+using VIRRDeframer = ArbitraryDeframer<uint64_t, 0b101000010001011011111101011100011001110110000011110010010101, 60, 208400>;
+
+/// Deframe `data` at random bit offsets with both the real and reference deframers
+template <typename T, uint64_t SYNC, size_t SYNC_SIZE, size_t FRAME_SIZE>
+void check_deframer(Report &report, std::mt19937 &rng, size_t iterations, const std::string &name,
+                    const std::vector<uint8_t> &data, bool inverted, std::function<T *()> make) {
+    size_t failures = 0;
+    size_t frames = 0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        bool invert = inverted && i % 2 == 1;
+        std::mt19937 copy = rng;
+        std::vector<uint8_t> input = shift(data, rng, invert);
+        std::vector<uint8_t> plain = shift(data, copy, false);
+
+        std::unique_ptr<T> deframer(make());
+        std::vector<std::vector<uint8_t>> got = run_deframer(*deframer, input, FRAME_SIZE);
+        std::vector<std::vector<uint8_t>> expected = reference::deframe(plain, SYNC, SYNC_SIZE, FRAME_SIZE);
+        failures += got != expected || expected.empty();
+        frames += got.size();
+    }
+
+    report.result("deframe/" + name, failures == 0,
+                  std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched, " + std::to_string(frames) +
+                      " frames");
+}
+
+void check_deframers(Report &report, std::mt19937 &rng, size_t iterations, const std::vector<synth::Recording> &recordings) {
+    const uint64_t POES_ASM = 0b101000010001011011111101011100011001110110000011110010010101;
+    const uint64_t POES_ASM_REVERSE = 0b010011001111000011111001001010011011001001001000101010011110;
+
+    check_deframer<POESDeframer, POES_ASM, 60, 110900>(report, rng, iterations, "noaa_hrpt",
+                                                       synth::find(recordings, "noaa_hrpt").data, true,
+                                                       [] { return new POESDeframer(8, true); });
+    check_deframer<GACDeframer, POES_ASM, 60, 33270>(report, rng, iterations, "noaa_gac",
+                                                     synth::find(recordings, "noaa_gac").data, true,
+                                                     [] { return new GACDeframer(8, true); });
+    check_deframer<GACReverseDeframer, POES_ASM_REVERSE, 60, 33270>(report, rng, iterations, "noaa_gac_reverse",
+                                                                    synth::find(recordings, "noaa_gac_reverse").data, true,
+                                                                    [] { return new GACReverseDeframer(8, true); });
+    check_deframer<VIRRDeframer, POES_ASM, 60, 208400>(report, rng, iterations, "fengyun_virr",
+                                                       synth::mpdus(synth::find(recordings, "fengyun_virr").data, 5), false,
+                                                       [] { return new VIRRDeframer(8, false); });
+
+    for (std::string name : {"metop_ahrpt", "meteor_hrpt", "meteor_lrpt", "fengyun_virr"}) {
+        check_deframer<ccsds::Deframer, 0x1ACFFC1D, 32, 8192>(report, rng, iterations, "ccsds/" + name,
+                                                              synth::find(recordings, name).data, true,
+                                                              [] { return new ccsds::Deframer; });
+    }
+}
+
+/// Every recording served over a loopback TCP connection and decoded live, against decoding it from a file
+void check_stream(Report &report, const std::vector<synth::Recording> &recordings) {
+    QTemporaryDir dir;
+    std::string filename = dir.filePath("pass.bin").toStdString();
+
+    size_t failures = 0;
+    for (const synth::Recording &recording : recordings) {
+        QFile file(QString::fromStdString(filename));
+        bool ok = file.open(QIODevice::WriteOnly) &&
+                  file.write((const char *)recording.data.data(), recording.data.size()) == (qint64)recording.data.size();
+        file.close();
+
+        std::unique_ptr<Decoder> expected_decoder(Decoder::make(recording.protocol, recording.sat));
+        ok = ok && expected_decoder->decodeFile(filename, recording.type);
+
+        // Sockets can only be used from the thread that made them, so the server gets its own
+        std::promise<quint16> port;
+        std::thread server([&recording, &port]() {
+            QTcpServer server;
+            if (!server.listen(QHostAddress::LocalHost)) {
+                port.set_value(0);
+                return;
+            }
+            port.set_value(server.serverPort());
+            if (!server.waitForNewConnection(5000)) return;
+
+            QTcpSocket *socket = server.nextPendingConnection();
+            socket->write((const char *)recording.data.data(), recording.data.size());
+            // There is no event loop on this thread to send it in the background
+            while (socket->bytesToWrite() > 0 && socket->waitForBytesWritten(5000)) {
+            }
+            socket->disconnectFromHost();
+            if (socket->state() != QAbstractSocket::UnconnectedState) socket->waitForDisconnected(5000);
+        });
+
+        quint16 p = port.get_future().get();
+        std::unique_ptr<StreamSource> source(p == 0 ? nullptr : StreamSource::make("tcp://127.0.0.1:" + std::to_string(p)));
+        std::unique_ptr<Decoder> decoder(Decoder::make(recording.protocol, recording.sat));
+        if (source) {
+            std::istream stream(source.get());
+            decoder->decodeStream(stream, recording.type);
+        }
+        server.join();
+
+        // Every byte is read, and counted
+        ok = ok && source && source->received() == recording.data.size() &&
+             source->pubseekoff(0, std::ios::cur, std::ios::in) == (std::streamoff)recording.data.size();
+
+        if (ok) {
+            Data expected_data = expected_decoder->get();
+            Data data = decoder->get();
+            Fixtures expected, got;
+            raw_fixtures(expected, recording, expected_data);
+            raw_fixtures(got, recording, data);
+            ok = expected.size() == got.size();
+            for (const auto &entry : expected) {
+                ok = ok && got.count(entry.first) && got.at(entry.first).hash == entry.second.hash &&
+                     got.at(entry.first).values == entry.second.values;
+            }
+        }
+        failures += !ok;
+    }
+
+    report.result("decoder/stream", failures == 0,
+                  std::to_string(failures) + "/" + std::to_string(recordings.size()) + " mismatched");
+}
+
+/// A composite of the NOAA HRPT recording, to be projected with `synth::gcps()`
+QImage noaa_composite(const std::vector<synth::Recording> &recordings) {
+    const synth::Recording &recording = synth::find(recordings, "noaa_hrpt");
+    std::unique_ptr<Decoder> decoder = synth::decode(recording);
+    Data data = decoder->get();
+
+    ImageCompositor compositor;
+    compositor.import(data.imagers.at(recording.imager), recording.sat, recording.imager, data.caldata);
+    QImage composite;
+    compositor.getComposite(composite, {2, 2, 1});
+    return composite;
+}
+
+/// Rendering a projection in strips of any height has to give exactly the same result as rendering it all at once
+void check_projection(Report &report, std::mt19937 &rng, size_t iterations, const std::vector<synth::Recording> &recordings) {
+    QImage composite = noaa_composite(recordings);
+    auto points = synth::gcps(composite.width(), composite.height());
+    QRectF bounds = map::bounds_crs(points, transform::CRS::Equirectangular);
+    double scale = EARTH_CIRCUMFERENCE / 4.0;
+    QSize size(bounds.width() * scale, bounds.height() * scale / 2.0);
+    map::Projection projection(composite, points, 31, size, transform::CRS::Equirectangular, bounds);
+    QImage full = projection.render();
+
+    std::uniform_int_distribution<int> height(1, 64);
+    size_t failures = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        QImage strip(size.width(), height(rng), QImage::Format_RGBA64);
+        for (int top = 0; top < size.height(); top += strip.height()) {
+            projection.render(strip, top);
+            int rows = std::min(strip.height(), size.height() - top);
+            for (int y = 0; y < rows; y++) {
+                if (std::memcmp(strip.constScanLine(y), full.constScanLine(top + y), size.width() * sizeof(QRgba64)) != 0) {
+                    failures++;
+                    top = size.height();
+                    break;
+                }
+            }
+        }
+    }
+
+    report.result("project/strips", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+/// Interpolated positions and velocities against ones straight from SGP4 at random times over a pass, then latitudes,
+/// longitudes and altitudes from `Ephemeris::eci_to_geodetic()` against the ones `predict_orbit()` calculates itself
+void check_ephemeris(Report &report, std::mt19937 &rng, size_t iterations) {
+    // 15 minutes, in no particular order so samples are created out of order too
+    std::uniform_real_distribution<double> time(TLE_EPOCH + 1800.0, TLE_EPOCH + 2700.0);
+    Ephemeris ephemeris(NOAA19_TLE);
+    double position_error = 0.0, velocity_error = 0.0, ground_error = 0.0, altitude_error = 0.0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        double t = time(rng);
+        struct predict_position interpolated = ephemeris.predict(t);
+        struct predict_position exact = ephemeris.predict_exact(t);
+
+        double position = 0.0, velocity = 0.0;
+        for (size_t j = 0; j < 3; j++) {
+            position += std::pow(interpolated.position[j] - exact.position[j], 2.0);
+            velocity += std::pow(interpolated.velocity[j] - exact.velocity[j], 2.0);
+        }
+        position_error = std::max(position_error, std::sqrt(position));
+        velocity_error = std::max(velocity_error, std::sqrt(velocity));
+
+        // From the same position, so only the conversion itself is compared
+        double latitude, longitude, altitude;
+        Ephemeris::eci_to_geodetic(t, exact.position, latitude, longitude, altitude);
+        // Errors in longitude are scaled to an angle on the ground, then both to a distance
+        double angle = std::max(std::abs(latitude - exact.latitude),
+                                std::abs(std::remainder(longitude - exact.longitude, 2.0 * M_PI)) * std::cos(exact.latitude));
+        ground_error = std::max(ground_error, angle * EARTH_RADIUS);
+        altitude_error = std::max(altitude_error, std::abs(altitude - exact.altitude));
+    }
+
+    // libpredict works in Julian dates (~2.46e6 days), which quantizes times to ~40us: up to 0.15m along track in each
+    // sample and in `predict_exact()`. The velocities are derived from the differences between two samples a second apart
+    report.result("ephemeris/position", position_error <= 0.5e-3,
+                  "maximum error " + scientific(position_error * 1000.0) + " m");
+    report.result("ephemeris/velocity", velocity_error <= 1e-3,
+                  "maximum error " + scientific(velocity_error * 1000.0) + " m/s");
+
+    // Same method and constants as libpredict, only the ~40us time quantization of the GMST (~1cm on the ground) differs
+    report.result("ephemeris/geodetic", ground_error <= 5e-5 && altitude_error <= 1e-5,
+                  "maximum error " + scientific(ground_error * 1000.0) + " m on the ground, " +
+                      scientific(altitude_error * 1000.0) + " m in altitude");
+}
+
+/// The batch `los_to_earth()` against the original one called for every point
+void check_los_to_earth(Report &report, std::mt19937 &rng, size_t iterations) {
+    std::uniform_real_distribution<double> latitude(-M_PI_2, M_PI_2), longitude(-M_PI, M_PI), altitude(700.0, 900.0),
+        yaw(-M_PI, M_PI), roll(-55.0 * DEG2RAD, 55.0 * DEG2RAD), pitch(-2.0 * DEG2RAD, 2.0 * DEG2RAD),
+        miss(66.0 * DEG2RAD, 85.0 * DEG2RAD);
+    std::uniform_int_distribution<size_t> length(1, 256);
+    double error = 0.0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        Geodetic position(latitude(rng), longitude(rng), altitude(rng));
+        double y = yaw(rng);
+        size_t n = length(rng);
+
+        // Some of the rays point past the horizon
+        std::vector<double> rolls(n), pitches(n), latitudes(n), longitudes(n);
+        for (size_t j = 0; j < n; j++) {
+            rolls[j] = j % 16 == 15 ? miss(rng) * (j % 32 < 16 ? 1.0 : -1.0) : roll(rng);
+            pitches[j] = pitch(rng);
+        }
+        los_to_earth(position, rolls.data(), pitches.data(), y, n, latitudes.data(), longitudes.data());
+
+        for (size_t j = 0; j < n; j++) {
+            Geodetic expected = los_to_earth(position, rolls[j], pitches[j], y);
+            // Errors in longitude are scaled to an angle on the ground, near the poles they mean nothing
+            error = std::max(error, std::abs(latitudes[j] - expected.latitude));
+            error = std::max(error, std::abs(std::remainder(longitudes[j] - expected.longitude, 2.0 * M_PI)) *
+                                        std::cos(expected.latitude));
+        }
+    }
+
+    // A few ulp, the same geometry is evaluated in a different order (~1e-15 rad is typical)
+    report.result("los_to_earth", error <= 2e-15, "maximum error " + scientific(error) + " rad");
+}
+
+/// Solar zenith angles of every pixel against ones calculated from each GCP, then tiles calculated lazily
+void check_sunz(Report &report, std::mt19937 &rng, size_t iterations, size_t lines) {
+    std::vector<double> timestamps;
+    for (size_t i = 0; i < lines; i++) {
+        timestamps.push_back(TLE_EPOCH + 1800.0 + i / 6.0);
+    }
+    size_t width = sensor_info.at(Imager::AVHRR).width;
+
+    // A GCP on every pixel
+    Projector projector(NOAA19_TLE);
+    SunzBuffer sunz = projector.calculate_sunz(timestamps, Imager::AVHRR, SatID::NOAA19, width);
+    SunzBuffer quantized = projector.calculate_sunz(timestamps, Imager::AVHRR, SatID::NOAA19, width, SunzBuffer::Format::UInt16);
+    double error = 0.0;
+    double quantized_error = 0.0;
+    for (const auto &point : projector.calculate_gcps(timestamps, lines, width, Imager::AVHRR, SatID::NOAA19, width)) {
+        size_t x = std::lround(point.first.first);
+        size_t y = point.first.second;
+        double expected = reference::solar_zenith(point.second.latitude, point.second.longitude,
+                                                  Ephemeris::sun_vector(timestamps[y]));
+        error = std::max(error, std::abs(sunz.at(y, x) - expected));
+        quantized_error = std::max(quantized_error, std::abs(quantized.at(y, x) - expected));
+    }
+    report.result("sunz", !sunz.empty() && error <= 1e-6, "maximum error " + scientific(error) + " rad");
+    // Half a step of 16 bits over 0-pi
+    report.result("sunz/uint16", !quantized.empty() && quantized_error <= M_PI / 65535.0 / 2.0 + 1e-6,
+                  "maximum error " + scientific(quantized_error) + " rad");
+
+    // Only two tiles fit, so reading rows in a random order from every thread keeps evicting them
+    size_t budget = 2 * SunzBuffer::TILE_ROWS * width * sizeof(float);
+    SunzBuffer lazy(
+        width, lines,
+        [&sunz, width](size_t y0, size_t rows, float *out) {
+            for (size_t y = 0; y < rows; y++) {
+                SunzBuffer::Row row = sunz.row(y0 + y);
+                for (size_t x = 0; x < width; x++) out[y * width + x] = row[x];
+            }
+        },
+        SunzBuffer::Format::Float, budget);
+
+    std::uniform_int_distribution<size_t> line(0, lines - 1);
+    std::vector<size_t> order(iterations);
+    for (size_t &y : order) y = line(rng);
+
+    size_t failures = 0;
+#pragma omp parallel for reduction(+ : failures)
+    for (size_t i = 0; i < iterations; i++) {
+        SunzBuffer::Row got = lazy.row(order[i]);
+        SunzBuffer::Row expected = sunz.row(order[i]);
+        for (size_t x = 0; x < width; x++) {
+            if (got[x] != expected[x]) {
+                failures++;
+                break;
+            }
+        }
+    }
+    report.result("sunz/lazy", failures == 0 && lazy.bytes() <= budget,
+                  std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched, " +
+                      std::to_string(lazy.bytes()) + " bytes kept");
+}
+
+/// Queries of the R-tree (both built in memory and memory mapped from a file) against checking every segment
+void check_segment_index(Report &report, std::mt19937 &rng, size_t iterations) {
+    // Coordinates that are exact as floats, so that the boxes of the index aren't rounded
+    std::uniform_real_distribution<float> longitude(-180.0f, 180.0f), latitude(-90.0f, 90.0f), length(-2.0f, 2.0f),
+        size(0.0f, 40.0f);
+    std::uniform_int_distribution<size_t> segments(0, 5000), node_size(2, 32);
+    QTemporaryDir dir;
+    std::string filename = dir.filePath("index.lhmap").toStdString();
+
+    auto order = [](const QLineF &a, const QLineF &b) {
+        return std::make_tuple(a.x1(), a.y1(), a.x2(), a.y2()) < std::make_tuple(b.x1(), b.y1(), b.x2(), b.y2());
+    };
+
+    size_t failures = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        std::vector<QLineF> lines(segments(rng));
+        for (QLineF &line : lines) {
+            float x = longitude(rng);
+            float y = latitude(rng);
+            line = QLineF(x, y, (float)(x + length(rng)), (float)(y + length(rng)));
+        }
+
+        map::SegmentIndex index(lines, {0, 0, 0}, node_size(rng));
+        if (i % 2 == 1) {
+            if (!index.save(filename)) {
+                failures++;
+                continue;
+            }
+            index = map::SegmentIndex::open(filename);
+        }
+        if (index.size() != lines.size()) {
+            failures++;
+            continue;
+        }
+
+        for (size_t j = 0; j < 16; j++) {
+            QRectF rect(longitude(rng), latitude(rng), size(rng), size(rng));
+            std::vector<QLineF> got;
+            index.query(rect, [&got](const QLineF &line) { got.push_back(line); });
+            std::vector<QLineF> expected = reference::query(lines, rect);
+
+            std::sort(got.begin(), got.end(), order);
+            std::sort(expected.begin(), expected.end(), order);
+            if (got != expected) {
+                failures++;
+                break;
+            }
+        }
+    }
+
+    report.result("map/index", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+/// The scanline rasterizer of `map::Projection` against testing every pixel of every cell with `containsPoint()`
+void check_rasterizer(Report &report, const std::vector<synth::Recording> &recordings) {
+    QImage composite = noaa_composite(recordings);
+    auto points = synth::gcps(composite.width(), composite.height());
+    QSize size(640, 640);
+
+    // The pass is over Europe, so every cell is drawn directly in all of these
+    for (transform::CRS crs : {transform::CRS::Equirectangular, transform::CRS::Mercator, transform::CRS::North_Polar}) {
+        QRectF bounds = map::bounds_crs(points, crs);
+        QImage got = map::Projection(composite, points, 31, size, crs, bounds).render();
+        QImage expected = reference::project(composite, points, 31, size, crs, bounds);
+
+        // Pixels centered exactly on the edge of a cell can land on either side, and sampling positions are
+        // calculated differently so can round the other way
+        size_t covered = 0;
+        size_t edges = 0;
+        int error = 0;
+        for (int y = 0; y < size.height(); y++) {
+            const QRgba64 *a = (const QRgba64 *)got.constScanLine(y);
+            const QRgba64 *b = (const QRgba64 *)expected.constScanLine(y);
+            for (int x = 0; x < size.width(); x++) {
+                covered += b[x].alpha() != 0;
+                if (a[x].alpha() != b[x].alpha()) {
+                    edges++;
+                    continue;
+                }
+                error = std::max({error, std::abs(a[x].red() - b[x].red()), std::abs(a[x].green() - b[x].green()),
+                                  std::abs(a[x].blue() - b[x].blue())});
+            }
+        }
+
+        std::string name = transform::CRS_NAMES[(size_t)crs];
+        std::replace(name.begin(), name.end(), ' ', '_');
+        report.result("project/rasterize/" + name, covered != 0 && edges <= covered / 1000 && error <= 1,
+                      std::to_string(edges) + "/" + std::to_string(covered) + " pixels covered differently, maximum error " +
+                          std::to_string(error));
+    }
+}
+
+/// A random RGBA64 image, nothing is fully transparent so that every format keeps the color of every pixel
+QImage random_image(std::mt19937 &rng, int width, int height) {
+    QImage image(width, height, QImage::Format_RGBA64);
+    for (int y = 0; y < height; y++) {
+        QRgba64 *line = (QRgba64 *)image.scanLine(y);
+        for (int x = 0; x < width; x++) {
+            line[x] = QRgba64::fromRgba64(rng(), rng(), rng(), std::max<uint16_t>(rng(), 257));
+        }
+    }
+    return image;
+}
+
+/// Decode PNGs from `PngWriter` and `QImage::save()`, both have to give back the original image
+void check_png(Report &report, std::mt19937 &rng, size_t iterations) {
+    const QImage::Format formats[] = {QImage::Format_Grayscale8, QImage::Format_Grayscale16, QImage::Format_RGB888,
+                                      QImage::Format_ARGB32,     QImage::Format_RGBX64,      QImage::Format_RGBA64};
+    // Wide and tall enough to be split into several bands
+    std::uniform_int_distribution<int> width(1, 2048), height(1, 512), level(0, 9);
+    QTemporaryDir dir;
+    QString ours = dir.filePath("ours.png");
+    QString theirs = dir.filePath("theirs.png");
+
+    size_t failures = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        QImage::Format format = formats[i % (sizeof(formats) / sizeof(formats[0]))];
+        QImage image = random_image(rng, width(rng), height(rng)).convertToFormat(format);
+
+        bool ok = PngWriter::save(image, ours.toStdString(), level(rng)) && image.save(theirs);
+        QImage a = QImage(ours).convertToFormat(format);
+        QImage b = QImage(theirs).convertToFormat(format);
+        failures += !ok || a != image || b != image;
+    }
+
+    report.result("png", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+/// Decode the tiles of GeoTIFFs written in strips, they have to give back the original image
+void check_geotiff(Report &report, std::mt19937 &rng, size_t iterations) {
+    // Edge tiles and a few overview levels
+    std::uniform_int_distribution<int> size(1, 700), strip(1, 300);
+    QTemporaryDir dir;
+    std::string filename = dir.filePath("image.tif").toStdString();
+
+    size_t failures = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        int depth = i % 2 == 0 ? 16 : 8;
+        QImage image = random_image(rng, size(rng), size(rng));
+
+        GeoTiffWriter writer(filename, image.size(), (transform::CRS)(i % 4), QRectF(0.25, 0.25, 0.5, 0.5), depth);
+        bool ok = true;
+        for (int top = 0; top < image.height();) {
+            int rows = strip(rng);
+            ok &= writer.write(image.copy(0, top, image.width(), rows));
+            top += rows;
+        }
+        ok &= writer.close();
+
+        // 8 bit samples are rounded
+        if (depth == 8) {
+            for (int y = 0; y < image.height(); y++) {
+                uint16_t *line = (uint16_t *)image.scanLine(y);
+                for (int x = 0; x < image.width() * 4; x++) line[x] = (line[x] + 128) / 257 * 257;
+            }
+        }
+
+        // Overviews are made until the image fits in a single tile
+        std::vector<QImage> images = reference::read_tiff(filename);
+        QSize expected = image.size();
+        for (size_t level = 0; level < images.size(); level++) {
+            ok &= images[level].size() == expected;
+            if (level + 1 == images.size()) ok &= std::max(expected.width(), expected.height()) <= 256;
+            expected = QSize((expected.width() + 1) / 2, (expected.height() + 1) / 2);
+        }
+        failures += !ok || images.empty() || images[0] != image;
+    }
+
+    report.result("geotiff", failures == 0, std::to_string(failures) + "/" + std::to_string(iterations) + " mismatched");
+}
+
+/// Save and open an L1a archive of every recording, then read random ranges of lines back
+void check_archive(Report &report, std::mt19937 &rng, size_t iterations, const std::vector<synth::Recording> &recordings) {
+    std::uniform_int_distribution<size_t> band_rows(1, 300);
+    QTemporaryDir dir;
+    std::string filename = dir.filePath("pass.l1a").toStdString();
+
+    size_t failures = 0;
+    for (const synth::Recording &recording : recordings) {
+        std::unique_ptr<Decoder> decoder = synth::decode(recording);
+        Data data = decoder->get();
+
+        L1aArchive saved(data, recording.sat, recording.protocol, band_rows(rng));
+        L1aArchive archive = saved.save(filename) ? L1aArchive::open(filename) : L1aArchive();
+        Data metadata = archive.metadata();
+        bool ok = !archive.empty() && archive.satellite() == recording.sat && archive.protocol() == recording.protocol &&
+                  metadata.caldata == data.caldata && metadata.ch3a == data.ch3a;
+
+        for (const auto &imager : data.imagers) {
+            RawImage *raw = imager.second;
+            const std::vector<double> &timestamps = data.timestamps[imager.first];
+            const std::vector<double> &saved_timestamps = metadata.timestamps[imager.first];
+            ok = ok && archive.has_imager(imager.first) && archive.width(imager.first) == raw->width() &&
+                 archive.rows(imager.first) == raw->rows() && archive.channels(imager.first) == raw->channels() &&
+                 saved_timestamps.size() == timestamps.size() &&
+                 (timestamps.empty() ||
+                  std::memcmp(saved_timestamps.data(), timestamps.data(), timestamps.size() * sizeof(double)) == 0);
+            if (!ok || raw->rows() == 0) continue;
+
+            for (size_t i = 0; i < iterations && ok; i++) {
+                size_t channel = rng() % raw->channels();
+                size_t first = std::uniform_int_distribution<size_t>(0, raw->rows() - 1)(rng);
+                size_t count = std::uniform_int_distribution<size_t>(1, raw->rows() - first)(rng);
+
+                std::vector<uint16_t> lines(count * raw->width());
+                ok = archive.read(imager.first, channel, first, count, lines.data(), raw->width()) &&
+                     std::memcmp(lines.data(), &raw->getChannel(channel)[first * raw->width()],
+                                 lines.size() * sizeof(uint16_t)) == 0;
+            }
+        }
+
+        // Importing an archive is the same as importing what it was made from
+        ImageCompositor expected, got;
+        expected.ch3a = got.ch3a = data.ch3a;
+        expected.import(data.imagers.at(recording.imager), recording.sat, recording.imager, data.caldata);
+        ok = ok && got.import(archive, recording.imager) && got.channels() == expected.channels();
+        for (size_t ch = 1; ok && ch <= expected.channels(); ch++) {
+            QImage a, b;
+            expected.getChannel(a, ch);
+            got.getChannel(b, ch);
+            ok = a == b;
+        }
+        failures += !ok;
+    }
+
+    report.result("archive", failures == 0,
+                  std::to_string(failures) + "/" + std::to_string(recordings.size()) + " mismatched");
+}
+
+/// Append recordings to a compositor a few lines at a time, like when decoding live, against importing them in one go
+void check_append(Report &report, std::mt19937 &rng, size_t iterations, const std::vector<synth::Recording> &recordings) {
+    std::uniform_int_distribution<size_t> chunk(1, 64);
+    size_t failures = 0;
+    size_t total = 0;
+
+    for (std::string name : {"noaa_hrpt", "meteor_hrpt", "fengyun_virr"}) {
+        const synth::Recording &recording = synth::find(recordings, name);
+        std::unique_ptr<Decoder> decoder = synth::decode(recording);
+        Data data = decoder->get();
+        RawImage *raw = data.imagers.at(recording.imager);
+
+        ImageCompositor whole;
+        whole.ch3a = data.ch3a;
+        whole.import(raw, recording.sat, recording.imager, data.caldata);
+
+        for (size_t i = 0; i < iterations; i++, total++) {
+            // The same as a RawImage that is still being decoded into
+            RawImage growing = *raw;
+            growing.set_height(0);
+            ImageCompositor live;
+            live.ch3a = data.ch3a;
+            while (growing.rows() < raw->rows()) {
+                growing.set_height(std::min(growing.rows() + chunk(rng), raw->rows()));
+                live.append(&growing, recording.sat, recording.imager, data.caldata);
+            }
+
+            bool ok = live.width() == whole.width() && live.height() == whole.height() && live.channels() == whole.channels();
+            for (size_t ch = 1; ok && ch <= whole.channels(); ch++) {
+                QImage a, b;
+                whole.getChannel(a, ch);
+                live.getChannel(b, ch);
+                ok = a == b;
+
+                // Equalised with the histograms that each of them keeps up to date
+                whole.equalise(a, Equalization::Histogram, 1.0f, false, {ch});
+                live.equalise(b, Equalization::Histogram, 1.0f, false, {ch});
+                ok = ok && a == b;
+            }
+            failures += !ok;
+        }
+    }
+
+    report.result("compositor/append", failures == 0, std::to_string(failures) + "/" + std::to_string(total) + " mismatched");
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("LeanHRPT Verify");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Checks the decoding chain against reference implementations and golden outputs of synthetic recordings");
+    parser.addHelpOption();
+    parser.addOption({"iterations", "Number of random inputs each kernel is checked with (default 1000)", "n"});
+    parser.addOption({"seed", "Seed of the random inputs and synthetic recordings (default 1)", "n"});
+    parser.addOption({"lines", "Number of lines in each recording (default 200)", "n"});
+    parser.addOption({"record", "Write golden outputs to a JSON file", "file"});
+    parser.addOption({"check", "Compare outputs against golden outputs from a JSON file", "file"});
+    parser.process(app);
+
+    size_t iterations = parser.isSet("iterations") ? parser.value("iterations").toULong() : 1000;
+    uint32_t seed = parser.isSet("seed") ? parser.value("seed").toUInt() : 1;
+    size_t lines = parser.isSet("lines") ? parser.value("lines").toULong() : 200;
+    if (lines < 8 || iterations == 0) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 1;
+    }
+
+    Report report;
+    std::mt19937 rng(seed);
+    std::vector<synth::Recording> recordings = synth::recordings(lines, seed);
+
+    // Whole recordings are slow to deframe and render, so they get fewer iterations
+    size_t slow_iterations = std::max<size_t>(iterations / 100, 4);
+    check_repack10(report, rng, iterations);
+    check_push10(report, rng, iterations);
+    check_idct(report, rng, iterations * 10);
+    check_deframers(report, rng, slow_iterations, recordings);
+    check_stream(report, recordings);
+    check_projection(report, rng, slow_iterations, recordings);
+    check_ephemeris(report, rng, iterations);
+    check_los_to_earth(report, rng, iterations);
+    check_sunz(report, rng, iterations, lines);
+    check_segment_index(report, rng, std::max<size_t>(iterations / 10, 4));
+    check_rasterizer(report, recordings);
+    check_png(report, rng, slow_iterations);
+    check_geotiff(report, rng, slow_iterations);
+    check_archive(report, rng, slow_iterations, recordings);
+    check_append(report, rng, slow_iterations, recordings);
+
+    if (parser.isSet("record")) {
+        QSaveFile file(parser.value("record"));
+        QJsonDocument json(to_json(golden(lines, seed), lines, seed));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json.toJson()) == -1 || !file.commit()) {
+            std::cerr << "Could not write golden outputs" << std::endl;
+            return 1;
+        }
+    }
+
+    if (parser.isSet("check")) {
+        QFile file(parser.value("check"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::cerr << "Could not open golden outputs" << std::endl;
+            return 1;
+        }
+        QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+
+        // Regenerate with the same recordings the golden outputs were made from
+        size_t golden_lines = json["lines"].toDouble();
+        uint32_t golden_seed = json["seed"].toDouble();
+        std::printf("\nGolden outputs of %zu lines with seed %u\n", golden_lines, golden_seed);
+        compare(report, from_json(json), golden(golden_lines, golden_seed));
+    }
+
+    std::printf("\n%zu failed\n", report.failures());
+    return report.failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,314 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "archive.h"
+
+#include <zlib.h>
+
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Delta filter every line and split the samples into byte planes, the high bytes are mostly zero and compress well
+static std::vector<uint8_t> compress_band(const uint16_t *data, size_t width, size_t rows) {
+    size_t n = width * rows;
+    std::vector<uint8_t> planes(n * 2);
+    for (size_t y = 0; y < rows; y++) {
+        const uint16_t *line = &data[y * width];
+        for (size_t x = 0; x < width; x++) {
+            uint16_t delta = line[x] - (x == 0 ? 0 : line[x - 1]);
+            planes[y * width + x] = delta;
+            planes[n + y * width + x] = delta >> 8;
+        }
+    }
+
+    uLongf size = compressBound(planes.size());
+    std::vector<uint8_t> out(size);
+    if (compress2(out.data(), &size, planes.data(), planes.size(), Z_BEST_SPEED) != Z_OK) return {};
+    out.resize(size);
+    return out;
+}
+
+L1aArchive::L1aArchive(const Data &data, SatID satellite, Protocol protocol, size_t band_rows) {
+    band_rows = std::max<size_t>(band_rows, 1);
+    for (auto &entry : data.caldata) {
+        if (entry.first.size() >= sizeof(CalEntry::name)) {
+            throw std::runtime_error("calibration data name \"" + entry.first + "\" is too long");
+        }
+    }
+
+    struct Job {
+        const uint16_t *data;
+        size_t width;
+        size_t rows;
+    };
+    std::vector<Job> jobs;
+    for (auto &imager : data.imagers) {
+        RawImage *image = imager.second;
+        for (size_t ch = 0; ch < image->channels(); ch++) {
+            for (size_t start = 0; start < image->rows(); start += band_rows) {
+                jobs.push_back({&image->getChannel(ch)[start * image->width()], image->width(),
+                                std::min(band_rows, image->rows() - start)});
+            }
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> compressed(jobs.size());
+#pragma omp parallel for
+    for (size_t i = 0; i < jobs.size(); i++) {
+        compressed[i] = compress_band(jobs[i].data, jobs[i].width, jobs[i].rows);
+    }
+    for (const std::vector<uint8_t> &band : compressed) {
+        if (band.empty()) throw std::runtime_error("could not compress a band");
+    }
+
+    std::vector<CalEntry> caldata;
+    for (auto &entry : data.caldata) {
+        CalEntry cal = {};
+        std::memcpy(cal.name, entry.first.data(), entry.first.size());
+        cal.value = entry.second;
+        caldata.push_back(cal);
+    }
+
+    // Lay everything out, the tables are all 8 byte aligned
+    size_t offset = sizeof(Header) + data.imagers.size() * sizeof(ImagerEntry) + caldata.size() * sizeof(CalEntry);
+    std::vector<ImagerEntry> imagers;
+    for (auto &imager : data.imagers) {
+        RawImage *image = imager.second;
+        ImagerEntry entry = {};
+        entry.imager = (uint32_t)imager.first;
+        entry.channels = image->channels();
+        entry.width = image->width();
+        entry.rows = image->rows();
+        entry.timestamps = data.timestamps.count(imager.first) ? data.timestamps.at(imager.first).size() : 0;
+        entry.timestamp_offset = offset;
+        offset += entry.timestamps * sizeof(double);
+        entry.band_offset = offset;
+        offset += entry.channels * ((entry.rows + band_rows - 1) / band_rows) * sizeof(Band);
+        imagers.push_back(entry);
+    }
+    size_t ch3a_offset = offset;
+    offset += (data.ch3a.size() + 7) / 8 * 8;
+    size_t band_data = offset;
+
+    std::vector<Band> bands;
+    for (const std::vector<uint8_t> &band : compressed) {
+        bands.push_back({offset, band.size()});
+        offset += band.size();
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, "LHRPTL1A", sizeof(header.magic));
+    header.version = 1;
+    header.satellite = (uint32_t)satellite;
+    header.protocol = (uint32_t)protocol;
+    header.band_rows = band_rows;
+    header.imagers = imagers.size();
+    header.caldata = caldata.size();
+    header.ch3a = data.ch3a.size();
+    header.ch3a_offset = ch3a_offset;
+    header.size = offset;
+
+    auto buffer = std::make_shared<std::vector<char>>(offset, 0);
+    char *ptr = buffer->data();
+    auto write = [&ptr](const void *data, size_t size) {
+        if (size != 0) std::memcpy(ptr, data, size);
+        ptr += size;
+    };
+    write(&header, sizeof(Header));
+    write(imagers.data(), imagers.size() * sizeof(ImagerEntry));
+    write(caldata.data(), caldata.size() * sizeof(CalEntry));
+
+    // Bands are in the same order as the jobs, imager then channel major
+    const Band *band = bands.data();
+    for (const ImagerEntry &entry : imagers) {
+        if (entry.timestamps != 0) write(data.timestamps.at((Imager)entry.imager).data(), entry.timestamps * sizeof(double));
+        size_t n = entry.channels * ((entry.rows + band_rows - 1) / band_rows);
+        write(band, n * sizeof(Band));
+        band += n;
+    }
+    for (bool flag : data.ch3a) {
+        *ptr++ = flag;
+    }
+    ptr = buffer->data() + band_data;
+    for (const std::vector<uint8_t> &band : compressed) {
+        write(band.data(), band.size());
+    }
+
+    attach(buffer, buffer->data(), buffer->size());
+}
+
+bool L1aArchive::attach(std::shared_ptr<const void> storage, const char *data, size_t size) {
+    static_assert(sizeof(Header) == 64, "Header layout changed");
+    static_assert(sizeof(ImagerEntry) == 48, "ImagerEntry layout changed");
+    static_assert(sizeof(CalEntry) == 64, "CalEntry layout changed");
+
+    if (size < sizeof(Header)) return false;
+    const Header *header = (const Header *)data;
+    if (std::memcmp(header->magic, "LHRPTL1A", sizeof(header->magic)) != 0 || header->version != 1 ||
+        header->size != size || header->band_rows == 0) {
+        return false;
+    }
+    if (header->imagers > size || header->caldata > size || header->ch3a > size ||
+        sizeof(Header) + header->imagers * sizeof(ImagerEntry) + header->caldata * sizeof(CalEntry) > size ||
+        header->ch3a_offset > size - header->ch3a) {
+        return false;
+    }
+
+    // Make sure reads can't go out of bounds
+    auto in_bounds = [size](uint64_t offset, uint64_t count, uint64_t element) {
+        return offset % 8 == 0 && count <= size / element && offset <= size - count * element;
+    };
+    const ImagerEntry *imagers = (const ImagerEntry *)(data + sizeof(Header));
+    for (size_t i = 0; i < header->imagers; i++) {
+        const ImagerEntry &entry = imagers[i];
+        if (entry.width == 0 || entry.width > (1 << 20) || entry.rows > UINT32_MAX || entry.channels > 256) return false;
+
+        uint64_t bands = entry.channels * ((entry.rows + header->band_rows - 1) / header->band_rows);
+        if (!in_bounds(entry.timestamp_offset, entry.timestamps, sizeof(double)) ||
+            !in_bounds(entry.band_offset, bands, sizeof(Band))) {
+            return false;
+        }
+        const Band *table = (const Band *)(data + entry.band_offset);
+        for (size_t j = 0; j < bands; j++) {
+            if (table[j].offset > size || table[j].size > size - table[j].offset) return false;
+        }
+    }
+    const CalEntry *caldata = (const CalEntry *)(data + sizeof(Header) + header->imagers * sizeof(ImagerEntry));
+    for (size_t i = 0; i < header->caldata; i++) {
+        if (caldata[i].name[sizeof(caldata[i].name) - 1] != '\0') return false;
+    }
+
+    m_storage = std::move(storage);
+    m_data = data;
+    m_bytes = size;
+    m_header = header;
+    m_imagers = imagers;
+    m_caldata = caldata;
+    return true;
+}
+
+const L1aArchive::ImagerEntry *L1aArchive::find(Imager imager) const {
+    for (size_t i = 0; i < (m_header ? m_header->imagers : 0); i++) {
+        if (m_imagers[i].imager == (uint32_t)imager) return &m_imagers[i];
+    }
+    return nullptr;
+}
+
+std::vector<Imager> L1aArchive::imagers() const {
+    std::vector<Imager> imagers;
+    for (size_t i = 0; i < (m_header ? m_header->imagers : 0); i++) {
+        imagers.push_back((Imager)m_imagers[i].imager);
+    }
+    return imagers;
+}
+
+bool L1aArchive::read(Imager imager, size_t channel, size_t first, size_t count, uint16_t *out, size_t stride) const {
+    const ImagerEntry *entry = find(imager);
+    if (entry == nullptr || channel >= entry->channels || first > entry->rows || count > entry->rows - first) return false;
+    if (count == 0) return true;
+
+    size_t band_rows = m_header->band_rows;
+    size_t width = entry->width;
+    const Band *table = (const Band *)(m_data + entry->band_offset) + channel * bands(*entry);
+    size_t first_band = first / band_rows;
+    size_t last_band = (first + count - 1) / band_rows;
+
+    std::vector<char> ok(last_band - first_band + 1, true);
+#pragma omp parallel for
+    for (size_t i = first_band; i <= last_band; i++) {
+        size_t start = i * band_rows;
+        size_t rows = std::min(band_rows, entry->rows - start);
+        size_t n = width * rows;
+
+        std::vector<uint8_t> planes(n * 2);
+        uLongf size = planes.size();
+        if (uncompress(planes.data(), &size, (const Bytef *)(m_data + table[i].offset), table[i].size) != Z_OK ||
+            size != planes.size()) {
+            ok[i - first_band] = false;
+            continue;
+        }
+
+        // Only the lines that were asked for
+        for (size_t y = std::max(start, first); y < std::min(start + rows, first + count); y++) {
+            const uint8_t *low = &planes[(y - start) * width];
+            const uint8_t *high = low + n;
+            uint16_t *line = &out[(y - first) * stride];
+
+            uint16_t value = 0;
+            for (size_t x = 0; x < width; x++) {
+                value += low[x] | high[x] << 8;
+                line[x] = value;
+            }
+        }
+    }
+
+    return std::all_of(ok.begin(), ok.end(), [](char x) { return x; });
+}
+
+Data L1aArchive::metadata() const {
+    Data data;
+    if (empty()) return data;
+
+    for (size_t i = 0; i < m_header->imagers; i++) {
+        const ImagerEntry &entry = m_imagers[i];
+        const double *timestamps = (const double *)(m_data + entry.timestamp_offset);
+        data.timestamps[(Imager)entry.imager] = std::vector<double>(timestamps, timestamps + entry.timestamps);
+    }
+    for (size_t i = 0; i < m_header->caldata; i++) {
+        data.caldata[m_caldata[i].name] = m_caldata[i].value;
+    }
+    const uint8_t *ch3a = (const uint8_t *)(m_data + m_header->ch3a_offset);
+    data.ch3a.assign(ch3a, ch3a + m_header->ch3a);
+
+    return data;
+}
+
+bool L1aArchive::save(const std::string &filename) const {
+    if (m_data == nullptr) return false;
+
+    // Written to a temporary file first so that a partially written archive is never opened
+    QSaveFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    if (file.write(m_data, m_bytes) != (qint64)m_bytes) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+L1aArchive L1aArchive::open(const std::string &filename) {
+    auto file = std::make_shared<QFile>(QString::fromStdString(filename));
+    if (!file->open(QIODevice::ReadOnly)) return L1aArchive();
+
+    // The mapping stays valid for as long as the file is open
+    size_t size = file->size();
+    const char *data = (const char *)file->map(0, size);
+    L1aArchive archive;
+    if (data == nullptr || !archive.attach(file, data, size)) return L1aArchive();
+    return archive;
+}
+
+bool L1aArchive::is_archive(const std::string &filename) {
+    QFile file(QString::fromStdString(filename));
+    char magic[8];
+    return file.open(QIODevice::ReadOnly) && file.read(magic, sizeof(magic)) == sizeof(magic) &&
+           std::memcmp(magic, "LHRPTL1A", sizeof(magic)) == 0;
+}
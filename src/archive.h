@@ -0,0 +1,129 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_ARCHIVE_H_
+#define LEANHRPT_ARCHIVE_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoders/decoder.h"
+#include "satinfo.h"
+
+/**
+ * An archive of decoded (L1a) data
+ *
+ * Holds everything a `Decoder` produces: the raw channels of every imager,
+ * timestamps, calibration data and the channel 3A flags, along with the
+ * satellite and protocol. Loading an archive skips fingerprinting, deframing
+ * and decoding entirely.
+ *
+ * Channels are stored in bands of `band_rows` lines, each band is delta
+ * filtered, split into byte planes and compressed with zlib on its fastest
+ * setting. Any range of lines can be read by decompressing only the bands
+ * covering it. On disk the archive is a 64 byte header, a table of imagers,
+ * the calibration data, the timestamps and band table of every imager, the
+ * channel 3A flags and then the bands. Saved archives are memory mapped when
+ * opened. Copies share the buffer.
+ */
+class L1aArchive {
+   public:
+    L1aArchive() = default;
+    /// @throws std::runtime_error If a band can't be compressed, or a calibration data name is longer than 55 characters
+    L1aArchive(const Data &data, SatID satellite, Protocol protocol, size_t band_rows = 256);
+
+    /// If there is nothing in the archive (or it failed to open)
+    bool empty() const { return m_header == nullptr; }
+    SatID satellite() const { return (SatID)m_header->satellite; }
+    Protocol protocol() const { return (Protocol)m_header->protocol; }
+    /// The imagers in the archive, in the same order as `Data::imagers`
+    std::vector<Imager> imagers() const;
+    bool has_imager(Imager imager) const { return find(imager) != nullptr; }
+    size_t width(Imager imager) const { return find(imager)->width; }
+    size_t rows(Imager imager) const { return find(imager)->rows; }
+    size_t channels(Imager imager) const { return find(imager)->channels; }
+
+    /**
+     * Decompress lines of a channel
+     *
+     * @param first The first line to read
+     * @param count The number of lines to read, must be within the image
+     * @param out Where to write the lines to
+     * @param stride Distance between lines in `out`, in samples
+     */
+    bool read(Imager imager, size_t channel, size_t first, size_t count, uint16_t *out, size_t stride) const;
+    /// Timestamps, calibration data and channel 3A flags (no imagers)
+    Data metadata() const;
+
+    /// Save the archive
+    bool save(const std::string &filename) const;
+    /// Open (memory map) a saved archive, the archive is empty if it fails
+    static L1aArchive open(const std::string &filename);
+    /// If a file looks like an archive
+    static bool is_archive(const std::string &filename);
+
+   private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t satellite;
+        uint32_t protocol;
+        uint32_t band_rows;
+        uint64_t imagers;
+        uint64_t caldata;
+        uint64_t ch3a;
+        uint64_t ch3a_offset;
+        uint64_t size;
+    };
+    struct ImagerEntry {
+        uint32_t imager;
+        uint32_t channels;
+        uint64_t width;
+        uint64_t rows;
+        uint64_t timestamps;
+        // Offsets of the timestamps and band table, the band table is channel major
+        uint64_t timestamp_offset;
+        uint64_t band_offset;
+    };
+    struct CalEntry {
+        char name[56];
+        double value;
+    };
+    struct Band {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Point into a buffer, checking that it is valid
+    bool attach(std::shared_ptr<const void> storage, const char *data, size_t size);
+    const ImagerEntry *find(Imager imager) const;
+    size_t bands(const ImagerEntry &entry) const { return (entry.rows + m_header->band_rows - 1) / m_header->band_rows; }
+
+    // Keeps the buffer alive (a vector or a memory mapped file)
+    std::shared_ptr<const void> m_storage;
+    const char *m_data = nullptr;
+    size_t m_bytes = 0;
+    const Header *m_header = nullptr;
+    const ImagerEntry *m_imagers = nullptr;
+    const CalEntry *m_caldata = nullptr;
+};
+
+#endif
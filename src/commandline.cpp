@@ -19,112 +19,305 @@
 #include "commandline.h"
 
 #include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLocale>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
 #include <array>
+#include <atomic>
 #include <iostream>
+#include <set>
+#include <stdexcept>
 
+#include "archive.h"
 #include "config/preset.h"
 #include "decoders/decoder.h"
+#include "decoders/stream.h"
 #include "fingerprint.h"
 #include "geometry.h"
 #include "image/compositor.h"
+#include "image/geotiff.h"
+#include "image/png.h"
 #include "map.h"
 #include "network.h"
+#include "passgeolocation.h"
 #include "protocol/timestamp.h"
 #include "satinfo.h"
+#include "stats.h"
 
 static ulong str2ulong(QString str) {
     QLocale l(QLocale::C);
     return l.toULong(str);
 }
 
-int parseCommandLine(QCommandLineParser &parser) {
-    QString filename = parser.positionalArguments().first();
-    if (filename.isEmpty()) return 1;
+// clang-format off
+const std::map<std::string, Protocol> protocol_names = {
+    { "hrpt",        Protocol::HRPT },
+    { "gac",         Protocol::GAC },
+    { "gac-reverse", Protocol::GACReverse },
+    { "dsb",         Protocol::DSB },
+    { "ahrpt",       Protocol::AHRPT },
+    { "meteor-hrpt", Protocol::MeteorHRPT },
+    { "lrpt",        Protocol::LRPT },
+    { "fy-hrpt",     Protocol::FengYunHRPT },
+};
+const std::map<std::string, map::Mosaic::Rule> mosaic_rules = {
+    { "nadir",  map::Mosaic::Rule::Nadir },
+    { "zenith", map::Mosaic::Rule::Zenith },
+    { "newest", map::Mosaic::Rule::Newest },
+};
+const std::map<std::string, transform::CRS> crs_names = {
+    { "equirectangular", transform::CRS::Equirectangular },
+    { "mercator",        transform::CRS::Mercator },
+    { "north-polar",     transform::CRS::North_Polar },
+    { "south-polar",     transform::CRS::South_Polar },
+};
+const std::map<std::string, FileType> format_names = {
+    { "raw",   FileType::Raw },
+    { "cadu",  FileType::CADU },
+    { "vcdu",  FileType::VCDU },
+    { "raw16", FileType::raw16 },
+    { "hrp",   FileType::HRP },
+    { "tip",   FileType::TIP },
+};
+// clang-format on
 
-    QString outdir = parser.value("out");
-    if (!outdir.isEmpty() && !QDir(outdir).exists()) {
-        std::cout << "Output directory doesn't exist, creating it" << std::endl;
-        QDir().mkdir(outdir);
+/// Work out what is being received, streams can't be fingerprinted so this comes from the command line
+static bool parse_stream_options(QCommandLineParser &parser, SatID &sat, FileType &type, Protocol &protocol) {
+    sat = SatID::Unknown;
+    for (const auto &satellite : satellite_info) {
+        if (QString::fromStdString(satellite.second.name).compare(parser.value("satellite"), Qt::CaseInsensitive) == 0) {
+            sat = satellite.first;
+        }
+    }
+    if (sat == SatID::Unknown) {
+        std::cout << "Streaming requires a known satellite (--satellite), e.g. NOAA-19" << std::endl;
+        return false;
     }
 
-    bool have_map = false;
-    bool have_landmarks = false;
-    std::array<std::vector<QLineF>, 36 * 18> map_buckets;
-    std::vector<Landmark> landmarks;
+    if (parser.isSet("protocol")) {
+        if (!protocol_names.count(parser.value("protocol").toStdString())) {
+            std::cout << "Unknown protocol" << std::endl;
+            return false;
+        }
+        protocol = protocol_names.at(parser.value("protocol").toStdString());
+    } else {
+        switch (satellite_info.at(sat).mission) {
+            case Mission::POES:
+                protocol = Protocol::HRPT;
+                break;
+            case Mission::MeteorM:
+                protocol = Protocol::MeteorHRPT;
+                break;
+            case Mission::FengYun3:
+                protocol = Protocol::FengYunHRPT;
+                break;
+            case Mission::MetOp:
+                protocol = Protocol::AHRPT;
+                break;
+        }
+    }
 
-    QString shapefile_path = parser.value("map");
-    if (!shapefile_path.isEmpty()) {
-        if (!map::verify_shapefile(shapefile_path.toStdString())) {
-            std::cout << "Could not open shapefile" << std::endl;
-            return 1;
+    if (parser.isSet("format")) {
+        if (!format_names.count(parser.value("format").toStdString())) {
+            std::cout << "Unknown format" << std::endl;
+            return false;
         }
+        type = format_names.at(parser.value("format").toStdString());
+    } else if (protocol == Protocol::AHRPT || protocol == Protocol::FengYunHRPT || protocol == Protocol::LRPT) {
+        type = FileType::CADU;
+    } else if (protocol == Protocol::DSB) {
+        type = FileType::TIP;
+    } else {
+        type = FileType::Raw;
+    }
 
-        map_buckets = map::index_line_segments(map::read_shapefile(shapefile_path.toStdString()));
-        have_map = true;
+    return true;
+}
+
+/// Replace template strings in an output filename
+static QString output_filename(const std::string &name, const QString &sat, Imager imager, const QString &time) {
+    QString filename = QString::fromStdString(name);
+    filename = filename.replace("{sat}", sat);
+    filename = filename.replace("{time}", time);
+    filename = filename.replace("{sensor}", QString::fromStdString(sensor_info.at(imager).name));
+    return filename;
+}
+/// @copydoc output_filename
+static QString output_filename(const std::string &name, SatID sat, Imager imager, const QString &time) {
+    return output_filename(name, QString::fromStdString(satellite_info.at(sat).name), imager, time);
+}
+
+/// If an output is meant for an imager, `quiet` suppresses the warning about invalid outputs
+static bool output_applies(const std::string &name, std::map<std::string, std::string> &settings, Imager imager,
+                           bool quiet = false) {
+    if (!settings.count("sensors")) {
+        if (!quiet) std::cout << "Image \"" << name << "\" doesn't specify what sensors it works on, skipping" << std::endl;
+        return false;
     }
+    return settings["sensors"].find(sensor_info.at(imager).name) != std::string::npos;
+}
 
-    QString landmark_path = parser.value("landmark");
-    if (!landmark_path.isEmpty()) {
-        landmarks = map::read_landmarks(landmark_path.toStdString());
-        if (landmarks.size() != 0) {
-            have_landmarks = true;
+/**
+ * Generate the image described by an output, without any equalization or postprocessing
+ *
+ * @param sources Set to the channels the image was made from, empty for expressions
+ * @return false if the output is invalid
+ */
+static bool generate_source(ImageCompositor &compositor, Imager imager, const std::string &name,
+                            std::map<std::string, std::string> &settings, const PresetManager &preset_manager, QImage &image,
+                            std::vector<size_t> &sources) {
+    sources.clear();
+    image = QImage(compositor.width(), compositor.height(), QImage::Format_RGBX64);
+    if (settings.count("preset")) {
+        // Preset
+        if (!preset_manager.presets.count(settings["preset"])) {
+            std::cout << "Image \"" << name << "\" uses an unknown preset, skipping" << std::endl;
+            return false;
         }
+        Preset preset = preset_manager.presets.at(settings["preset"]);
+        std::string expression = preset.expression;
+        if (preset.overrides.count(imager)) {
+            expression = preset.overrides.at(imager);
+        }
+        compositor.getExpression(image, expression);
+    } else if (settings.count("channel")) {
+        // Single channel
+        sources = {str2ulong(QString::fromStdString(settings["channel"]))};
+        compositor.getChannel(image, sources[0]);
+    } else if (settings.count("composite")) {
+        // RGB composite
+        QStringList _channels = QString::fromStdString(settings["composite"]).split(",");
+        std::array<size_t, 3> channels = {str2ulong(_channels[0]), str2ulong(_channels[1]), str2ulong(_channels[2])};
+        compositor.getComposite(image, channels);
+        sources.assign(channels.begin(), channels.end());
+    } else {
+        std::cout << "Image \"" << name << "\" has no source, skipping" << std::endl;
+        return false;
     }
 
-    TLEManager *tles;
-    if (have_map || have_landmarks) {
-        tles = new TLEManager;
-    }
+    return true;
+}
 
-    std::cout << "Fingerprinting \"" << filename.toStdString() << "\"" << std::endl;
+/**
+ * Equalise an image generated by `generate_source`
+ *
+ * Channels and composites are equalised with the histograms kept by the compositor
+ *
+ * @return false if the equalization is invalid
+ */
+static bool equalise_output(ImageCompositor &compositor, const std::string &name, std::map<std::string, std::string> &settings,
+                            QImage &image, const std::vector<size_t> &sources) {
+    std::string equalization = settings.count("equalization") ? settings["equalization"] : "none";
+    std::string brightnessonly = settings.count("brightnessonly") ? settings["brightnessonly"] : "true";
 
-    SatID sat;
-    FileType type;
-    Protocol protocol;
-    std::tie(sat, type, protocol) = Fingerprint().file(filename.toStdString(),Suggestion::Automatic);
+    Equalization type;
+    if (equalization == "histogram") {
+        type = Equalization::Histogram;
+    } else if (equalization == "stretch") {
+        type = Equalization::Stretch;
+    } else if (equalization == "none") {
+        type = Equalization::None;
+    } else {
+        std::cout << "Image \"" << name << "\" uses an unknown equalization, skipping" << std::endl;
+        return false;
+    }
 
-    if (sat == SatID::Unknown) {
-        std::cout << "Unable to identify satellite" << std::endl;
-        return 1;
+    if (sources.empty()) {
+        ImageCompositor::equalise(image, type, 1.0f, brightnessonly == "true");
     } else {
-        std::cout << "Satellite is " << satellite_info.at(sat).name << std::endl;
+        compositor.equalise(image, type, 1.0f, brightnessonly == "true", sources);
     }
 
-    Decoder *decoder = Decoder::make(protocol, sat);
+    return true;
+}
 
-    std::cout << "Decoding" << std::endl;
+/// Everything that is loaded once and then shared, read only, between passes
+struct SharedResources {
+    QString outdir;
+    bool flip = false;
+    inipp::Ini<char> ini;
+    PresetManager preset_manager;
 
-    decoder->decodeFile(filename.toStdString(), type);
-    Data data = decoder->get();
-    std::cout << "Finished decoding" << std::endl;
+    bool have_map = false;
+    bool have_landmarks = false;
+    map::SegmentIndex map_index;
+    std::vector<Landmark> landmarks;
+    // Export a geolocation grid of every nth pixel, 0 if disabled
+    size_t geolocation_decimation = 0;
+    // zlib compression level of PNGs
+    int png_level = Z_DEFAULT_COMPRESSION;
+    // Save the decoded data of every pass as an L1a archive
+    bool save_l1a = false;
+    // Save the sync telemetry of every pass as JSON
+    bool save_sync = false;
+    // Combine every pass into one projected image per output
+    bool mosaic = false;
+    TLEManager *tles = nullptr;
 
-    // Timestamp is the middle of the pass on the main imager
-    for (auto &sensor : data.timestamps) {
-        std::vector<double> &timestamp = sensor.second;
+    // Output pipeline, shared by every pass so that the memory budget is global (these are all thread safe)
+    mutable QThreadPool composite_pool;
+    mutable QThreadPool equalise_pool;
+    mutable QThreadPool encode_pool;
+    // In MiB
+    mutable QSemaphore memory_budget;
+    int memory_limit;
+};
 
-        if (protocol == Protocol::GACReverse) {
-            reverse(timestamp);
+static bool load_resources(QCommandLineParser &parser, SharedResources &resources) {
+    resources.outdir = parser.value("out");
+    if (!resources.outdir.isEmpty() && !QDir(resources.outdir).exists()) {
+        std::cout << "Output directory doesn't exist, creating it" << std::endl;
+        QDir().mkdir(resources.outdir);
+    }
+    resources.flip = parser.isSet("flip");
+    resources.memory_limit = std::max(parser.isSet("memory") ? parser.value("memory").toInt() : 2048, 1);
+    resources.memory_budget.release(resources.memory_limit);
+    resources.save_l1a = parser.isSet("l1a");
+    resources.save_sync = parser.isSet("sync");
+    resources.mosaic = parser.isSet("mosaic");
+    if (parser.isSet("png-level")) {
+        resources.png_level = std::min(std::max(parser.value("png-level").toInt(), 0), 9);
+    }
+
+    QString shapefile_path = parser.value("map");
+    if (!shapefile_path.isEmpty()) {
+        if (!map::verify_shapefile(shapefile_path.toStdString())) {
+            std::cout << "Could not open shapefile" << std::endl;
+            return false;
         }
 
-        timestamp = filter_timestamps(timestamp);
+        resources.map_index = map::load_shapefile(shapefile_path.toStdString());
+        resources.have_map = true;
     }
 
-    QDateTime timestamp;
-    {
-        Imager default_imager = satellite_info.at(sat).default_imager;
-        std::vector<double> medianv = data.timestamps[default_imager];
-        std::sort(medianv.begin(), medianv.end());
-        medianv.erase(std::remove(medianv.begin(), medianv.end(), 0.0), medianv.end());
-        timestamp.setSecsSinceEpoch(medianv[medianv.size() / 2]);
+    QString landmark_path = parser.value("landmark");
+    if (!landmark_path.isEmpty()) {
+        resources.landmarks = map::read_landmarks(landmark_path.toStdString());
+        if (resources.landmarks.size() != 0) {
+            resources.have_landmarks = true;
+        }
     }
 
-    inipp::Ini<char> ini;
+    if (parser.isSet("geolocation")) {
+        resources.geolocation_decimation = std::max(parser.value("geolocation").toInt(), 1);
+    }
+
+    if (resources.have_map || resources.have_landmarks || resources.geolocation_decimation != 0 || resources.mosaic) {
+        resources.tles = new TLEManager;
+    }
+
+    inipp::Ini<char> &ini = resources.ini;
     if (parser.isSet("ini")) {
         std::ifstream ifs(parser.value("ini").toStdString());
         if (!ifs.is_open()) {
             std::cout << "Could not open composite definition file" << std::endl;
-            return 1;
+            return false;
         }
         ini.parse(ifs);
         ifs.close();
@@ -154,105 +347,715 @@ int parseCommandLine(QCommandLineParser &parser) {
         ini.sections["{sat}_{time}_{sensor}_Thermal_CONT.png"] = settings;
     }
 
-    PresetManager preset_manager;
+    return true;
+}
+
+/// If TLEs are available for a satellite, only needed for map and landmark overlays
+static bool have_tles(const SharedResources &resources, SatID sat) {
+    return resources.tles != nullptr && resources.tles->catalog_by_norad.count((int)sat);
+}
+
+/**
+ * Put the timestamps of a pass in order and filter out bad ones
+ *
+ * @return The middle of the pass on the main imager, or now if there are no valid timestamps
+ */
+static QDateTime clean_timestamps(Data &data, SatID sat, Protocol protocol) {
+    for (auto &sensor : data.timestamps) {
+        std::vector<double> &timestamp = sensor.second;
+
+        if (protocol == Protocol::GACReverse) {
+            reverse(timestamp);
+        }
+
+        timestamp = filter_timestamps(timestamp);
+    }
+
+    QDateTime timestamp = QDateTime::currentDateTime();
+    Imager default_imager = satellite_info.at(sat).default_imager;
+    std::vector<double> medianv = data.timestamps[default_imager];
+    std::sort(medianv.begin(), medianv.end());
+    medianv.erase(std::remove(medianv.begin(), medianv.end(), 0.0), medianv.end());
+    if (medianv.size() != 0) {
+        timestamp.setSecsSinceEpoch(medianv[medianv.size() / 2]);
+    }
+
+    return timestamp;
+}
+
+/// Write the sync telemetry of every deframer of a pass as JSON
+static bool save_sync_telemetry(const std::map<std::string, SyncTelemetry> &sync, const QString &filename) {
+    QJsonObject deframers;
+    for (auto &deframer : sync) {
+        const SyncTelemetry &telemetry = deframer.second;
+
+        QJsonArray events;
+        for (const SyncTelemetry::Event &event : telemetry.events) {
+            QString type;
+            switch (event.type) {
+                case SyncTelemetry::EventType::Lock:
+                    type = "lock";
+                    break;
+                case SyncTelemetry::EventType::Loss:
+                    type = "loss";
+                    break;
+                case SyncTelemetry::EventType::Inversion:
+                    type = "inversion";
+                    break;
+            }
+            events.append(QJsonObject{{"type", type}, {"offset", (double)event.offset}});
+        }
+        QJsonArray asm_errors;
+        for (uint64_t frames : telemetry.asm_errors) asm_errors.append((double)frames);
+        QJsonArray frames_per_second;
+        for (uint64_t frames : telemetry.frames_per_second) frames_per_second.append((double)frames);
+        QJsonArray frames_per_processing_second;
+        for (uint64_t frames : telemetry.frames_per_processing_second) frames_per_processing_second.append((double)frames);
+
+        QJsonObject object;
+        object["bytes"] = (double)telemetry.bytes;
+        object["frames"] = (double)telemetry.frames;
+        object["events"] = events;
+        object["asm_errors"] = asm_errors;
+        object["byte_rate"] = telemetry.byte_rate;
+        object["frames_per_second"] = frames_per_second;
+        object["frames_per_processing_second"] = frames_per_processing_second;
+        deframers[QString::fromStdString(deframer.first)] = object;
+    }
+
+    QSaveFile file(filename);
+    return file.open(QIODevice::WriteOnly) && file.write(QJsonDocument(deframers).toJson()) != -1 && file.commit();
+}
+
+/**
+ * Render every output of a pass, from either decoded data or an archive (in which case `data` is its metadata)
+ *
+ * @return If every geolocation grid could be written
+ */
+static bool write_outputs(Data data, SatID sat, Protocol protocol, const SharedResources &resources,
+                          const L1aArchive *archive = nullptr) {
+    bool ok = true;
+
+    // Archived before the timestamps are cleaned up, so it holds exactly what was decoded
+    L1aArchive l1a;
+    if (resources.save_l1a && archive == nullptr) {
+        try {
+            l1a = L1aArchive(data, sat, protocol);
+        } catch (std::runtime_error &e) {
+            std::cout << "Could not archive the pass: " << e.what() << std::endl;
+            ok = false;
+        }
+    }
+    std::vector<Imager> imagers;
+    if (archive) {
+        imagers = archive->imagers();
+    } else {
+        for (auto &sensor_data : data.imagers) imagers.push_back(sensor_data.first);
+    }
+
+    QDateTime timestamp = clean_timestamps(data, sat, protocol);
+
+    if (!l1a.empty()) {
+        QString filename = output_filename("{sat}_{time}.l1a", sat, satellite_info.at(sat).default_imager,
+                                           timestamp.toString("yyyyMMdd-hhmmss"));
+        std::cout << "Writing \"" << filename.toStdString() << "\"" << std::endl;
+        if (!l1a.save(QDir(resources.outdir).filePath(filename).toStdString())) {
+            std::cout << "Could not write archive" << std::endl;
+            ok = false;
+        }
+    }
+
+    // Archives don't keep sync telemetry
+    if (resources.save_sync && !data.sync.empty()) {
+        QString filename = output_filename("{sat}_{time}_sync.json", sat, satellite_info.at(sat).default_imager,
+                                           timestamp.toString("yyyyMMdd-hhmmss"));
+        std::cout << "Writing \"" << filename.toStdString() << "\"" << std::endl;
+        if (!save_sync_telemetry(data.sync, QDir(resources.outdir).filePath(filename))) {
+            std::cout << "Could not write sync telemetry" << std::endl;
+        }
+    }
 
+    // Geolocation is shared by every output of the pass
+    std::unique_ptr<PassGeolocation> geolocation;
+    if ((resources.have_map || resources.have_landmarks || resources.geolocation_decimation != 0) && have_tles(resources, sat)) {
+        geolocation.reset(new PassGeolocation(resources.tles->catalog_by_norad.at((int)sat), sat, data.timestamps));
+    }
+
+    // Set every compositor up before rendering starts, from then on they are only read
     std::map<Imager, ImageCompositor> compositors;
-    for (auto &sensor_data : data.imagers) {
-        Imager imager = sensor_data.first;
-        RawImage *image = sensor_data.second;
-
-        compositors[imager].import(image, sat, imager, data.caldata);
-        compositors[imager].ch3a = data.ch3a;
-
-        for (auto &file : ini.sections) {
-            // Replace template strings in filename
-            QString filename = QString::fromStdString(file.first);
-            filename = filename.replace("{sat}", QString::fromStdString(satellite_info.at(sat).name));
-            filename = filename.replace("{time}", timestamp.toString("yyyyMMdd-hhmmss"));
-            filename = filename.replace("{sensor}", QString::fromStdString(sensor_info.at(imager).name));
-
-            // Parse settings
-            std::string sensors;
-            if (file.second.count("sensors")) {
-                sensors = file.second["sensors"];
-            } else {
-                std::cout << "Image \"" << file.first << "\" doesn't specify what sensors it works on, skipping" << std::endl;
-                continue;
+    for (Imager imager : imagers) {
+        ImageCompositor &compositor = compositors[imager];
+
+        if (archive) {
+            compositor.import(*archive, imager);
+        } else {
+            compositor.import(data.imagers.at(imager), sat, imager, data.caldata);
+        }
+        compositor.ch3a = data.ch3a;
+        compositor.setFlipped(resources.flip);
+
+        if (geolocation && resources.geolocation_decimation != 0) {
+            GeolocationGrid grid = geolocation->grid(imager, compositor.width(), resources.geolocation_decimation);
+            if (grid.latitude.size() != 0) {
+                QString filename =
+                    output_filename("{sat}_{time}_{sensor}.geo", sat, imager, timestamp.toString("yyyyMMdd-hhmmss"));
+                std::cout << "Writing \"" << filename.toStdString() << "\"" << std::endl;
+                if (!Projector::save_grid_file(grid, QDir(resources.outdir).filePath(filename).toStdString())) {
+                    std::cout << "Could not write geolocation grid" << std::endl;
+                    ok = false;
+                }
             }
-            std::string equalization = file.second.count("equalization") ? file.second["equalization"] : "none";
-            std::string brightnessonly = file.second.count("brightnessonly") ? file.second["brightnessonly"] : "true";
-            std::string corrected = file.second.count("corrected") ? file.second["corrected"] : "true";
+        }
+
+        if (geolocation && (resources.have_map || resources.have_landmarks)) {
+            size_t width = compositor.width();
+
+            if (resources.have_map) {
+                compositor.overlay = *geolocation->map_overlay(imager, width, "map", resources.map_index);
+                compositor.enable_map = true;
+                compositor.map_color = QColor(255, 255, 0);
+            }
+            if (resources.have_landmarks) {
+                compositor.landmarks = *geolocation->landmarks(imager, width, "landmarks", resources.landmarks);
+                compositor.enable_landmarks = true;
+                compositor.landmark_color = QColor(255, 0, 0);
+            }
+        }
+    }
+
+    // Every image that is going to be made
+    struct Output {
+        ImageCompositor *compositor;
+        Imager imager;
+        std::string name;
+        std::map<std::string, std::string> settings;
+        QString filename;
+        QImage image;
+        std::vector<size_t> sources;
+        int cost;
+    };
+    std::vector<std::shared_ptr<Output>> outputs;
+    for (auto &compositor : compositors) {
+        for (auto file : resources.ini.sections) {
+            Imager imager = compositor.first;
 
             // Skip if it doesn't work for this imager
-            if (sensors.find(sensor_info.at(imager).name) == std::string::npos) {
+            if (!output_applies(file.first, file.second, imager)) {
                 continue;
             }
 
-            // Generate the image
-            QImage image(compositors[imager].width(), compositors[imager].height(), QImage::Format_RGBX64);
-            if (file.second.count("preset")) {
-                // Preset
-                Preset preset = preset_manager.presets.at(file.second["preset"]);
-                std::string expression = preset.expression;
-                if (preset.overrides.count(imager)) {
-                    expression = preset.overrides.at(imager);
+            // Worst case is an RGBX64 image plus a copy of it during postprocessing
+            size_t bytes = compositor.second.width() * compositor.second.height() * sizeof(QRgba64) * 2;
+            int cost = std::min(std::max((int)(bytes / (1024 * 1024)), 1), resources.memory_limit);
+
+            QString filename = output_filename(file.first, sat, imager, timestamp.toString("yyyyMMdd-hhmmss"));
+            outputs.push_back(std::make_shared<Output>(
+                Output{&compositor.second, imager, file.first, file.second, filename, QImage(), {}, cost}));
+        }
+    }
+
+    /*
+     * Outputs go through three pipelined stages each on their own pool: compositing, equalization
+     * (and postprocessing) and then encoding. Memory for an output is reserved from the budget
+     * before it's composited and given back once it's written, so this can't run away.
+     */
+    QSemaphore finished;
+    std::atomic<bool> failed(false);
+    for (std::shared_ptr<Output> output : outputs) {
+        auto done = [&resources, &finished, output]() {
+            output->image = QImage();
+            resources.memory_budget.release(output->cost);
+            finished.release();
+        };
+        // Anything thrown in a stage would otherwise end up in a future nobody reads, and `finished` would never be released
+        auto fail = [&failed, output, done](const std::exception &e) {
+            std::cout << "Could not make \"" << output->filename.toStdString() << "\": " << e.what() << std::endl;
+            failed = true;
+            done();
+        };
+
+        QtConcurrent::run(&resources.composite_pool, [&resources, &failed, output, done, fail]() {
+            resources.memory_budget.acquire(output->cost);
+            try {
+                if (!generate_source(*output->compositor, output->imager, output->name, output->settings,
+                                     resources.preset_manager, output->image, output->sources)) {
+                    done();
+                    return;
                 }
-                compositors[imager].getExpression(image, expression);
-            } else if (file.second.count("channel")) {
-                // Single channel
-                compositors[imager].getChannel(image, str2ulong(QString::fromStdString(file.second["channel"])));
-            } else if (file.second.count("composite")) {
-                // RGB composite
-                QStringList _channels = QString::fromStdString(file.second["composite"]).split(",");
-                std::array<size_t, 3> channels = {str2ulong(_channels[0]), str2ulong(_channels[1]), str2ulong(_channels[2])};
-                compositors[imager].getComposite(image, channels);
-            } else {
-                std::cout << "Image \"" << file.first << "\" has no source, skipping" << std::endl;
-                continue;
+            } catch (const std::exception &e) {
+                fail(e);
+                return;
             }
 
-            // Equalize the image
-            if (equalization == "histogram") {
-                ImageCompositor::equalise(image, Equalization::Histogram, 1.0f, brightnessonly == "true");
-            } else if (equalization == "stretch") {
-                ImageCompositor::equalise(image, Equalization::Stretch, 1.0f, brightnessonly == "true");
-            } else if (equalization == "none") {
-                ImageCompositor::equalise(image, Equalization::None, 1.0f, brightnessonly == "true");
-            } else {
-                std::cout << "Image \"" << file.first << "\" uses an unknown equalization, skipping" << std::endl;
+            QtConcurrent::run(&resources.equalise_pool, [&resources, &failed, output, done, fail]() {
+                try {
+                    if (!equalise_output(*output->compositor, output->name, output->settings, output->image, output->sources)) {
+                        done();
+                        return;
+                    }
+                    std::string corrected = output->settings.count("corrected") ? output->settings["corrected"] : "true";
+                    output->compositor->postprocess(output->image, corrected == "true");
+                } catch (const std::exception &e) {
+                    fail(e);
+                    return;
+                }
+
+                QtConcurrent::run(&resources.encode_pool, [&resources, &failed, output, done]() {
+                    std::cout << "Writing \"" << output->filename.toStdString() << "\"" << std::endl;
+                    if (!save_image(output->image, QDir(resources.outdir).filePath(output->filename), resources.png_level)) {
+                        std::cout << "Could not write \"" << output->filename.toStdString() << "\"" << std::endl;
+                        failed = true;
+                    }
+                    done();
+                });
+            });
+        });
+    }
+    finished.acquire(outputs.size());
+
+    return ok && !failed;
+}
+
+/// Fingerprint and decode a recording, nullptr if the satellite couldn't be identified
+static Decoder *decode_file(const QString &filename, SatID &sat, Protocol &protocol) {
+    std::cout << "Fingerprinting \"" << filename.toStdString() << "\"" << std::endl;
+
+    FileType type;
+    std::tie(sat, type, protocol) = Fingerprint().file(filename.toStdString(), Suggestion::Automatic);
+
+    if (sat == SatID::Unknown) {
+        std::cout << "Unable to identify satellite" << std::endl;
+        return nullptr;
+    } else {
+        std::cout << "Satellite is " << satellite_info.at(sat).name << std::endl;
+    }
+
+    Decoder *decoder = Decoder::make(protocol, sat);
+
+    std::cout << "Decoding" << std::endl;
+
+    decoder->decodeFile(filename.toStdString(), type);
+    std::cout << "Finished decoding" << std::endl;
+
+    return decoder;
+}
+
+static int process_file(const QString &filename, const SharedResources &resources) {
+    if (L1aArchive::is_archive(filename.toStdString())) {
+        L1aArchive archive = L1aArchive::open(filename.toStdString());
+        if (archive.empty()) {
+            std::cout << "Could not open archive \"" << filename.toStdString() << "\"" << std::endl;
+            return 1;
+        }
+
+        std::cout << "Loading archive of " << satellite_info.at(archive.satellite()).name << std::endl;
+        return write_outputs(archive.metadata(), archive.satellite(), archive.protocol(), resources, &archive) ? 0 : 1;
+    }
+
+    SatID sat;
+    Protocol protocol;
+    Decoder *decoder = decode_file(filename, sat, protocol);
+    if (decoder == nullptr) {
+        return 1;
+    }
+
+    bool ok = write_outputs(decoder->get(), sat, protocol, resources);
+    delete decoder;
+
+    return ok ? 0 : 1;
+}
+
+static int process_stream(QCommandLineParser &parser, const SharedResources &resources) {
+    QString filename = parser.value("stream");
+
+    SatID sat;
+    FileType type;
+    Protocol protocol;
+    if (!parse_stream_options(parser, sat, type, protocol)) {
+        return 1;
+    }
+
+    double timeout = parser.isSet("timeout") ? parser.value("timeout").toDouble() : 10.0;
+    StreamSource *source = StreamSource::make(filename.toStdString(), timeout);
+    if (source == nullptr) {
+        return 1;
+    }
+    Decoder *decoder = Decoder::make(protocol, sat);
+    auto sections = resources.ini.sections;
+
+    // Periodically write a preview of the first output of every imager, with "live" in place of the time
+    double interval = parser.isSet("interval") ? parser.value("interval").toDouble() : 5.0;
+    std::map<Imager, ImageCompositor> live;
+    decoder->setUpdateCallback(
+        [&]() {
+            Data data = decoder->get();
+            for (auto &sensor_data : data.imagers) {
+                Imager imager = sensor_data.first;
+                ImageCompositor &compositor = live[imager];
+
+                compositor.ch3a = data.ch3a;
+                size_t start = compositor.height();
+                size_t rows = compositor.append(sensor_data.second, sat, imager, data.caldata);
+                if (rows == 0) continue;
+                compositor.setFlipped(resources.flip);
+
+                // Only warp the overlays onto the new band
+                std::vector<double> timestamps = filter_timestamps(data.timestamps[imager]);
+                if ((resources.have_map || resources.have_landmarks) && have_tles(resources, sat) &&
+                    timestamps.size() >= start + rows) {
+                    size_t width = compositor.width();
+                    std::vector<double> band(timestamps.begin() + start, timestamps.begin() + start + rows);
+                    size_t yn = std::max<size_t>(2, (double)rows / (double)width * 21.0);
+
+                    Projector projector(resources.tles->catalog_by_norad.at((int)sat));
+                    std::vector<std::pair<xy, Geodetic>> gcps = projector.calculate_gcps(band, yn, 21, imager, sat, width);
+
+                    if (resources.have_map && gcps.size() != 0) {
+                        for (QLineF line : map::warp_to_pass(resources.map_index, gcps, 21)) {
+                            compositor.overlay.push_back(line.translated(0, start));
+                        }
+                        compositor.enable_map = true;
+                        compositor.map_color = QColor(255, 255, 0);
+                    }
+                    if (resources.have_landmarks && gcps.size() != 0) {
+                        for (Landmark landmark : map::warp_to_pass(resources.landmarks, gcps, 21)) {
+                            landmark.geo += QPointF(0, start);
+                            compositor.landmarks.push_back(landmark);
+                        }
+                        compositor.enable_landmarks = true;
+                        compositor.landmark_color = QColor(255, 0, 0);
+                    }
+                }
+
+                for (auto &file : sections) {
+                    if (!output_applies(file.first, file.second, imager, true)) continue;
+
+                    QImage image;
+                    std::vector<size_t> sources;
+                    if (generate_source(compositor, imager, file.first, file.second, resources.preset_manager, image, sources) &&
+                        equalise_output(compositor, file.first, file.second, image, sources)) {
+                        compositor.postprocess(image);
+                        save_image(image, QDir(resources.outdir).filePath(output_filename(file.first, sat, imager, "live")),
+                                   resources.png_level);
+                    }
+                    break;
+                }
+            }
+            std::cout << "Received " << source->received() << " bytes" << std::endl;
+        },
+        interval);
+
+    std::cout << "Decoding " << satellite_info.at(sat).name << " from \"" << filename.toStdString() << "\"" << std::endl;
+    std::istream stream(source);
+    decoder->decodeStream(stream, type);
+    delete source;
+    std::cout << "Finished decoding" << std::endl;
+
+    bool ok = write_outputs(decoder->get(), sat, protocol, resources);
+    delete decoder;
+
+    return ok ? 0 : 1;
+}
+
+/// Add every file in a directory (oldest first), or listed in a file (one path per line), to `files`
+static bool list_batch(const QString &path, QStringList &files) {
+    if (QFileInfo(path).isDir()) {
+        for (const QFileInfo &file : QDir(path).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed)) {
+            files.push_back(file.absoluteFilePath());
+        }
+        return true;
+    }
+
+    QFile list(path);
+    if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        std::cout << "Could not open \"" << path.toStdString() << "\"" << std::endl;
+        return false;
+    }
+    while (!list.atEnd()) {
+        QString line = QString::fromUtf8(list.readLine()).trimmed();
+        if (!line.isEmpty()) files.push_back(line);
+    }
+    return true;
+}
+
+/**
+ * Process every pass in a directory, or listed in a file (one path per line)
+ *
+ * With `--watch` the directory is polled for new files forever, a file is
+ * only picked up once its size has stopped changing between two polls.
+ */
+static int process_batch(QCommandLineParser &parser, const SharedResources &resources) {
+    QString path = parser.value("batch");
+    QFileInfo info(path);
+    bool watch = parser.isSet("watch") && info.isDir();
+
+    QThreadPool pool;
+    int workers = parser.isSet("workers") ? parser.value("workers").toInt() : QThread::idealThreadCount();
+    pool.setMaxThreadCount(std::max(workers, 1));
+
+    std::set<QString> queued;
+    std::map<QString, qint64> sizes;
+    std::atomic<size_t> failed(0);
+
+    while (true) {
+        QStringList files;
+        if (!list_batch(path, files)) {
+            return 1;
+        }
+
+        for (const QString &file : files) {
+            if (queued.count(file)) continue;
+
+            // Still being written
+            qint64 size = QFileInfo(file).size();
+            if (watch && (!sizes.count(file) || sizes[file] != size)) {
+                sizes[file] = size;
                 continue;
             }
 
-            if (have_map || have_landmarks) {
-                size_t width = compositors[imager].width();
-                size_t height = compositors[imager].height();
+            queued.insert(file);
+            QtConcurrent::run(&pool, [&resources, &failed, file]() {
+                if (process_file(file, resources) != 0) failed++;
+            });
+        }
 
-                Projector projector(tles->catalog_by_norad[(int)sat]);
-                std::vector<std::pair<xy, Geodetic>> gcps =
-                    projector.calculate_gcps(data.timestamps[imager], (height / width) * 21, 21, imager, sat, width);
-                if (gcps.size() == 0) {
+        if (!watch) break;
+        QThread::sleep(5);
+    }
+
+    pool.waitForDone();
+    std::cout << "Processed " << queued.size() << " passes, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+/// A pass loaded for mosaicking, the raw data is released as soon as it is imported
+struct MosaicPass {
+    SatID sat;
+    QDateTime timestamp;
+    std::map<Imager, ImageCompositor> compositors;
+    std::unique_ptr<PassGeolocation> geolocation;
+};
+
+/// Decode a recording (or open an archive) for a mosaic, nullptr if it can't be used
+static std::unique_ptr<MosaicPass> load_mosaic_pass(const QString &filename, const SharedResources &resources) {
+    std::unique_ptr<MosaicPass> pass(new MosaicPass);
+    Data data;
+    Protocol protocol;
+    L1aArchive archive;
+    Decoder *decoder = nullptr;
+
+    if (L1aArchive::is_archive(filename.toStdString())) {
+        archive = L1aArchive::open(filename.toStdString());
+        if (archive.empty()) {
+            std::cout << "Could not open archive \"" << filename.toStdString() << "\"" << std::endl;
+            return nullptr;
+        }
+        pass->sat = archive.satellite();
+        protocol = archive.protocol();
+        data = archive.metadata();
+    } else {
+        decoder = decode_file(filename, pass->sat, protocol);
+        if (decoder == nullptr) {
+            return nullptr;
+        }
+        data = decoder->get();
+    }
+
+    if (!have_tles(resources, pass->sat)) {
+        std::cout << "No TLEs for " << satellite_info.at(pass->sat).name << ", leaving \"" << filename.toStdString()
+                  << "\" out of the mosaic" << std::endl;
+        delete decoder;
+        return nullptr;
+    }
+
+    pass->timestamp = clean_timestamps(data, pass->sat, protocol);
+    std::vector<Imager> imagers;
+    if (archive.empty()) {
+        for (auto &sensor_data : data.imagers) imagers.push_back(sensor_data.first);
+    } else {
+        imagers = archive.imagers();
+    }
+    for (Imager imager : imagers) {
+        ImageCompositor &compositor = pass->compositors[imager];
+        if (archive.empty()) {
+            compositor.import(data.imagers.at(imager), pass->sat, imager, data.caldata);
+        } else {
+            compositor.import(archive, imager);
+        }
+        compositor.ch3a = data.ch3a;
+    }
+    delete decoder;
+
+    pass->geolocation.reset(new PassGeolocation(resources.tles->catalog_by_norad.at((int)pass->sat), pass->sat, data.timestamps));
+    return pass;
+}
+
+/**
+ * Project every pass given into one image per output
+ *
+ * Passes are loaded in parallel, then every output is made for each pass
+ * and combined with `map::Mosaic`. Outputs are rendered and written in
+ * strips, as GeoTIFFs if their name ends in .tif and PNGs otherwise.
+ */
+static int process_mosaic(QCommandLineParser &parser, const SharedResources &resources) {
+    if (!mosaic_rules.count(parser.value("mosaic").toStdString())) {
+        std::cout << "Unknown mosaic rule" << std::endl;
+        return 1;
+    }
+    map::Mosaic::Rule rule = mosaic_rules.at(parser.value("mosaic").toStdString());
+
+    transform::CRS crs = transform::CRS::Equirectangular;
+    if (parser.isSet("crs")) {
+        if (!crs_names.count(parser.value("crs").toStdString())) {
+            std::cout << "Unknown CRS" << std::endl;
+            return 1;
+        }
+        crs = crs_names.at(parser.value("crs").toStdString());
+    }
+    double resolution = parser.isSet("resolution") ? parser.value("resolution").toDouble() : 1.0;
+    if (!(resolution > 0.0)) {
+        std::cout << "Invalid resolution" << std::endl;
+        return 1;
+    }
+
+    QStringList files = parser.positionalArguments();
+    if (parser.isSet("batch") && !list_batch(parser.value("batch"), files)) {
+        return 1;
+    }
+
+    QThreadPool pool;
+    int workers = parser.isSet("workers") ? parser.value("workers").toInt() : QThread::idealThreadCount();
+    pool.setMaxThreadCount(std::max(workers, 1));
+
+    std::vector<std::unique_ptr<MosaicPass>> passes(files.size());
+    for (int i = 0; i < files.size(); i++) {
+        QtConcurrent::run(&pool, [&resources, &passes, &files, i]() { passes[i] = load_mosaic_pass(files[i], resources); });
+    }
+    pool.waitForDone();
+    passes.erase(std::remove(passes.begin(), passes.end(), nullptr), passes.end());
+    if (passes.empty()) {
+        std::cout << "No passes to mosaic" << std::endl;
+        return 1;
+    }
+
+    QDateTime newest = passes[0]->timestamp;
+    std::set<Imager> imagers;
+    for (auto &pass : passes) {
+        newest = std::max(newest, pass->timestamp);
+        for (auto &compositor : pass->compositors) imagers.insert(compositor.first);
+    }
+
+    // Pixels per unit of XY, which is 360 degrees of longitude wide (and 180 of latitude tall when equirectangular)
+    double scale = EARTH_CIRCUMFERENCE / resolution;
+    size_t failed = 0;
+
+    for (auto file : resources.ini.sections) {
+        for (Imager imager : imagers) {
+            if (!output_applies(file.first, file.second, imager)) continue;
+
+            // Every pass with this imager that can be geolocated, and the area they cover together
+            std::vector<std::pair<MosaicPass *, std::shared_ptr<const PassGeolocation::GCPs>>> sources;
+            QRectF bounds;
+            for (auto &pass : passes) {
+                if (!pass->compositors.count(imager)) continue;
+                ImageCompositor &compositor = pass->compositors.at(imager);
+
+                size_t width = compositor.width();
+                size_t y = round((double)compositor.height() / (double)width * 31.0);
+                std::shared_ptr<const PassGeolocation::GCPs> points = pass->geolocation->gcps(imager, width, y, 31);
+                if (points->empty()) continue;
+
+                sources.push_back({pass.get(), points});
+                bounds = bounds.united(map::bounds_crs(*points, crs));
+            }
+            if (sources.empty()) continue;
+
+            double height = crs == transform::CRS::Equirectangular ? bounds.height() * scale / 2.0 : bounds.height() * scale;
+            QSize size(std::max(bounds.width() * scale, 1.0), std::max(height, 1.0));
+
+            map::Mosaic mosaic(size, crs, bounds, rule);
+            for (auto &source : sources) {
+                ImageCompositor &compositor = source.first->compositors.at(imager);
+
+                QImage image;
+                std::vector<size_t> channels;
+                if (!generate_source(compositor, imager, file.first, file.second, resources.preset_manager, image, channels) ||
+                    !equalise_output(compositor, file.first, file.second, image, channels)) {
                     break;
                 }
 
-                if (have_map) {
-                    compositors[imager].overlay = map::warp_to_pass(map_buckets, gcps, 21);
-                    compositors[imager].enable_map = true;
-                    compositors[imager].map_color = QColor(255, 255, 0);
-                }
-                if (have_landmarks) {
-                    compositors[imager].landmarks = map::warp_to_pass(landmarks, gcps, 21);
-                    compositors[imager].enable_landmarks = true;
-                    compositors[imager].landmark_color = QColor(255, 0, 0);
-                }
+                std::shared_ptr<const std::vector<float>> satz =
+                    source.first->geolocation->satellite_zenith(imager, compositor.width());
+                mosaic.add(image, *source.second, 31, source.first->timestamp.toSecsSinceEpoch(), *satz);
+            }
+            if (mosaic.passes() != sources.size()) {
+                std::cout << "Could not make \"" << file.first << "\" for " << sensor_info.at(imager).name << std::endl;
+                failed++;
+                continue;
             }
 
-            compositors[imager].setFlipped(parser.isSet("flip"));
-            compositors[imager].postprocess(image, corrected == "true");
+            QString filename = output_filename(file.first, "Mosaic", imager, newest.toString("yyyyMMdd-hhmmss"));
+            QString suffix = QFileInfo(filename).suffix().toLower();
+            std::unique_ptr<StripWriter> writer;
+            if (suffix == "tif" || suffix == "tiff") {
+                writer.reset(new GeoTiffWriter(QDir(resources.outdir).filePath(filename).toStdString(), size, crs, bounds));
+            } else {
+                if (suffix != "png") filename = QFileInfo(filename).completeBaseName() + ".png";
+                writer.reset(new PngWriter(QDir(resources.outdir).filePath(filename).toStdString(), size, 16,
+                                           PngWriter::Color::RGBA, resources.png_level));
+            }
+            std::cout << "Writing \"" << filename.toStdString() << "\" from " << sources.size() << " passes ("
+                      << size.width() << "x" << size.height() << ")" << std::endl;
 
-            std::cout << "Writing \"" << filename.toStdString() << "\"" << std::endl;
-            image.save(QDir(outdir).filePath(filename));
+            map::StripOverlays overlays;
+            if (resources.have_map) {
+                overlays.lines = map::overlay_lines(resources.map_index, crs, bounds, size);
+                overlays.map_color = QColor(255, 255, 0);
+            }
+            if (resources.have_landmarks) {
+                overlays.landmarks = resources.landmarks;
+                overlays.landmark_color = QColor(255, 0, 0);
+            }
+            if (!map::write_strips(mosaic, overlays, *writer)) {
+                std::cout << "Could not write \"" << filename.toStdString() << "\"" << std::endl;
+                failed++;
+            }
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}
+
+static int process(QCommandLineParser &parser, const SharedResources &resources) {
+    if (parser.isSet("mosaic")) {
+        return process_mosaic(parser, resources);
+    } else if (parser.isSet("batch")) {
+        return process_batch(parser, resources);
+    } else if (parser.isSet("stream")) {
+        return process_stream(parser, resources);
+    }
+
+    QString filename = parser.positionalArguments().value(0);
+    if (filename.isEmpty()) return 1;
+    return process_file(filename, resources);
+}
+
+int parseCommandLine(QCommandLineParser &parser) {
+    SharedResources resources;
+    if (!load_resources(parser, resources)) {
+        return 1;
+    }
+
+    if (parser.isSet("stats")) stats::enable();
+    int result = process(parser, resources);
+
+    if (parser.isSet("stats")) {
+        std::cout << "Writing \"" << parser.value("stats").toStdString() << "\"" << std::endl;
+        if (!stats::save_report(stats::report(), parser.value("stats").toStdString())) {
+            std::cout << "Could not write statistics" << std::endl;
+            return 1;
         }
     }
 
-    return 0;
+    return result;
 }
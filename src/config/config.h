@@ -24,6 +24,9 @@
 #include <QStandardPaths>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 
 // Load a config file, first try looking in the current directory and then config paths
 class Config : public inipp::Ini<char> {
@@ -49,6 +52,23 @@ class Config : public inipp::Ini<char> {
         std::cerr << "Could not open " << filename << std::endl;
     }
 
+    /**
+     * Get a shared copy of a config file, it is only loaded the first time it's requested
+     *
+     * This is for configs that are read for every pass/image (calibration and
+     * projection), changes to them are only picked up after a restart.
+     */
+    static std::shared_ptr<const Config> cached(const std::string &filename) {
+        static std::mutex mutex;
+        static std::map<std::string, std::shared_ptr<const Config>> cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!cache.count(filename)) {
+            cache[filename] = std::make_shared<const Config>(filename);
+        }
+        return cache.at(filename);
+    }
+
    private:
     bool try_load(std::string filename) {
         std::filebuf file;
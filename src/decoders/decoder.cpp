@@ -26,6 +26,8 @@
 #include "noaa_gac.h"
 #include "noaa_hrpt.h"
 
+stats::Stage Decoder::decode_stage("decode");
+
 Decoder *Decoder::make(Protocol protocol, SatID sat) {
     Decoder *decoder;
     switch (protocol) {
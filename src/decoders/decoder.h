@@ -22,11 +22,15 @@
 #include <QDateTime>
 #include <QFileInfo>
 #include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <istream>
 
 #include "image/raw.h"
+#include "protocol/telemetry.h"
 #include "satinfo.h"
+#include "stats.h"
 
 #define BUFFER_SIZE 1024
 
@@ -35,6 +39,8 @@ struct Data {
     std::map<Imager, std::vector<double>> timestamps;
     std::map<std::string, double> caldata;
     std::vector<bool> ch3a;
+    /// Sync telemetry of every deframer, by what it deframes
+    std::map<std::string, SyncTelemetry> sync;
 };
 
 enum class FileType { Raw, CADU, VCDU, raw16, HRP, TIP, Unknown };
@@ -63,14 +69,30 @@ class Decoder {
         if (!_created.isValid()) _created = QDateTime::currentDateTimeUtc();
         created = _created.toSecsSinceEpoch();
 
-        while (is_running && !stream.eof()) {
-            work(stream);
-            read = stream.tellg();
-        }
+        decode(stream, true);
 
         file.close();
         return true;
     }
+
+    /**
+     * Decode from a live source (see StreamSource)
+     *
+     * Runs until the stream ends or `stop()` is called, the data produced so
+     * far can be read with `get()` from the update callback.
+     */
+    void decodeStream(std::istream &stream, FileType filetype) {
+        d_filetype = filetype;
+        created = QDateTime::currentDateTimeUtc().toSecsSinceEpoch();
+
+        decode(stream, false);
+    }
+
+    /// Set a function that is called from the decoding thread at most every `interval` seconds while decoding
+    void setUpdateCallback(std::function<void()> callback, double interval = 1.0) {
+        d_callback = callback;
+        d_interval = interval;
+    }
     /// Current decode progress (0 to 1)
     float progress() { return static_cast<float>(read) / static_cast<float>(filesize); }
 
@@ -82,7 +104,11 @@ class Decoder {
     void stop() { is_running = false; }
 
     /// Get the produced data
-    Data get() { return {images, timestamps, caldata, ch3a}; }
+    Data get() {
+        Data data = {images, timestamps, caldata, ch3a, {}};
+        for (auto &telemetry : sync_telemetry) data.sync[telemetry.first] = *telemetry.second;
+        return data;
+    }
 
     /// Automatically make/allocate a decoder given satid
     static Decoder *make(Protocol protocol, SatID sat);
@@ -93,6 +119,8 @@ class Decoder {
     std::map<Imager, std::vector<double>> timestamps;
     std::map<std::string, double> caldata;
     std::vector<bool> ch3a;
+    // Deframers register their telemetry here to have it included in `get()`
+    std::map<std::string, const SyncTelemetry *> sync_telemetry;
     virtual void work(std::istream &stream) = 0;
     FileType d_filetype;
     time_t created;
@@ -101,6 +129,33 @@ class Decoder {
     std::atomic<bool> is_running;
     size_t read = 0;
     size_t filesize = 1;
+    std::function<void()> d_callback;
+    double d_interval = 1.0;
+    // Includes time spent waiting for data when streaming
+    static stats::Stage decode_stage;
+
+    void decode(std::istream &stream, bool seekable) {
+        auto last_update = std::chrono::steady_clock::now();
+        stats::Timer timer(decode_stage);
+
+        // Decoders read several times per call so `gcount()` only covers the last read, ask the buffer where it is instead
+        // (which unlike `tellg()` still works once the end has been hit)
+        std::streamoff last = stream.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+
+        while (is_running && !stream.eof()) {
+            work(stream);
+            std::streamoff position = stream.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+            timer.bytes(position >= 0 && last >= 0 ? position - last : stream.gcount());
+            last = position;
+            if (seekable) read = position;
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - last_update;
+            if (d_callback && elapsed.count() >= d_interval) {
+                d_callback();
+                last_update = std::chrono::steady_clock::now();
+            }
+        }
+    }
 
     void get_filesize(std::istream &stream) {
         // Get filesize
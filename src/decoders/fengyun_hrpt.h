@@ -30,6 +30,9 @@ class FengyunHRPTDecoder : public Decoder {
         frame = new uint8_t[1024];
         line = new uint8_t[208400 / 8];
         images[Imager::VIRR] = new RawImage(2048, 10);
+        // 6 lines per second
+        virrDeframer.setInputRate(6.0 * 208400 / 8);
+        sync_telemetry["VIRR"] = &virrDeframer.telemetry();
 
         switch (sat) {
             case SatID::FengYun3A:
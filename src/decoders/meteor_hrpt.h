@@ -34,6 +34,13 @@ class MeteorHRPTDecoder : public Decoder {
         msumrFrame = new uint8_t[11850];
         images[Imager::MSUMR] = new RawImage(1572, 6, 4);
         images[Imager::MTVZA] = new RawImage(200, 30);
+        // 665.4 kbps, MSU-MR and MTVZA get 948 and 32 bytes of every CADU
+        deframer.setInputRate(665400.0 / 8);
+        MSUMRDeframer.setInputRate(665400.0 / 8 * 948 / 1024);
+        mtvza_deframer.setInputRate(665400.0 / 8 * 32 / 1024);
+        sync_telemetry["CADU"] = &deframer.telemetry();
+        sync_telemetry["MSU-MR"] = &MSUMRDeframer.telemetry();
+        sync_telemetry["MTVZA"] = &mtvza_deframer.telemetry();
     }
     ~MeteorHRPTDecoder() {
         delete[] frame;
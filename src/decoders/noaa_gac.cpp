@@ -23,14 +23,14 @@
 #include "protocol/reverse.h"
 
 // Contains 1023 bits of data, last bit is zero
-uint8_t pattern[128] = {0x07, 0x40, 0xc9, 0x29, 0x42, 0x5e, 0xee, 0xa8, 0xee, 0x2c, 0x2f, 0xb1, 0xf5, 0x24, 0x21, 0xc8,
-                        0xe6, 0x60, 0x36, 0x6c, 0x5c, 0x79, 0x6f, 0x04, 0x9c, 0xed, 0x36, 0xaa, 0xfd, 0x2a, 0x58, 0xdb,
-                        0xa2, 0x77, 0x92, 0xd6, 0x45, 0x20, 0x07, 0xc4, 0x08, 0xb4, 0x98, 0xcb, 0x3a, 0x44, 0x29, 0x84,
-                        0xff, 0xbd, 0x9f, 0x31, 0x12, 0xb5, 0x15, 0x89, 0x9c, 0x2b, 0x97, 0xf9, 0xca, 0xf5, 0x66, 0x41,
-                        0x06, 0x0b, 0x2a, 0xdc, 0x1a, 0x3f, 0xad, 0x07, 0x02, 0xa9, 0xe7, 0xaf, 0x14, 0x04, 0xde, 0x8d,
-                        0xf8, 0x47, 0xb7, 0xc0, 0x2e, 0xb8, 0x76, 0x1f, 0x94, 0xe3, 0x4f, 0xb9, 0xb9, 0x3d, 0xfc, 0x61,
-                        0xbb, 0x2e, 0xfa, 0x16, 0xd1, 0x79, 0xa9, 0xa5, 0xcf, 0xda, 0xe9, 0x94, 0x67, 0x8e, 0x24, 0x63,
-                        0xa8, 0x28, 0x8d, 0x7c, 0x86, 0x2a, 0x1a, 0xbb, 0x6c, 0x9a, 0xd8, 0x3c, 0x33, 0x43, 0xd3, 0xac};
+const uint8_t gac_pattern[128] = {0x07, 0x40, 0xc9, 0x29, 0x42, 0x5e, 0xee, 0xa8, 0xee, 0x2c, 0x2f, 0xb1, 0xf5, 0x24, 0x21, 0xc8,
+                                  0xe6, 0x60, 0x36, 0x6c, 0x5c, 0x79, 0x6f, 0x04, 0x9c, 0xed, 0x36, 0xaa, 0xfd, 0x2a, 0x58, 0xdb,
+                                  0xa2, 0x77, 0x92, 0xd6, 0x45, 0x20, 0x07, 0xc4, 0x08, 0xb4, 0x98, 0xcb, 0x3a, 0x44, 0x29, 0x84,
+                                  0xff, 0xbd, 0x9f, 0x31, 0x12, 0xb5, 0x15, 0x89, 0x9c, 0x2b, 0x97, 0xf9, 0xca, 0xf5, 0x66, 0x41,
+                                  0x06, 0x0b, 0x2a, 0xdc, 0x1a, 0x3f, 0xad, 0x07, 0x02, 0xa9, 0xe7, 0xaf, 0x14, 0x04, 0xde, 0x8d,
+                                  0xf8, 0x47, 0xb7, 0xc0, 0x2e, 0xb8, 0x76, 0x1f, 0x94, 0xe3, 0x4f, 0xb9, 0xb9, 0x3d, 0xfc, 0x61,
+                                  0xbb, 0x2e, 0xfa, 0x16, 0xd1, 0x79, 0xa9, 0xa5, 0xcf, 0xda, 0xe9, 0x94, 0x67, 0x8e, 0x24, 0x63,
+                                  0xa8, 0x28, 0x8d, 0x7c, 0x86, 0x2a, 0x1a, 0xbb, 0x6c, 0x9a, 0xd8, 0x3c, 0x33, 0x43, 0xd3, 0xac};
 
 void NOAAGACDecoder::init_xor() {
     uint8_t buf = 0;
@@ -40,7 +40,7 @@ void NOAAGACDecoder::init_xor() {
 
     for (size_t i = 0; i < 33270 - offset; i++) {
         size_t j = i % 1023;
-        buf = buf << 1 | std::bitset<8>(pattern[j / 8]).test(7 - (j % 8));
+        buf = buf << 1 | std::bitset<8>(gac_pattern[j / 8]).test(7 - (j % 8));
         bit++;
 
         if (bit == 8) {
@@ -24,6 +24,9 @@
 #include "decoder.h"
 #include "protocol/deframer.h"
 
+/// Pseudo random pattern GAC frames are XORed with (after the sync word), 1023 bits long
+extern const uint8_t gac_pattern[128];
+
 class NOAAGACDecoder : public Decoder {
    public:
     NOAAGACDecoder(bool reverse) : d_reverse(reverse), deframer(8, true), deframer_reverse(8, true) {
@@ -31,6 +34,10 @@ class NOAAGACDecoder : public Decoder {
         images[Imager::HIRS] = new RawImage(56, 20);
         images[Imager::MHS] = new RawImage(90, 6);
         images[Imager::AMSUA] = new RawImage(30, 15);
+        // 2.6616 Mbps
+        deframer.setInputRate(2661600.0 / 8);
+        deframer_reverse.setInputRate(2661600.0 / 8);
+        sync_telemetry["GAC"] = reverse ? &deframer_reverse.telemetry() : &deframer.telemetry();
         init_xor();
     }
 
@@ -33,6 +33,9 @@ class NOAAHRPTDecoder : public Decoder {
         images[Imager::MHS] = new RawImage(90, 6);
         images[Imager::HIRS] = new RawImage(56, 20);
         images[Imager::AMSUA] = new RawImage(30, 15);
+        // 665.4 kbps
+        deframer.setInputRate(665400.0 / 8);
+        sync_telemetry["HRPT"] = &deframer.telemetry();
     }
     ~NOAAHRPTDecoder() {
         delete[] frame;
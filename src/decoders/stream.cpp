@@ -0,0 +1,129 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stream.h"
+
+#include <QFileInfo>
+#include <QTcpSocket>
+#include <QUrl>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+/// stdin, FIFOs and growing files
+class FileSource : public StreamSource {
+   public:
+    FileSource(std::FILE *file, bool follow, double idle_timeout)
+        : d_file(file), d_follow(follow), d_idle_timeout(idle_timeout) {}
+    ~FileSource() {
+        if (d_file != stdin) std::fclose(d_file);
+    }
+
+   private:
+    std::FILE *d_file;
+    bool d_follow;
+    double d_idle_timeout;
+
+    size_t read_some(char *data, size_t len) override {
+        auto last_data = std::chrono::steady_clock::now();
+
+        while (is_running) {
+            size_t n = std::fread(data, 1, len, d_file);
+            if (n != 0 || !d_follow) return n;
+
+            // Reached the current end of the file, wait for it to grow
+            std::chrono::duration<double> idle = std::chrono::steady_clock::now() - last_data;
+            if (idle.count() > d_idle_timeout) return 0;
+            std::clearerr(d_file);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        return 0;
+    }
+};
+
+/// A TCP connection, this must be used from the thread that created it
+class TcpSource : public StreamSource {
+   public:
+    bool connect(const QString &host, quint16 port) {
+        socket.connectToHost(host, port);
+        return socket.waitForConnected(5000);
+    }
+
+   private:
+    QTcpSocket socket;
+
+    size_t read_some(char *data, size_t len) override {
+        while (socket.bytesAvailable() == 0) {
+            if (!is_running) return 0;
+            if (!socket.waitForReadyRead(100) && socket.state() != QAbstractSocket::ConnectedState) {
+                return 0;
+            }
+        }
+
+        qint64 n = socket.read(data, len);
+        return n > 0 ? n : 0;
+    }
+};
+
+StreamSource *StreamSource::make(const std::string &source, double idle_timeout) {
+    if (source == "-") {
+        return new FileSource(stdin, false, idle_timeout);
+    }
+
+    QUrl url(QString::fromStdString(source));
+    if (url.scheme() == "tcp") {
+        if (url.host().isEmpty() || url.port() == -1) {
+            std::cerr << "TCP sources must be in the form tcp://host:port" << std::endl;
+            return nullptr;
+        }
+
+        TcpSource *tcp = new TcpSource;
+        if (!tcp->connect(url.host(), url.port())) {
+            std::cerr << "Could not connect to " << source << std::endl;
+            delete tcp;
+            return nullptr;
+        }
+        return tcp;
+    }
+
+    std::FILE *file = std::fopen(source.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Could not open " << source << std::endl;
+        return nullptr;
+    }
+    return new FileSource(file, QFileInfo(QString::fromStdString(source)).isFile(), idle_timeout);
+}
+
+StreamSource::int_type StreamSource::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (!is_running) return traits_type::eof();
+
+    size_t n = read_some(d_buffer, sizeof(d_buffer));
+    if (n == 0) return traits_type::eof();
+
+    d_received += n;
+    setg(d_buffer, d_buffer, d_buffer + n);
+    return traits_type::to_int_type(*gptr());
+}
+
+StreamSource::pos_type StreamSource::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::in)) return pos_type(off_type(-1));
+    return pos_type(off_type(d_received - (egptr() - gptr())));
+}
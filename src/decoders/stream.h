@@ -0,0 +1,71 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_DECODERS_STREAM_H_
+#define LEANHRPT_DECODERS_STREAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+/**
+ * A std::streambuf over a live source of data
+ *
+ * Reads block until data is available, end of file is only reported once
+ * the source has actually finished (or `stop()` was called). This lets the
+ * decoders, which read in fixed size chunks, be used unchanged.
+ */
+class StreamSource : public std::streambuf {
+   public:
+    virtual ~StreamSource() = default;
+
+    /**
+     * Open a live source
+     *
+     * - `-` reads from stdin
+     * - `tcp://host:port` connects to a TCP server
+     * - Anything else is a path, regular files are followed as they grow (like
+     *   `tail -f`) until nothing has been written for `idle_timeout` seconds,
+     *   FIFOs are read until the writer closes them
+     *
+     * @return nullptr on failure
+     */
+    static StreamSource *make(const std::string &source, double idle_timeout = 10.0);
+
+    /// Make the stream end at the next read
+    void stop() { is_running = false; }
+    /// Total number of bytes received
+    size_t received() const { return d_received; }
+
+   protected:
+    std::atomic<bool> is_running{true};
+
+    /// Block until data is available, returns 0 at the end of the stream
+    virtual size_t read_some(char *data, size_t len) = 0;
+
+   private:
+    char d_buffer[4096];
+    size_t d_received = 0;
+
+    int_type underflow() override;
+    // Streams can't seek, this only tells how many bytes have been read
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ephemeris.h"
+
+#include <cmath>
+
+const Ephemeris::State &Ephemeris::sample(int64_t i) {
+    auto it = samples.find(i);
+    if (it != samples.end()) {
+        return it->second;
+    }
+
+    struct predict_position orbit = predictor.predict((double)i * step);
+    State state;
+    for (size_t j = 0; j < 3; j++) {
+        state.position[j] = orbit.position[j];
+        state.velocity[j] = orbit.velocity[j];
+    }
+    return samples[i] = state;
+}
+
+struct predict_position Ephemeris::predict(double timestamp) {
+    int64_t i = std::floor(timestamp / step);
+    const State a = sample(i);
+    const State b = sample(i + 1);
+
+    // Cubic Hermite basis functions and their derivatives
+    double s = timestamp / step - (double)i;
+    double s2 = s * s;
+    double s3 = s2 * s;
+    double h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+    double h10 = s3 - 2.0 * s2 + s;
+    double h01 = -2.0 * s3 + 3.0 * s2;
+    double h11 = s3 - s2;
+    double d00 = (6.0 * s2 - 6.0 * s) / step;
+    double d10 = 3.0 * s2 - 4.0 * s + 1.0;
+    double d01 = (-6.0 * s2 + 6.0 * s) / step;
+    double d11 = 3.0 * s2 - 2.0 * s;
+
+    struct predict_position orbit = {};
+    orbit.time = (timestamp / 86400.0) - 3651.0;
+    for (size_t j = 0; j < 3; j++) {
+        orbit.position[j] = h00 * a.position[j] + h10 * step * a.velocity[j] + h01 * b.position[j] + h11 * step * b.velocity[j];
+        orbit.velocity[j] = d00 * a.position[j] + d10 * a.velocity[j] + d01 * b.position[j] + d11 * b.velocity[j];
+    }
+    eci_to_geodetic(timestamp, orbit.position, orbit.latitude, orbit.longitude, orbit.altitude);
+
+    return orbit;
+}
+
+// Greenwich mean sidereal time in radians
+static double gmst(double jd) {
+    double ut = std::fmod(jd + 0.5, 1.0);
+    double tu = (jd - ut - 2451545.0) / 36525.0;
+    double seconds = 24110.54841 + tu * (8640184.812866 + tu * (0.093104 - tu * 6.2e-6));
+    seconds = std::fmod(seconds + 86400.0 * 1.00273790934 * ut, 86400.0);
+    if (seconds < 0.0) seconds += 86400.0;
+    return 2.0 * M_PI * seconds / 86400.0;
+}
+
+// Same method (and constants) as libpredict so results are interchangeable with predict_orbit
+void Ephemeris::eci_to_geodetic(double timestamp, const double position[3], double &latitude, double &longitude,
+                                double &altitude) {
+    const double a = 6378.137;
+    const double f = 3.35281066474748e-3;
+    const double e2 = f * (2.0 - f);
+
+    double jd = timestamp / 86400.0 + 2440587.5;
+    longitude = std::fmod(std::atan2(position[1], position[0]) - gmst(jd), 2.0 * M_PI);
+    if (longitude < 0.0) longitude += 2.0 * M_PI;
+
+    double r = std::sqrt(position[0] * position[0] + position[1] * position[1]);
+    double c = 1.0;
+    latitude = std::atan2(position[2], r);
+    for (size_t i = 0; i < 10; i++) {
+        double phi = latitude;
+        c = 1.0 / std::sqrt(1.0 - e2 * std::sin(phi) * std::sin(phi));
+        latitude = std::atan2(position[2] + a * c * e2 * std::sin(phi), r);
+        if (std::abs(latitude - phi) < 1e-10) break;
+    }
+    altitude = r / std::cos(latitude) - a * c;
+}
+
+std::array<double, 3> Ephemeris::sun_vector(double timestamp) {
+    double jd = timestamp / 86400.0 + 2440587.5;
+    double n = jd - 2451545.0;
+
+    // Ecliptic longitude of the sun and the obliquity of the ecliptic
+    double mean_longitude = (280.460 + 0.9856474 * n) * M_PI / 180.0;
+    double anomaly = (357.528 + 0.9856003 * n) * M_PI / 180.0;
+    double longitude = mean_longitude + (1.915 * std::sin(anomaly) + 0.020 * std::sin(2.0 * anomaly)) * M_PI / 180.0;
+    double obliquity = (23.439 - 0.0000004 * n) * M_PI / 180.0;
+
+    double right_ascension = std::atan2(std::cos(obliquity) * std::sin(longitude), std::cos(longitude));
+    double declination = std::asin(std::sin(obliquity) * std::sin(longitude));
+
+    // Rotate into the earth fixed frame
+    double hour_angle = right_ascension - gmst(jd);
+    return {std::cos(declination) * std::cos(hour_angle), std::cos(declination) * std::sin(hour_angle), std::sin(declination)};
+}
@@ -0,0 +1,81 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_EPHEMERIS_H_
+#define LEANHRPT_EPHEMERIS_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "orbit.h"
+
+/**
+ * A cache of orbit predictions for a single satellite
+ *
+ * The orbit is propagated (with SGP4/SDP4) at fixed steps, positions and
+ * velocities in between are then interpolated with cubic Hermite splines in
+ * the inertial frame. Samples are created on demand, so only the parts of the
+ * orbit that are actually used are ever propagated. With the default step of
+ * 1 second the interpolation error is in the order of millimetres, below the
+ * ~0.3 metres that libpredict's own time resolution (~40us) already causes.
+ *
+ * Not thread safe.
+ */
+class Ephemeris {
+   public:
+    Ephemeris(std::pair<std::string, std::string> tle, double step = 1.0) : predictor(tle), step(step) {}
+
+    /**
+     * Gets the interpolated position of the satellite at the specified timestamp
+     *
+     * Only the time, position, velocity, latitude, longitude and altitude are set.
+     *
+     * @param timestamp UNIX timestamp
+     */
+    struct predict_position predict(double timestamp);
+
+    /// Gets orbital information directly from SGP4/SDP4, bypassing the cache
+    struct predict_position predict_exact(double timestamp) { return predictor.predict(timestamp); }
+
+    /// Convert an inertial (TEME) position in km into latitude, longitude (radians) and altitude (km)
+    static void eci_to_geodetic(double timestamp, const double position[3], double &latitude, double &longitude,
+                                double &altitude);
+
+    /**
+     * Unit vector pointing at the sun in earth fixed coordinates
+     *
+     * Uses the low precision formulas from the Astronomical Almanac, which are
+     * accurate to ~0.01 degrees between 1950 and 2050.
+     */
+    static std::array<double, 3> sun_vector(double timestamp);
+
+   private:
+    struct State {
+        std::array<double, 3> position;
+        std::array<double, 3> velocity;
+    };
+    const State &sample(int64_t i);
+
+    OrbitPredictor predictor;
+    double step;
+    std::unordered_map<int64_t, State> samples;
+};
+
+#endif
@@ -10,12 +10,15 @@
 #include "protocol/deframer.h"
 #include "protocol/repack.h"
 #include "protocol/reverse.h"
+#include "stats.h"
 
 const std::map<std::string, FileType> known_extensions = {
     {"cadu", FileType::CADU}, {"vcdu", FileType::VCDU}, {"raw16", FileType::raw16},
     {"hrp", FileType::HRP},   {"tip", FileType::TIP},
 };
 
+static stats::Stage fingerprint_stage("fingerprint");
+
 /// Finds the most common value of T
 template <typename T>
 class Scoreboard {
@@ -39,6 +42,7 @@ class Scoreboard {
 };
 
 std::tuple<SatID, FileType, Protocol> Fingerprint::file(std::string filename, Suggestion suggestion) {
+    stats::Timer timer(fingerprint_stage);
     std::filebuf file;
     if (!file.open(filename, std::ios::in | std::ios::binary) && QFileInfo(QString::fromStdString(filename)).size() != 0) {
         return {SatID::Unknown, FileType::Unknown, Protocol::Unknown};
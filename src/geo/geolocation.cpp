@@ -44,8 +44,10 @@
 
 #include "geolocation.h"
 
+#include <algorithm>
 #include <limits>
 #include <stdexcept>
+#include <vector>
 
 #include "util.h"
 
@@ -146,6 +148,72 @@ Geodetic los_to_earth(const Vector &position, double roll, double pitch, double
     return vectorToLocation(Vector(x, y, z));
 }
 
+void los_to_earth(const Geodetic &position, const double *roll, const double *pitch, double yaw, size_t n, double *latitude,
+                  double *longitude) {
+    const double a = 6371.0087714;
+    const double c = 6356.752314245;
+    const double a2 = a * a;
+    const double c2 = c * c;
+
+    Vector3 p = locationToVector(position);
+
+    // Everything except the roll and pitch is the same for every point
+    Matrix4x4 base = lookAt(p, Vector(0, 0, 0), Vector(0, 0, 1)) * Matrix4x4::CreateRotationZ(yaw);
+    const std::array<double, 16> &m = base.mElements;
+
+    // Dot products with the satellite position, the same for every ray
+    double pp = (p.x * p.x + p.y * p.y) / a2 + p.z * p.z / c2 - 1.0;
+
+    std::vector<double> u(n), v(n), w(n);
+    for (size_t i = 0; i < n; i++) {
+        // Third column of RotationY(pitch) * RotationX(roll)
+        double lx = -std::sin(pitch[i]) * std::cos(roll[i]);
+        double ly = std::sin(roll[i]);
+        double lz = std::cos(pitch[i]) * std::cos(roll[i]);
+
+        u[i] = m[0] * lx + m[1] * ly + m[2] * lz;
+        v[i] = m[4] * lx + m[5] * ly + m[6] * lz;
+        w[i] = m[8] * lx + m[9] * ly + m[10] * lz;
+    }
+
+    // Intersect every ray with the ellipsoid, u/v/w are replaced with the intersection
+    for (size_t i = 0; i < n; i++) {
+        double qa = (u[i] * u[i] + v[i] * v[i]) / a2 + w[i] * w[i] / c2;
+        double qb = (p.x * u[i] + p.y * v[i]) / a2 + p.z * w[i] / c2;
+        double discriminant = qb * qb - qa * pp;
+        double d = (-qb - std::sqrt(std::max(discriminant, 0.0))) / qa;
+        bool hit = discriminant >= 0.0 && d >= 0.0;
+
+        u[i] = hit ? p.x + d * u[i] : 0.0;
+        v[i] = hit ? p.y + d * v[i] : 0.0;
+        w[i] = hit ? p.z + d * w[i] : 0.0;
+    }
+
+    // Same as vectorToLocation() but without any redundant trigonometry
+    const double wa = 6378.137;
+    const double wf = 1.0 / 298.257223563;
+    const double wb = wa * (1.0 - wf);
+    const double e2 = (wa * wa - wb * wb) / (wa * wa);
+    const double ep2 = (wa * wa - wb * wb) / (wb * wb);
+    for (size_t i = 0; i < n; i++) {
+        if (u[i] == 0.0 && v[i] == 0.0 && w[i] == 0.0) {
+            latitude[i] = 0.0;
+            longitude[i] = 0.0;
+            continue;
+        }
+
+        double r = std::sqrt(u[i] * u[i] + v[i] * v[i]);
+        double t = w[i] * wa;
+        double q = r * wb;
+        double h = std::sqrt(t * t + q * q);
+        double sin_phi = t / h;
+        double cos_phi = q / h;
+
+        latitude[i] = std::atan2(w[i] + ep2 * wb * sin_phi * sin_phi * sin_phi, r - e2 * wa * cos_phi * cos_phi * cos_phi);
+        longitude[i] = std::atan2(v[i], u[i]);
+    }
+}
+
 GeodeticCurve CalculateGeodeticCurve(Ellipsoid ellipsoid, Geodetic start, Geodetic end, double tolerance) {
     //
     // All equation numbers refer back to Vincenty's publication:
@@ -19,6 +19,8 @@
 #ifndef LEANHRPT_GEO_GEOLOCATION_H_
 #define LEANHRPT_GEO_GEOLOCATION_H_
 
+#include <cstddef>
+
 #include "geodetic.h"
 #include "matrix.h"
 #include "vector.h"
@@ -62,6 +64,16 @@ Vector locationToVector(const Geodetic &location);
 Geodetic vectorToLocation(const Vector &vector);
 Geodetic los_to_earth(const Geodetic &position, double roll, double pitch, double yaw);
 Geodetic los_to_earth(const Vector &position, double roll, double pitch, double yaw);
+/**
+ * Batch version of `los_to_earth()` for many look angles from the same position and yaw
+ *
+ * The rotation is only built once and the intersections are calculated in
+ * simple loops over arrays that the compiler can vectorize. Points that miss
+ * the earth are (0, 0) like `los_to_earth()`. `roll`, `pitch`, `latitude`
+ * and `longitude` must all have `n` elements, angles are in radians.
+ */
+void los_to_earth(const Geodetic &position, const double *roll, const double *pitch, double yaw, size_t n, double *latitude,
+                  double *longitude);
 double calculateBearingAngle(const Geodetic &start, const Geodetic &end);
 Matrix4x4 lookAt(const Vector3 &position, const Vector3 &target, const Vector3 &up);
 
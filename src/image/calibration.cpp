@@ -20,14 +20,20 @@
 
 #include <QLocale>
 
+#include "stats.h"
 #include "util.h"
 
+static stats::Stage calibrate_stage("calibrate");
+
 static double str2double(std::string str) {
     QLocale l(QLocale::C);
     return l.toDouble(QString::fromStdString(str));
 }
 
 void Calibrator::calibrate(SatID id, Imager imager, std::vector<QImage> &channels) {
+    stats::Timer timer(calibrate_stage);
+    for (const QImage &channel : channels) timer.bytes(channel.sizeInBytes());
+
     // MSU-MR Calibration
 #if 0
     if (imager == Imager::MSUMR && d_caldata.count("wl1_sum")) {
@@ -45,9 +51,9 @@ void Calibrator::calibrate(SatID id, Imager imager, std::vector<QImage> &channel
 
     for (size_t i = 0; i < channels.size(); i++) {
         std::string name = satellite_info.at(id).name + "_" + sensor_info.at(imager).name + "/" + std::to_string(i + 1);
-        if (!config.sections.count(name)) continue;
+        if (!config->sections.count(name)) continue;
 
-        std::map<std::string, std::string> coefficients = config.sections.at(name);
+        std::map<std::string, std::string> coefficients = config->sections.at(name);
         std::string type = "linear";
         if (coefficients.count("type")) {
             type = coefficients.at("type");
@@ -27,11 +27,11 @@
 class Calibrator {
    public:
     Calibrator(std::map<std::string, double> caldata, std::vector<bool> ch3a = {})
-        : config("calibration.ini"), d_caldata(caldata), d_ch3a(ch3a){};
+        : config(Config::cached("calibration.ini")), d_caldata(caldata), d_ch3a(ch3a){};
     void calibrate(SatID id, Imager imager, std::vector<QImage> &channel);
 
    private:
-    Config config;
+    std::shared_ptr<const Config> config;
     std::map<std::string, double> d_caldata;
     std::vector<bool> d_ch3a;
 
@@ -31,10 +31,31 @@
 #include "calibration.h"
 #include "config/config.h"
 #include "geometry.h"
+#include "stats.h"
 #include "util.h"
 
+static stats::Stage import_stage("import");
+static stats::Stage composite_stage("composite");
+static stats::Stage equalise_stage("equalise");
+
+// Count every non-zero value of a Grayscale16 image
+static void add_to_histogram(std::vector<size_t> &histogram, const QImage &image) {
+    for (size_t y = 0; y < (size_t)image.height(); y++) {
+        const quint16 *line = reinterpret_cast<const quint16 *>(image.constScanLine(y));
+
+        for (size_t x = 0; x < (size_t)image.width(); x++) {
+            if (line[x] != 0) histogram[line[x]]++;
+        }
+    }
+}
+
+static void release_storage(void *info) { delete static_cast<std::shared_ptr<std::vector<uint16_t>> *>(info); }
+
 void ImageCompositor::import(RawImage *image, SatID satellite, Imager sensor, std::map<std::string, double> caldata,
                              double reverse) {
+    stats::Timer timer(import_stage);
+    timer.bytes(image->width() * image->rows() * image->channels() * sizeof(uint16_t));
+
     m_width = image->width();
     m_height = image->rows();
     m_channels = image->channels();
@@ -52,15 +73,49 @@ void ImageCompositor::import(RawImage *image, SatID satellite, Imager sensor, st
         }
     }
 
+    process_import(reverse);
+}
+
+bool ImageCompositor::import(const L1aArchive &archive, Imager sensor, double reverse) {
+    if (!archive.has_imager(sensor)) return false;
+    stats::Timer timer(import_stage);
+    timer.bytes(archive.width(sensor) * archive.rows(sensor) * archive.channels(sensor) * sizeof(uint16_t));
+    m_width = archive.width(sensor);
+    m_height = archive.rows(sensor);
+    m_channels = archive.channels(sensor);
+    m_satellite = archive.satellite();
+    m_sensor = sensor;
+    m_isFlipped = false;
+    d_caldata = archive.metadata().caldata;
+
+    // Decompressed straight into the channels
+    rawChannels.clear();
+    rawChannels.resize(m_channels);
+    for (size_t i = 0; i < m_channels; i++) {
+        rawChannels[i] = QImage(m_width, m_height, QImage::Format_Grayscale16);
+        if (m_height != 0 && !archive.read(sensor, i, 0, m_height, (uint16_t *)rawChannels[i].bits(),
+                                           rawChannels[i].bytesPerLine() / sizeof(uint16_t))) {
+            rawChannels.clear();
+            pyramids.clear();
+            m_width = m_height = m_channels = 0;
+            return false;
+        }
+    }
+
+    process_import(reverse);
+    return true;
+}
+
+void ImageCompositor::process_import(bool reverse) {
     if (m_sensor == Imager::MSUMR) {
         rawChannels[3].invertPixels();
         rawChannels[4].invertPixels();
         rawChannels[5].invertPixels();
     }
 
-    Calibrator(d_caldata, ch3a).calibrate(satellite, sensor, rawChannels);
+    Calibrator(d_caldata, ch3a).calibrate(m_satellite, m_sensor, rawChannels);
 
-    if (sensor == Imager::MHS || sensor == Imager::HIRS || sensor == Imager::AMSUA) {
+    if (m_sensor == Imager::MHS || m_sensor == Imager::HIRS || m_sensor == Imager::AMSUA) {
         for (size_t i = 0; i < m_channels; i++) {
             rawChannels[i] = rawChannels[i].mirrored(true, false);
         }
@@ -70,19 +125,117 @@ void ImageCompositor::import(RawImage *image, SatID satellite, Imager sensor, st
             rawChannels[i] = rawChannels[i].mirrored(false, true);
         }
     }
+
+    pyramids.clear();
+    for (size_t i = 0; i < m_channels; i++) {
+        pyramids.push_back(ImagePyramid(rawChannels[i]));
+    }
+
+    histograms.assign(m_channels, std::vector<size_t>(UINT16_MAX + 1));
+#pragma omp parallel for
+    for (size_t i = 0; i < m_channels; i++) {
+        add_to_histogram(histograms[i], rawChannels[i]);
+    }
+
+    d_storage.clear();
+    d_capacity = 0;
+}
+
+size_t ImageCompositor::append(RawImage *image, SatID satellite, Imager sensor, std::map<std::string, double> caldata) {
+    stats::Timer timer(import_stage);
+    if (d_storage.empty()) {
+        m_width = image->width();
+        m_height = 0;
+        m_channels = image->channels();
+        m_satellite = satellite;
+        m_sensor = sensor;
+        m_isFlipped = false;
+
+        // Keep rows 32-bit aligned, as QImage requires
+        d_stride = (m_width + 1) & ~(size_t)1;
+        d_capacity = 0;
+        d_storage.resize(m_channels);
+        rawChannels.assign(m_channels, QImage());
+        histograms.assign(m_channels, std::vector<size_t>(UINT16_MAX + 1));
+        pyramids.clear();
+    }
+    d_caldata = caldata;
+
+    size_t rows = image->rows();
+    if (rows <= m_height) return 0;
+    size_t start = m_height;
+    size_t n = rows - start;
+    timer.bytes(n * m_width * m_channels * sizeof(uint16_t));
+
+    // Grow geometrically to keep appending O(n) overall, anything still viewing the old memory keeps it alive
+    if (rows > d_capacity) {
+        d_capacity = std::max(rows, std::max(d_capacity * 2, (size_t)1024));
+        for (auto &storage : d_storage) {
+            auto grown = std::make_shared<std::vector<uint16_t>>(d_capacity * d_stride);
+            if (storage) std::memcpy(grown->data(), storage->data(), start * d_stride * sizeof(uint16_t));
+            storage = grown;
+        }
+    }
+
+    // Copy and process only the new band
+    std::vector<QImage> band(m_channels);
+    for (size_t i = 0; i < m_channels; i++) {
+        uint16_t *data = &(*d_storage[i])[start * d_stride];
+        for (size_t y = 0; y < n; y++) {
+            std::memcpy(&data[y * d_stride], &image->getChannel(i)[(start + y) * m_width], m_width * sizeof(uint16_t));
+        }
+        band[i] = QImage(reinterpret_cast<uchar *>(data), m_width, n, d_stride * sizeof(uint16_t), QImage::Format_Grayscale16);
+    }
+
+    if (m_sensor == Imager::MSUMR) {
+        band[3].invertPixels();
+        band[4].invertPixels();
+        band[5].invertPixels();
+    }
+
+    std::vector<bool> band_ch3a;
+    if (ch3a.size() >= rows) {
+        band_ch3a.assign(ch3a.begin() + start, ch3a.begin() + rows);
+    }
+    Calibrator(d_caldata, band_ch3a).calibrate(satellite, sensor, band);
+
+    if (sensor == Imager::MHS || sensor == Imager::HIRS || sensor == Imager::AMSUA) {
+        for (size_t i = 0; i < m_channels; i++) {
+            for (size_t y = 0; y < n; y++) {
+                quint16 *line = reinterpret_cast<quint16 *>(band[i].scanLine(y));
+                std::reverse(line, line + m_width);
+            }
+        }
+    }
+
+#pragma omp parallel for
+    for (size_t i = 0; i < m_channels; i++) {
+        add_to_histogram(histograms[i], band[i]);
+    }
+
+    m_height = rows;
+    for (size_t i = 0; i < m_channels; i++) {
+        rawChannels[i] = QImage(reinterpret_cast<uchar *>(d_storage[i]->data()), m_width, m_height, d_stride * sizeof(uint16_t),
+                                QImage::Format_Grayscale16, release_storage,
+                                new std::shared_ptr<std::vector<uint16_t>>(d_storage[i]));
+    }
+
+    return n;
 }
 
-void ImageCompositor::postprocess(QImage &image, bool correct) {
+void ImageCompositor::postprocess(QImage &image, bool correct, size_t level) {
+    level = std::min(level, levels() - 1);
+
     if (image.format() == QImage::Format_Grayscale16 && stops.size() > 1) {
         QImage copy(image);
         image = QImage(image.width(), image.height(), QImage::Format_RGBX64);
 
-        for (size_t i = 0; i < m_height; i++) {
-            uint16_t *bits = (uint16_t *)copy.scanLine(i);
+        for (size_t i = 0; i < (size_t)image.height(); i++) {
+            const uint16_t *bits = (const uint16_t *)copy.constScanLine(i);
             QRgba64 *color_bits = (QRgba64 *)image.scanLine(i);
 
 #pragma omp parallel for
-            for (size_t j = 0; j < m_width; j++) {
+            for (size_t j = 0; j < (size_t)image.width(); j++) {
                 double x = (double)bits[j] / (double)UINT16_MAX * (stops.size() - 1);
 
                 QColor color = lerp(stops[floor(x)], stops[ceil(x)], fmod(x, 1.0));
@@ -91,18 +244,21 @@ void ImageCompositor::postprocess(QImage &image, bool correct) {
         }
     }
 
-    if (ir_blend) {
-        QImage copy(m_sensor == Imager::MSUMR ? rawChannels[4] : rawChannels[3]);
+    if (cancelled()) return;
+
+    if (ir_blend && has_sunz()) {
+        QImage copy(channel(m_sensor == Imager::MSUMR ? 4 : 3, level));
         equalise(copy, Equalization::Histogram, 0.7f, false);
 
-        for (size_t i = 0; i < m_height; i++) {
+        for (size_t i = 0; i < (size_t)image.height(); i++) {
             uint16_t *ir = (uint16_t *)copy.scanLine(i);
             std::tuple<QRgba64 *, quint16 *> bits =
                 std::make_tuple(reinterpret_cast<QRgba64 *>(image.scanLine(i)), reinterpret_cast<quint16 *>(image.scanLine(i)));
+            SunzBuffer::Row sunz_row = sunz->row(i << level);
 
 #pragma omp parallel for
-            for (size_t j = 0; j < m_width; j++) {
-                float _sunz = sunz[i * m_width + j];
+            for (size_t j = 0; j < (size_t)image.width(); j++) {
+                float _sunz = sunz_row[j << level];
                 float x = clamp(_sunz * 10.0f - 14.8f, 0.0f, 1.0f);
 
                 if (image.format() == QImage::Format_RGBX64) {
@@ -115,9 +271,12 @@ void ImageCompositor::postprocess(QImage &image, bool correct) {
     }
 
     if (correct) {
-        image = correct_geometry(image, m_satellite, m_sensor, m_width);
+        image = correct_geometry(image, m_satellite, m_sensor, width(level));
     }
 
+    // Overlays are stored in full resolution pixel coordinates
+    double scale = 1.0 / (double)(1 << level);
+
     if (enable_map) {
         auto _overlay = overlay;
         if (correct) {
@@ -126,6 +285,7 @@ void ImageCompositor::postprocess(QImage &image, bool correct) {
 
         image = image.convertToFormat(QImage::Format_RGBX64);
         QPainter painter(&image);
+        painter.scale(scale, scale);
         painter.setPen(map_color);
         painter.setRenderHint(QPainter::Antialiasing);
         painter.drawLines(_overlay.data(), _overlay.size());
@@ -158,7 +318,7 @@ void ImageCompositor::postprocess(QImage &image, bool correct) {
         painter.setFont(font);
 
         for (const Landmark &landmark : _landmarks) {
-            QPointF point = landmark.geo;
+            QPointF point = landmark.geo * scale;
             if (m_isFlipped) {
                 point.rx() = image.width() - point.x();
                 point.ry() = image.height() - point.y();
@@ -168,27 +328,43 @@ void ImageCompositor::postprocess(QImage &image, bool correct) {
     }
 }
 
-void ImageCompositor::getChannel(QImage &image, size_t channel) { image = rawChannels[channel - 1]; }
+void ImageCompositor::getChannel(QImage &image, size_t ch, size_t level) {
+    stats::Timer timer(composite_stage);
+    image = channel(ch - 1, std::min(level, levels() - 1));
+    timer.bytes(image.sizeInBytes());
+}
 
-void ImageCompositor::getComposite(QImage &image, std::array<size_t, 3> chs) {
-    if (image.format() != QImage::Format_RGBX64) {
-        image = QImage(image.width(), image.height(), QImage::Format_RGBX64);
+void ImageCompositor::getComposite(QImage &image, std::array<size_t, 3> chs, size_t level) {
+    stats::Timer timer(composite_stage);
+    level = std::min(level, levels() - 1);
+    const QImage &red = channel(chs[0] - 1, level);
+    const QImage &green = channel(chs[1] - 1, level);
+    const QImage &blue = channel(chs[2] - 1, level);
+
+    if (image.format() != QImage::Format_RGBX64 || image.size() != red.size()) {
+        image = QImage(red.size(), QImage::Format_RGBX64);
     }
+    timer.bytes(image.sizeInBytes());
 
-    for (size_t i = 0; i < m_height; i++) {
+    for (size_t i = 0; i < (size_t)image.height(); i++) {
         QRgba64 *line = (QRgba64 *)image.scanLine(i);
-        const uint16_t *r = (const uint16_t *)rawChannels[chs[0] - 1].constScanLine(i);
-        const uint16_t *g = (const uint16_t *)rawChannels[chs[1] - 1].constScanLine(i);
-        const uint16_t *b = (const uint16_t *)rawChannels[chs[2] - 1].constScanLine(i);
+        const uint16_t *r = (const uint16_t *)red.constScanLine(i);
+        const uint16_t *g = (const uint16_t *)green.constScanLine(i);
+        const uint16_t *b = (const uint16_t *)blue.constScanLine(i);
 
 #pragma omp parallel for
-        for (size_t x = 0; x < m_width; x++) {
+        for (size_t x = 0; x < (size_t)image.width(); x++) {
             line[x] = QRgba64::fromRgba64(r[x], g[x], b[x], UINT16_MAX);
         }
     }
 }
 
-void ImageCompositor::getExpression(QImage &image, std::string expression) {
+void ImageCompositor::getExpression(QImage &image, std::string expression, size_t level) {
+    stats::Timer timer(composite_stage);
+    level = std::min(level, levels() - 1);
+    size_t width = this->width(level);
+    size_t height = this->height(level);
+
     std::vector<double> ch(m_channels);
     double sunz_val = 0.0;
     double scan = 0.0;
@@ -210,29 +386,38 @@ void ImageCompositor::getExpression(QImage &image, std::string expression) {
     int channels;
     p.Eval(channels);
     QImage::Format format = channels == 1 ? QImage::Format_Grayscale16 : QImage::Format_RGBX64;
-    if (image.format() != format) {
-        image = QImage(image.width(), image.height(), format);
+    if (image.format() != format || image.size() != QSize(width, height)) {
+        image = QImage(width, height, format);
     }
+    timer.bytes(image.sizeInBytes());
 
     try {
-        for (size_t y = 0; y < m_height; y++) {
-            std::vector<quint16 *> rawbits(m_channels);
+        // Only touch the (lazily calculated) solar zenith angles if they are actually needed
+        bool have_sunz = has_sunz() && p.GetUsedVar().count("sunz");
+
+        for (size_t y = 0; y < height; y++) {
+            if (cancelled()) return;
+
+            std::vector<const quint16 *> rawbits(m_channels);
             for (size_t i = 0; i < m_channels; i++) {
-                rawbits[i] = (quint16 *)rawChannels[i].scanLine(y);
+                rawbits[i] = (const quint16 *)channel(i, level).constScanLine(y);
             }
             std::tuple<QRgba64 *, quint16 *> bits =
                 std::make_tuple(reinterpret_cast<QRgba64 *>(image.scanLine(y)), reinterpret_cast<quint16 *>(image.scanLine(y)));
+            bool is_ch3a = ch3a.size() != 0 && ch3a[std::min(y << level, ch3a.size() - 1)];
+            SunzBuffer::Row sunz_row;
+            if (have_sunz) sunz_row = sunz->row(y << level);
 
-            for (size_t x = 0; x < m_width; x++) {
-                scan = (double)x / (double)m_width;
+            for (size_t x = 0; x < width; x++) {
+                scan = (double)x / (double)width;
                 for (size_t i = 0; i < m_channels; i++) {
                     ch[i] = (double)rawbits[i][x] / (double)UINT16_MAX;
                 }
-                if (sunz.size() != 0) sunz_val = sunz[y * m_width + x];
+                if (have_sunz) sunz_val = sunz_row[x << level];
 
                 mwir = swir = 0.0;
                 if (m_sensor == Imager::AVHRR) {
-                    if (ch3a[y]) {
+                    if (is_ch3a) {
                         swir = ch[2];
                     } else {
                         mwir = ch[2];
@@ -386,7 +571,34 @@ void ImageCompositor::clip_histogram(std::vector<size_t> &histogram, float clip_
     }
 }
 
+void ImageCompositor::equalise(QImage &image, Equalization equalization, float clipLimit, bool brightness_only,
+                               std::vector<size_t> channels) {
+    if (image.format() == QImage::Format_Grayscale16 && channels.size() == 1) {
+        stats::Timer timer(equalise_stage);
+        timer.bytes(image.sizeInBytes());
+        std::vector<size_t> histogram = histograms[channels[0] - 1];
+        clip_histogram(histogram, clipLimit);
+        _equalise<uint16_t, 1, 0>(image, equalization, histogram);
+    } else if (image.format() == QImage::Format_RGBX64 && channels.size() == 3 && !brightness_only) {
+        stats::Timer timer(equalise_stage);
+        timer.bytes(image.sizeInBytes());
+        std::array<std::vector<size_t>, 3> rgb;
+        for (size_t i = 0; i < 3; i++) {
+            rgb[i] = histograms[channels[i] - 1];
+            clip_histogram(rgb[i], clipLimit);
+        }
+        _equalise<uint16_t, 4, 0>(image, equalization, rgb[0]);
+        _equalise<uint16_t, 4, 1>(image, equalization, rgb[1]);
+        _equalise<uint16_t, 4, 2>(image, equalization, rgb[2]);
+    } else {
+        // Brightness only histograms skip pixels where any channel is 0, which needs the composited image
+        equalise(image, equalization, clipLimit, brightness_only);
+    }
+}
+
 void ImageCompositor::equalise(QImage &image, Equalization equalization, float clipLimit, bool brightness_only) {
+    stats::Timer timer(equalise_stage);
+    timer.bytes(image.sizeInBytes());
     switch (image.format()) {
         case QImage::Format_RGBX64:
             if (brightness_only) {
@@ -23,9 +23,14 @@
 #include <QPainter>
 #include <array>
 #include <cmath>
+#include <functional>
+#include <memory>
 #include <vector>
 
+#include "archive.h"
+#include "image/pyramid.h"
 #include "image/raw.h"
+#include "image/sunz.h"
 #include "map.h"
 #include "satinfo.h"
 #include "util.h"
@@ -44,15 +49,38 @@ class ImageCompositor {
      * @param reverse Flips the image vertically, used for reverse transmissions
      */
     void import(RawImage *image, SatID satellite, Imager sensor, std::map<std::string, double> caldata, double reverse = false);
+    /**
+     * Loads an imager from an L1a archive, the same as importing the data it was made from
+     *
+     * @return If the imager is in the archive and could be read
+     */
+    bool import(const L1aArchive &archive, Imager sensor, double reverse = false);
+    /**
+     * Loads the rows of a RawImage that haven't been loaded yet, for live decoding
+     *
+     * Only the new rows are calibrated and processed, the first call (or the
+     * first call after `import()`) loads everything. Rows are calibrated with
+     * the calibration data available at the time they are appended. Unlike
+     * `import()` there is no support for reversed transmissions, and the image
+     * pyramid isn't maintained (only level 0 is available).
+     *
+     * @return The number of new rows
+     */
+    size_t append(RawImage *image, SatID satellite, Imager sensor, std::map<std::string, double> caldata);
+
+    /*
+     * All of the functions below take an optional pyramid level, 0 is full
+     * resolution and every level above that halves the size of the output.
+     */
 
     /// Get a channel and write the result into `image`
-    void getChannel(QImage &image, size_t channel);
+    void getChannel(QImage &image, size_t channel, size_t level = 0);
     /// Create a composite and write the result into `image`
-    void getComposite(QImage &image, std::array<size_t, 3> chs);
+    void getComposite(QImage &image, std::array<size_t, 3> chs, size_t level = 0);
     /// @copydoc getComposite
     void getComposite(QImage &image, size_t r, size_t g, size_t b) { getComposite(image, {r, g, b}); }
     /// Evaluate an expression and write the result into `image`
-    void getExpression(QImage &image, std::string expression);
+    void getExpression(QImage &image, std::string expression, size_t level = 0);
 
     /**
      * Adds overlays and final effects to an image
@@ -63,7 +91,7 @@ class ImageCompositor {
      * - Flipping
      * - IR Blend
      */
-    void postprocess(QImage &image, bool correct = false);
+    void postprocess(QImage &image, bool correct = false, size_t level = 0);
     /**
      * Equalises an image
      *
@@ -73,11 +101,24 @@ class ImageCompositor {
      * @param brightness_only Only change the brightness of the image
      */
     static void equalise(QImage &image, Equalization equalization, float clipLimit, bool brightness_only);
+    /**
+     * Equalises a channel or composite using the histograms of the channels it was made from
+     *
+     * The histograms are kept up to date by `import()` and `append()`, so unlike
+     * the static version nothing has to be recalculated from the image. Brightness
+     * only composites (and anything else) fall back to the static version.
+     *
+     * @param channels The channels `image` was created from (1 for a channel, 3 for a composite)
+     */
+    void equalise(QImage &image, Equalization equalization, float clipLimit, bool brightness_only,
+                  std::vector<size_t> channels);
 
     /// Gets the width of currently loaded image
-    size_t width() { return m_width; };
+    size_t width(size_t level = 0) { return level == 0 ? m_width : channel(0, level).width(); };
     /// Gets the height of currently loaded image
-    size_t height() { return m_height; };
+    size_t height(size_t level = 0) { return level == 0 ? m_height : channel(0, level).height(); };
+    /// Gets the number of pyramid levels of the currently loaded image
+    size_t levels() { return pyramids.empty() ? 1 : pyramids[0].levels(); }
     /// Gets the number of channels in the currently loaded image
     size_t channels() { return m_channels; };
     /// If the image is currently flipped
@@ -92,10 +133,21 @@ class ImageCompositor {
      */
     void enableIRBlend(bool enable) { ir_blend = enable; }
 
+    /**
+     * Set a function that is polled during long running operations, once it
+     * returns true the operation is abandoned and its output is undefined
+     */
+    void setCancellation(std::function<bool()> cancelled) { d_cancelled = cancelled; }
+    /// If the current operation should be abandoned
+    bool cancelled() { return d_cancelled && d_cancelled(); }
+
     std::vector<QLineF> overlay;
     bool enable_map = false;
     QColor map_color;
-    std::vector<float> sunz;
+    // Shared so that copies of a compositor (e.g. for background rendering) stay cheap
+    std::shared_ptr<const SunzBuffer> sunz;
+    /// If solar zenith angles are available
+    bool has_sunz() { return sunz && !sunz->empty(); }
     std::vector<QColor> stops;
     std::vector<bool> ch3a;
     bool has_ch3a = false;
@@ -105,15 +157,27 @@ class ImageCompositor {
     std::vector<Landmark> landmarks;
 
    private:
-    size_t m_width;
-    size_t m_height;
-    size_t m_channels;
+    size_t m_width = 0;
+    size_t m_height = 0;
+    size_t m_channels = 0;
     SatID m_satellite;
     Imager m_sensor;
     bool m_isFlipped;
     std::vector<QImage> rawChannels;
+    std::vector<ImagePyramid> pyramids;
+    std::vector<std::vector<size_t>> histograms;
+
+    // Backing memory for `append()`, rawChannels hold a reference to it so it can be reallocated safely
+    std::vector<std::shared_ptr<std::vector<uint16_t>>> d_storage;
+    size_t d_capacity = 0;
+    size_t d_stride = 0;
     std::map<std::string, double> d_caldata;
     bool ir_blend = false;
+    std::function<bool()> d_cancelled;
+
+    // Calibration and everything else `import()` does once the raw channels are loaded
+    void process_import(bool reverse);
+    const QImage &channel(size_t i, size_t level) { return level == 0 ? rawChannels[i] : pyramids[i].level(level); }
 
     template <typename T, size_t A, size_t B>
     static std::vector<size_t> create_histogram(QImage &image, float clip_limit = 1.0f);
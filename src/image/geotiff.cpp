@@ -0,0 +1,430 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "geotiff.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <type_traits>
+
+#include "stats.h"
+#include "util.h"
+
+static stats::Stage encode_stage("encode");
+
+// Size of tiles, overviews are generated until the image fits in a single tile
+#define TILE_SIZE 256
+// Radius of the sphere used by the Mercator and polar projections (the same as EPSG:3857)
+#define SPHERE_RADIUS 6378137.0
+
+// TIFF field types
+#define TYPE_ASCII 2
+#define TYPE_SHORT 3
+#define TYPE_LONG 4
+#define TYPE_DOUBLE 12
+#define TYPE_LONG8 16
+
+static void put_le(std::vector<uint8_t> &out, uint64_t x, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out.push_back(x >> (i * 8));
+    }
+}
+
+template <typename T>
+static std::vector<uint8_t> to_le(const std::vector<T> &values) {
+    std::vector<uint8_t> out;
+    for (T value : values) {
+        if (std::is_same<T, double>::value) {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            put_le(out, bits, 8);
+        } else {
+            put_le(out, (uint64_t)value, sizeof(T));
+        }
+    }
+    return out;
+}
+
+static size_t type_size(uint16_t type) {
+    switch (type) {
+        case TYPE_SHORT:
+            return 2;
+        case TYPE_LONG:
+            return 4;
+        case TYPE_DOUBLE:
+        case TYPE_LONG8:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+// Downsample two rows into one, colors are weighted by alpha so transparent pixels don't bleed in
+static void downsample(const uint16_t *a, const uint16_t *b, int width, uint16_t *out) {
+    for (int x = 0; x < (width + 1) / 2; x++) {
+        int x1 = std::min(x * 2 + 1, width - 1);
+        const uint16_t *pixels[4] = {&a[x * 2 * 4], &a[x1 * 4], &b[x * 2 * 4], &b[x1 * 4]};
+
+        uint64_t alpha = 0;
+        uint64_t sums[3] = {0, 0, 0};
+        for (const uint16_t *pixel : pixels) {
+            alpha += pixel[3];
+            for (size_t i = 0; i < 3; i++) {
+                sums[i] += (uint64_t)pixel[i] * pixel[3];
+            }
+        }
+
+        for (size_t i = 0; i < 3; i++) {
+            out[x * 4 + i] = alpha == 0 ? 0 : (sums[i] + alpha / 2) / alpha;
+        }
+        out[x * 4 + 3] = (alpha + 2) / 4;
+    }
+}
+
+GeoTiffWriter::GeoTiffWriter(const std::string &filename, QSize size, transform::CRS crs, QRectF bounds, int depth)
+    : m_file(QString::fromStdString(filename)), m_size(size), m_crs(crs), m_bounds(bounds), m_depth(depth == 8 ? 8 : 16) {
+    // Leave some room for overviews (which add up to a third of the image)
+    uint64_t bytes = (uint64_t)m_size.width() * m_size.height() * 4 * (m_depth / 8);
+    m_bigtiff = bytes + bytes / 3 > 0xF0000000ULL;
+
+    if (m_size.isEmpty() || !m_file.open(QIODevice::WriteOnly)) return;
+
+    int width = m_size.width();
+    int height = m_size.height();
+    while (true) {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.band.resize((size_t)TILE_SIZE * width * 4);
+        m_levels.push_back(level);
+
+        if (std::max(width, height) <= TILE_SIZE) break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    for (size_t i = 0; i < m_levels.size() - 1; i++) {
+        m_levels[i].pending.resize((size_t)m_levels[i].width * 4);
+    }
+
+    // The offset of the first IFD is filled in by close()
+    std::vector<uint8_t> header = {'I', 'I'};
+    if (m_bigtiff) {
+        put_le(header, 43, 2);
+        put_le(header, 8, 2);
+        put_le(header, 0, 2);
+        put_le(header, 0, 8);
+    } else {
+        put_le(header, 42, 2);
+        put_le(header, 0, 4);
+    }
+    m_ok = m_file.write((const char *)header.data(), header.size()) == (qint64)header.size();
+}
+
+bool GeoTiffWriter::write(const QImage &strip) {
+    if (!m_ok || m_closed) return false;
+    stats::Timer timer(encode_stage);
+    timer.bytes(strip.sizeInBytes());
+
+    QImage rgba = strip.convertToFormat(QImage::Format_RGBA64);
+    std::vector<uint16_t> row((size_t)m_size.width() * 4, 0);
+    for (int y = 0; y < rgba.height() && m_levels[0].rows < m_size.height(); y++) {
+        const QRgba64 *in = (const QRgba64 *)rgba.constScanLine(y);
+        int width = std::min(rgba.width(), m_size.width());
+        for (int x = 0; x < width; x++) {
+            row[x * 4 + 0] = in[x].red();
+            row[x * 4 + 1] = in[x].green();
+            row[x * 4 + 2] = in[x].blue();
+            row[x * 4 + 3] = in[x].alpha();
+        }
+
+        push(0, row.data());
+    }
+
+    return m_ok;
+}
+
+void GeoTiffWriter::push(size_t i, const uint16_t *row) {
+    Level &level = m_levels[i];
+
+    size_t stride = (size_t)level.width * 4;
+    std::memcpy(&level.band[(level.rows % TILE_SIZE) * stride], row, stride * sizeof(uint16_t));
+    level.rows++;
+    if (level.rows % TILE_SIZE == 0 || level.rows == level.height) {
+        flush(level);
+    }
+
+    if (i + 1 == m_levels.size()) return;
+    std::vector<uint16_t> downsampled((size_t)m_levels[i + 1].width * 4);
+    if (level.has_pending) {
+        downsample(level.pending.data(), row, level.width, downsampled.data());
+        level.has_pending = false;
+        push(i + 1, downsampled.data());
+    } else if (level.rows == level.height) {
+        // Odd number of rows, the last one has nothing to pair with
+        downsample(row, row, level.width, downsampled.data());
+        push(i + 1, downsampled.data());
+    } else {
+        std::memcpy(level.pending.data(), row, stride * sizeof(uint16_t));
+        level.has_pending = true;
+    }
+}
+
+void GeoTiffWriter::flush(Level &level) {
+    int rows = (level.rows - 1) % TILE_SIZE + 1;
+    int across = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+    size_t stride = (size_t)level.width * 4;
+    size_t bytes = m_depth / 8;
+
+    std::vector<std::vector<uint8_t>> tiles(across);
+#pragma omp parallel for
+    for (int tx = 0; tx < across; tx++) {
+        // Edge tiles are padded with zeros
+        std::vector<uint8_t> raw((size_t)TILE_SIZE * TILE_SIZE * 4 * bytes, 0);
+        int width = std::min(TILE_SIZE, level.width - tx * TILE_SIZE);
+
+        for (int y = 0; y < rows; y++) {
+            const uint16_t *in = &level.band[y * stride + (size_t)tx * TILE_SIZE * 4];
+            uint8_t *out = &raw[(size_t)y * TILE_SIZE * 4 * bytes];
+
+            // Horizontal differencing (predictor 2) for better compression, padding is included
+            uint16_t previous[4] = {0, 0, 0, 0};
+            for (int x = 0; x < TILE_SIZE; x++) {
+                for (size_t c = 0; c < 4; c++) {
+                    uint16_t sample = x < width ? in[x * 4 + c] : 0;
+                    if (m_depth == 8) sample = (sample + 128) / 257;
+
+                    uint16_t difference = sample - previous[c];
+                    previous[c] = sample;
+                    for (size_t b = 0; b < bytes; b++) {
+                        *out++ = difference >> (b * 8);
+                    }
+                }
+            }
+        }
+
+        uLongf size = compressBound(raw.size());
+        tiles[tx].resize(size);
+        if (compress2(tiles[tx].data(), &size, raw.data(), raw.size(), Z_DEFAULT_COMPRESSION) == Z_OK) {
+            tiles[tx].resize(size);
+        } else {
+            tiles[tx].clear();
+        }
+    }
+
+    for (const std::vector<uint8_t> &tile : tiles) {
+        level.offsets.push_back(m_file.pos());
+        level.counts.push_back(tile.size());
+        if (tile.empty() || m_file.write((const char *)tile.data(), tile.size()) != (qint64)tile.size()) {
+            m_ok = false;
+        }
+    }
+}
+
+std::vector<GeoTiffWriter::Entry> GeoTiffWriter::ifd(size_t i) const {
+    const Level &level = m_levels[i];
+    uint16_t bits = m_depth;
+    uint16_t offset_type = m_bigtiff ? TYPE_LONG8 : TYPE_LONG;
+
+    std::vector<Entry> entries = {
+        {254, TYPE_LONG, 1, to_le<uint32_t>({i == 0 ? 0u : 1u})},  // NewSubfileType, reduced resolution
+        {256, TYPE_LONG, 1, to_le<uint32_t>({(uint32_t)level.width})},
+        {257, TYPE_LONG, 1, to_le<uint32_t>({(uint32_t)level.height})},
+        {258, TYPE_SHORT, 4, to_le<uint16_t>({bits, bits, bits, bits})},
+        {259, TYPE_SHORT, 1, to_le<uint16_t>({8})},  // Compression, Adobe DEFLATE
+        {262, TYPE_SHORT, 1, to_le<uint16_t>({2})},  // PhotometricInterpretation, RGB
+        {277, TYPE_SHORT, 1, to_le<uint16_t>({4})},  // SamplesPerPixel
+        {284, TYPE_SHORT, 1, to_le<uint16_t>({1})},  // PlanarConfiguration, contiguous
+        {317, TYPE_SHORT, 1, to_le<uint16_t>({2})},  // Predictor, horizontal differencing
+        {322, TYPE_LONG, 1, to_le<uint32_t>({TILE_SIZE})},
+        {323, TYPE_LONG, 1, to_le<uint32_t>({TILE_SIZE})},
+        {324, offset_type, level.offsets.size(), {}},
+        {325, offset_type, level.counts.size(), {}},
+        {338, TYPE_SHORT, 1, to_le<uint16_t>({2})},  // ExtraSamples, unassociated alpha
+    };
+    for (Entry &entry : entries) {
+        if (entry.tag == 324 || entry.tag == 325) {
+            const std::vector<uint64_t> &values = entry.tag == 324 ? level.offsets : level.counts;
+            for (uint64_t value : values) {
+                put_le(entry.data, value, type_size(offset_type));
+            }
+        }
+    }
+
+    if (i == 0) georeference(entries);
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.tag < b.tag; });
+    return entries;
+}
+
+void GeoTiffWriter::georeference(std::vector<Entry> &entries) const {
+    std::vector<std::array<uint16_t, 4>> keys;
+    std::vector<double> doubles;
+    std::string ascii;
+    auto key = [&](uint16_t id, uint16_t value) { keys.push_back({id, 0, 1, value}); };
+    auto key_double = [&](uint16_t id, double value) {
+        keys.push_back({id, 34736, 1, (uint16_t)doubles.size()});
+        doubles.push_back(value);
+    };
+    auto key_ascii = [&](uint16_t id, std::string value) {
+        keys.push_back({id, 34737, (uint16_t)(value.size() + 1), (uint16_t)ascii.size()});
+        ascii += value + "|";
+    };
+
+    // Units per XY
+    double scale_x = M_2PI * SPHERE_RADIUS;
+    double scale_y = M_2PI * SPHERE_RADIUS;
+
+    key(1025, 1);  // GTRasterTypeGeoKey, PixelIsArea
+    switch (m_crs) {
+        case transform::CRS::Equirectangular:
+            scale_x = 360.0;
+            scale_y = 180.0;
+            key(1024, 2);     // GTModelTypeGeoKey, geographic
+            key(2048, 4326);  // GeographicTypeGeoKey, WGS 84
+            break;
+        case transform::CRS::Mercator:
+            key(1024, 1);     // GTModelTypeGeoKey, projected
+            key(3072, 3857);  // ProjectedCSTypeGeoKey, WGS 84 / Pseudo-Mercator
+            break;
+        case transform::CRS::North_Polar:
+        case transform::CRS::South_Polar: {
+            // The polar projections are azimuthal equidistant on a sphere, which has no EPSG code
+            bool north = m_crs == transform::CRS::North_Polar;
+            key(1024, 1);  // GTModelTypeGeoKey, projected
+            key_ascii(1026, north ? "North Polar Azimuthal Equidistant" : "South Polar Azimuthal Equidistant");
+            key(2048, 32767);  // GeographicTypeGeoKey, user defined
+            key(2050, 32767);  // GeogGeodeticDatumGeoKey, user defined
+            key(2051, 8901);  // GeogPrimeMeridianGeoKey, Greenwich
+            key(2054, 9102);  // GeogAngularUnitsGeoKey, degrees
+            key(2056, 32767);  // GeogEllipsoidGeoKey, user defined
+            key_double(2057, SPHERE_RADIUS);  // GeogSemiMajorAxisGeoKey
+            key_double(2058, SPHERE_RADIUS);  // GeogSemiMinorAxisGeoKey
+            key(3072, 32767);  // ProjectedCSTypeGeoKey, user defined
+            key(3074, 32767);  // ProjectionGeoKey, user defined
+            key(3075, 12);  // ProjCoordTransGeoKey, CT_AzimuthalEquidistant
+            key(3076, 9001);  // ProjLinearUnitsGeoKey, metres
+            key_double(3082, 0.0);  // ProjFalseEastingGeoKey
+            key_double(3083, 0.0);  // ProjFalseNorthingGeoKey
+            key_double(3088, 0.0);  // ProjCenterLongGeoKey
+            key_double(3089, north ? 90.0 : -90.0);  // ProjCenterLatGeoKey
+            break;
+        }
+    }
+    std::sort(keys.begin(), keys.end(), [](const auto &a, const auto &b) { return a[0] < b[0]; });
+
+    // XY has its origin in the top left, model coordinates are centered with north up
+    double x = (m_bounds.left() - 0.5) * scale_x;
+    double y = (0.5 - m_bounds.top()) * scale_y;
+    double pixel_x = m_bounds.width() * scale_x / m_size.width();
+    double pixel_y = m_bounds.height() * scale_y / m_size.height();
+
+    std::vector<uint16_t> directory = {1, 1, 0, (uint16_t)keys.size()};
+    for (const std::array<uint16_t, 4> &key : keys) {
+        directory.insert(directory.end(), key.begin(), key.end());
+    }
+
+    entries.push_back({33550, TYPE_DOUBLE, 3, to_le<double>({pixel_x, pixel_y, 0.0})});     // ModelPixelScaleTag
+    entries.push_back({33922, TYPE_DOUBLE, 6, to_le<double>({0.0, 0.0, 0.0, x, y, 0.0})});  // ModelTiepointTag
+    entries.push_back({34735, TYPE_SHORT, directory.size(), to_le<uint16_t>(directory)});  // GeoKeyDirectoryTag
+    if (!doubles.empty()) {
+        entries.push_back({34736, TYPE_DOUBLE, doubles.size(), to_le<double>(doubles)});  // GeoDoubleParamsTag
+    }
+    if (!ascii.empty()) {
+        std::vector<uint8_t> data(ascii.begin(), ascii.end());
+        data.push_back('\0');
+        entries.push_back({34737, TYPE_ASCII, data.size(), data});  // GeoAsciiParamsTag
+    }
+}
+
+uint64_t GeoTiffWriter::write_ifds(const std::vector<std::vector<Entry>> &ifds) {
+    size_t count_size = m_bigtiff ? 8 : 2;
+    size_t entry_size = m_bigtiff ? 20 : 12;
+    size_t value_size = m_bigtiff ? 8 : 4;
+
+    // IFDs must start on a word boundary
+    uint64_t start = m_file.pos() + m_file.pos() % 2;
+    std::vector<uint8_t> out(start - m_file.pos(), 0);
+
+    uint64_t position = start;
+    for (size_t i = 0; i < ifds.size(); i++) {
+        const std::vector<Entry> &entries = ifds[i];
+
+        // Values that don't fit in an entry go after the IFD
+        uint64_t data = position + count_size + entries.size() * entry_size + value_size;
+        uint64_t next = data;
+        for (const Entry &entry : entries) {
+            if (entry.data.size() > value_size) next += entry.data.size() + entry.data.size() % 2;
+        }
+
+        put_le(out, entries.size(), count_size);
+        for (const Entry &entry : entries) {
+            put_le(out, entry.tag, 2);
+            put_le(out, entry.type, 2);
+            put_le(out, entry.count, value_size);
+            if (entry.data.size() > value_size) {
+                put_le(out, data, value_size);
+                data += entry.data.size() + entry.data.size() % 2;
+            } else {
+                out.insert(out.end(), entry.data.begin(), entry.data.end());
+                out.resize(out.size() + value_size - entry.data.size(), 0);
+            }
+        }
+        put_le(out, i + 1 == ifds.size() ? 0 : next, value_size);
+
+        for (const Entry &entry : entries) {
+            if (entry.data.size() > value_size) {
+                out.insert(out.end(), entry.data.begin(), entry.data.end());
+                out.resize(out.size() + entry.data.size() % 2, 0);
+            }
+        }
+        position = next;
+    }
+
+    if (m_file.write((const char *)out.data(), out.size()) != (qint64)out.size()) {
+        m_ok = false;
+    }
+    return start;
+}
+
+bool GeoTiffWriter::close() {
+    if (m_closed) return m_ok;
+    m_closed = true;
+    if (!m_ok) return false;
+    stats::Timer timer(encode_stage);
+
+    if (m_levels[0].rows != m_size.height()) {
+        m_file.close();
+        return m_ok = false;
+    }
+
+    std::vector<std::vector<Entry>> ifds;
+    for (size_t i = 0; i < m_levels.size(); i++) {
+        ifds.push_back(ifd(i));
+    }
+    uint64_t first = write_ifds(ifds);
+
+    std::vector<uint8_t> offset;
+    put_le(offset, first, m_bigtiff ? 8 : 4);
+    m_ok = m_ok && m_file.seek(m_bigtiff ? 8 : 4) &&
+           m_file.write((const char *)offset.data(), offset.size()) == (qint64)offset.size();
+    m_file.close();
+
+    return m_ok;
+}
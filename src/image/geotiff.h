@@ -0,0 +1,95 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_IMAGE_GEOTIFF_H_
+#define LEANHRPT_IMAGE_GEOTIFF_H_
+
+#include <QFile>
+#include <QImage>
+#include <QRectF>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "geo/crs.h"
+#include "image/stripwriter.h"
+
+/**
+ * A streaming GeoTIFF encoder
+ *
+ * Images are written as 256x256 DEFLATE compressed tiles with internal
+ * overviews, georeferenced with the GeoKeys of a `transform::CRS`. Only one
+ * row of tiles per overview level is held in memory, the tiles in a row are
+ * compressed in parallel. BigTIFF is used if the image might not fit in 4GiB.
+ */
+class GeoTiffWriter : public StripWriter {
+   public:
+    /**
+     * @param size Size of the full resolution image
+     * @param crs The CRS the image is projected into
+     * @param bounds The area of the CRS covered by the image, in XY
+     * @param depth Bits per sample, 8 or 16
+     */
+    GeoTiffWriter(const std::string &filename, QSize size, transform::CRS crs, QRectF bounds, int depth = 16);
+
+    bool write(const QImage &strip) override;
+    bool close() override;
+
+   private:
+    struct Level {
+        int width;
+        int height;
+        // Rows received so far
+        int rows = 0;
+        // The current row of tiles, RGBA
+        std::vector<uint16_t> band;
+        // Row waiting for its pair before being downsampled into the next level
+        std::vector<uint16_t> pending;
+        bool has_pending = false;
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> counts;
+    };
+    struct Entry {
+        uint16_t tag;
+        uint16_t type;
+        uint64_t count;
+        std::vector<uint8_t> data;
+    };
+
+    // Add a row to a level, flushing the band and passing it down to the next level as needed
+    void push(size_t level, const uint16_t *row);
+    // Compress and write the current band of tiles
+    void flush(Level &level);
+    // Write a chain of IFDs at the end of the file, returns the offset of the first one
+    uint64_t write_ifds(const std::vector<std::vector<Entry>> &ifds);
+    std::vector<Entry> ifd(size_t level) const;
+    // Georeferencing tags, only present on the full resolution image
+    void georeference(std::vector<Entry> &entries) const;
+
+    QFile m_file;
+    QSize m_size;
+    transform::CRS m_crs;
+    QRectF m_bounds;
+    int m_depth;
+    bool m_bigtiff;
+    bool m_ok = false;
+    bool m_closed = false;
+    std::vector<Level> m_levels;
+};
+
+#endif
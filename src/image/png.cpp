@@ -0,0 +1,333 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "png.h"
+
+#include <QFileInfo>
+#include <QThread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "stats.h"
+
+// Uncompressed size of a band, rows are never split between bands
+#define BAND_SIZE (1024 * 1024)
+// Size of the deflate window
+#define WINDOW_SIZE 32768
+
+static stats::Stage encode_stage("encode");
+
+static void put_u32(uint8_t *out, uint32_t x) {
+    out[0] = x >> 24;
+    out[1] = x >> 16;
+    out[2] = x >> 8;
+    out[3] = x;
+}
+
+static uint8_t paeth_predictor(uint8_t a, uint8_t b, uint8_t c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+static uint8_t apply_filter(uint8_t type, uint8_t x, uint8_t a, uint8_t b, uint8_t c) {
+    switch (type) {
+        case 1:
+            return x - a;
+        case 2:
+            return x - b;
+        case 3:
+            return x - ((a + b) >> 1);
+        case 4:
+            return x - paeth_predictor(a, b, c);
+        default:
+            return x;
+    }
+}
+
+// Filter a row with whichever filter gives the smallest sum of absolute differences, `out` starts with the filter type
+static void filter(const uint8_t *row, const uint8_t *previous, size_t stride, size_t bpp, uint8_t *out) {
+    size_t sums[5] = {0, 0, 0, 0, 0};
+    for (size_t i = 0; i < stride; i++) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = previous[i];
+        uint8_t c = i >= bpp ? previous[i - bpp] : 0;
+
+        // Treat the bytes as signed, so small negative differences are small too
+        for (uint8_t type = 0; type < 5; type++) {
+            sums[type] += std::abs((int8_t)apply_filter(type, row[i], a, b, c));
+        }
+    }
+
+    uint8_t best = 0;
+    for (uint8_t type = 1; type < 5; type++) {
+        if (sums[type] < sums[best]) best = type;
+    }
+
+    out[0] = best;
+    for (size_t i = 0; i < stride; i++) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t c = i >= bpp ? previous[i - bpp] : 0;
+        out[i + 1] = apply_filter(best, row[i], a, previous[i], c);
+    }
+}
+
+// Compress a band as a raw deflate stream, ending on a byte boundary unless it's the last one
+static bool deflate_band(const std::vector<uint8_t> &data, const uint8_t *dictionary, size_t dictionary_size, int level,
+                         bool last, std::vector<uint8_t> &out) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    if (dictionary_size != 0) deflateSetDictionary(&stream, dictionary, dictionary_size);
+
+    // Leave room for the sync marker
+    out.resize(deflateBound(&stream, data.size()) + 16);
+    stream.next_in = (Bytef *)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = out.data();
+    stream.avail_out = out.size();
+
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    while (true) {
+        int ret = deflate(&stream, flush);
+        if (ret == Z_STREAM_ERROR) break;
+        if (last ? ret == Z_STREAM_END : stream.avail_in == 0 && stream.avail_out != 0) {
+            out.resize(stream.total_out);
+            deflateEnd(&stream);
+            return true;
+        }
+
+        // Out of space
+        size_t used = stream.total_out;
+        out.resize(out.size() * 2);
+        stream.next_out = out.data() + used;
+        stream.avail_out = out.size() - used;
+    }
+
+    deflateEnd(&stream);
+    return false;
+}
+
+PngWriter::PngWriter(const std::string &filename, QSize size, int depth, Color color, int level)
+    : m_file(QString::fromStdString(filename)),
+      m_size(size),
+      m_depth(depth == 8 ? 8 : 16),
+      m_color(color),
+      m_level(std::min(std::max(level, (int)Z_DEFAULT_COMPRESSION), 9)) {
+    size_t channels = m_color == Color::Gray ? 1 : (m_color == Color::RGB ? 3 : 4);
+    m_stride = (size_t)m_size.width() * channels * (m_depth / 8);
+    m_band_rows = std::max<size_t>(BAND_SIZE / std::max<size_t>(m_stride, 1), 1);
+    m_bands = std::max(QThread::idealThreadCount(), 1);
+    m_buffer.resize(m_band_rows * m_bands * m_stride);
+    m_previous.resize(m_stride, 0);
+    m_adler = adler32(0, nullptr, 0);
+
+    if (m_size.isEmpty() || !m_file.open(QIODevice::WriteOnly)) return;
+
+    // Signature and header (no interlacing)
+    const uint8_t color_types[3] = {0, 2, 6};
+    uint8_t header[13] = {0};
+    put_u32(&header[0], m_size.width());
+    put_u32(&header[4], m_size.height());
+    header[8] = m_depth;
+    header[9] = color_types[(size_t)m_color];
+    m_ok = m_file.write("\x89PNG\r\n\x1a\n", 8) == 8 && chunk("IHDR", header, sizeof(header));
+}
+
+bool PngWriter::write(const QImage &strip) {
+    if (!m_ok || m_closed) return false;
+    stats::Timer timer(encode_stage);
+    timer.bytes(strip.sizeInBytes());
+
+    QImage image = strip;
+    if (m_color == Color::Gray && strip.format() != QImage::Format_Grayscale16) {
+        image = strip.convertToFormat(QImage::Format_Grayscale16);
+    } else if (m_color != Color::Gray && strip.format() != QImage::Format_RGBX64 && strip.format() != QImage::Format_RGBA64) {
+        image = strip.convertToFormat(QImage::Format_RGBA64);
+    }
+
+    int width = std::min(image.width(), m_size.width());
+    for (int y = 0; y < image.height() && m_rows < m_size.height(); y++, m_rows++) {
+        // Samples are big endian
+        uint8_t *out = &m_buffer[m_buffered * m_stride];
+        std::memset(out, 0, m_stride);
+        auto put = [&](uint16_t sample) {
+            if (m_depth == 16) {
+                *out++ = sample >> 8;
+                *out++ = sample;
+            } else {
+                *out++ = (sample + 128) / 257;
+            }
+        };
+
+        if (m_color == Color::Gray) {
+            const uint16_t *in = (const uint16_t *)image.constScanLine(y);
+            for (int x = 0; x < width; x++) {
+                put(in[x]);
+            }
+        } else {
+            const QRgba64 *in = (const QRgba64 *)image.constScanLine(y);
+            for (int x = 0; x < width; x++) {
+                put(in[x].red());
+                put(in[x].green());
+                put(in[x].blue());
+                if (m_color == Color::RGBA) put(in[x].alpha());
+            }
+        }
+
+        if (++m_buffered == m_band_rows * m_bands && !compress(false)) {
+            m_ok = false;
+        }
+    }
+
+    return m_ok;
+}
+
+bool PngWriter::compress(bool last) {
+    size_t bands = (m_buffered + m_band_rows - 1) / m_band_rows;
+    // The stream still needs to be finished even if there's nothing left
+    if (last) bands = std::max<size_t>(bands, 1);
+
+    size_t bpp = m_stride / m_size.width();
+    std::vector<std::vector<uint8_t>> filtered(bands);
+    std::vector<std::vector<uint8_t>> compressed(bands);
+    std::vector<uLong> adlers(bands);
+    std::vector<char> ok(bands, true);
+
+#pragma omp parallel for
+    for (size_t i = 0; i < bands; i++) {
+        size_t start = i * m_band_rows;
+        size_t rows = std::min(m_band_rows, m_buffered - start);
+        filtered[i].resize(rows * (m_stride + 1));
+
+        for (size_t y = start; y < start + rows; y++) {
+            const uint8_t *previous = y == 0 ? m_previous.data() : &m_buffer[(y - 1) * m_stride];
+            filter(&m_buffer[y * m_stride], previous, m_stride, bpp, &filtered[i][(y - start) * (m_stride + 1)]);
+        }
+        adlers[i] = adler32(adler32(0, nullptr, 0), filtered[i].data(), filtered[i].size());
+    }
+
+#pragma omp parallel for
+    for (size_t i = 0; i < bands; i++) {
+        const uint8_t *dictionary = m_dictionary.data();
+        size_t dictionary_size = m_dictionary.size();
+        if (i != 0) {
+            dictionary_size = std::min<size_t>(filtered[i - 1].size(), WINDOW_SIZE);
+            dictionary = filtered[i - 1].data() + filtered[i - 1].size() - dictionary_size;
+        }
+        ok[i] = deflate_band(filtered[i], dictionary, dictionary_size, m_level, last && i == bands - 1, compressed[i]);
+    }
+
+    std::vector<uint8_t> idat;
+    if (!m_started) {
+        // zlib header, 32KiB window
+        int level = m_level == Z_DEFAULT_COMPRESSION ? 6 : m_level;
+        uint8_t flags = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+        flags |= (31 - ((0x78 << 8) | flags) % 31) % 31;
+        idat.push_back(0x78);
+        idat.push_back(flags);
+        m_started = true;
+    }
+    for (size_t i = 0; i < bands; i++) {
+        if (!ok[i]) return false;
+        idat.insert(idat.end(), compressed[i].begin(), compressed[i].end());
+        m_adler = adler32_combine(m_adler, adlers[i], filtered[i].size());
+
+        m_dictionary.insert(m_dictionary.end(), filtered[i].begin(), filtered[i].end());
+        if (m_dictionary.size() > WINDOW_SIZE) {
+            m_dictionary.erase(m_dictionary.begin(), m_dictionary.end() - WINDOW_SIZE);
+        }
+    }
+    if (last) {
+        uint8_t adler[4];
+        put_u32(adler, m_adler);
+        idat.insert(idat.end(), adler, adler + 4);
+    }
+
+    if (m_buffered != 0) {
+        std::memcpy(m_previous.data(), &m_buffer[(m_buffered - 1) * m_stride], m_stride);
+    }
+    m_buffered = 0;
+
+    return chunk("IDAT", idat.data(), idat.size());
+}
+
+bool PngWriter::chunk(const char *type, const uint8_t *data, size_t size) {
+    uint8_t length[4];
+    uint8_t crc[4];
+    put_u32(length, size);
+    uLong sum = crc32(0, (const Bytef *)type, 4);
+    if (size != 0) sum = crc32(sum, data, size);
+    put_u32(crc, sum);
+
+    return m_file.write((const char *)length, 4) == 4 && m_file.write(type, 4) == 4 &&
+           m_file.write((const char *)data, size) == (qint64)size && m_file.write((const char *)crc, 4) == 4;
+}
+
+bool PngWriter::close() {
+    if (m_closed) return false;
+    m_closed = true;
+
+    if (m_ok && m_rows != m_size.height()) m_ok = false;
+    if (m_ok) {
+        stats::Timer timer(encode_stage);
+        m_ok = compress(true) && chunk("IEND", nullptr, 0);
+    }
+
+    m_file.close();
+    return m_ok && m_file.error() == QFileDevice::NoError;
+}
+
+bool PngWriter::save(const QImage &image, const std::string &filename, int level) {
+    Color color = image.hasAlphaChannel() ? Color::RGBA : Color::RGB;
+    int depth = 8;
+    switch (image.format()) {
+        case QImage::Format_Grayscale16:
+            color = Color::Gray;
+            depth = 16;
+            break;
+        case QImage::Format_Grayscale8:
+            color = Color::Gray;
+            break;
+        case QImage::Format_RGBX64:
+        case QImage::Format_RGBA64:
+        case QImage::Format_RGBA64_Premultiplied:
+            depth = 16;
+            break;
+        default:
+            break;
+    }
+
+    PngWriter writer(filename, image.size(), depth, color, level);
+    return writer.write(image) && writer.close();
+}
+
+bool save_image(const QImage &image, const QString &filename, int level) {
+    if (QFileInfo(filename).suffix().toLower() == "png") {
+        return PngWriter::save(image, filename.toStdString(), level);
+    }
+
+    stats::Timer timer(encode_stage);
+    timer.bytes(image.sizeInBytes());
+    return image.save(filename);
+}
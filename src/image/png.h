@@ -0,0 +1,92 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_IMAGE_PNG_H_
+#define LEANHRPT_IMAGE_PNG_H_
+
+#include <zlib.h>
+
+#include <QFile>
+#include <QImage>
+#include <QString>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image/stripwriter.h"
+
+/**
+ * A streaming, multithreaded PNG encoder
+ *
+ * Rows are collected into bands which are filtered and compressed in
+ * parallel. Every band is its own raw deflate stream, primed with the end of
+ * the band before it, and they are joined into a single zlib stream (the same
+ * way pigz does it). Memory use only depends on the width of the image, and
+ * the compressed data doesn't depend on the number of threads.
+ */
+class PngWriter : public StripWriter {
+   public:
+    /// Channels written, Gray and RGB drop the alpha channel
+    enum class Color { Gray, RGB, RGBA };
+
+    /**
+     * @param depth Bits per sample, 8 or 16
+     * @param level zlib compression level, from 0 (fastest) to 9 (smallest)
+     */
+    PngWriter(const std::string &filename, QSize size, int depth = 16, Color color = Color::RGBA,
+              int level = Z_DEFAULT_COMPRESSION);
+
+    bool write(const QImage &strip) override;
+    bool close() override;
+
+    /// Save a whole image, the color type and depth are picked from the format of the image
+    static bool save(const QImage &image, const std::string &filename, int level = Z_DEFAULT_COMPRESSION);
+
+   private:
+    // Filter and compress the buffered rows, `last` finishes the stream
+    bool compress(bool last);
+    // Write a chunk with its length and CRC
+    bool chunk(const char *type, const uint8_t *data, size_t size);
+
+    QFile m_file;
+    QSize m_size;
+    int m_depth;
+    Color m_color;
+    int m_level;
+    size_t m_stride;
+    size_t m_band_rows;
+    size_t m_bands;
+    int m_rows = 0;
+    bool m_ok = false;
+    bool m_closed = false;
+
+    // Rows waiting to be compressed
+    std::vector<uint8_t> m_buffer;
+    size_t m_buffered = 0;
+    // The row before the first buffered one
+    std::vector<uint8_t> m_previous;
+    // The last 32KiB given to deflate, used as the dictionary of the next band
+    std::vector<uint8_t> m_dictionary;
+    uLong m_adler;
+    bool m_started = false;
+};
+
+/// Save an image, PNGs are written with `PngWriter` and everything else by Qt
+bool save_image(const QImage &image, const QString &filename, int level = Z_DEFAULT_COMPRESSION);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pyramid.h"
+
+#include <cmath>
+#include <cstdint>
+
+ImagePyramid::ImagePyramid(const QImage &image, int min_size) {
+    m_levels.push_back(image);
+    if (image.isNull()) return;
+
+    while (std::min(m_levels.back().width(), m_levels.back().height()) / 2 >= min_size) {
+        m_levels.push_back(downsample(m_levels.back()));
+    }
+}
+
+size_t ImagePyramid::level_for_scale(double scale) {
+    if (scale <= 0.0 || scale >= 1.0) return 0;
+    return std::floor(std::log2(1.0 / scale));
+}
+
+template <size_t N>
+static void box_filter(const QImage &in, QImage &out) {
+    size_t in_width = in.width();
+    size_t in_height = in.height();
+
+#pragma omp parallel for
+    for (size_t y = 0; y < (size_t)out.height(); y++) {
+        const uint16_t *a = reinterpret_cast<const uint16_t *>(in.constScanLine(std::min(y * 2, in_height - 1)));
+        const uint16_t *b = reinterpret_cast<const uint16_t *>(in.constScanLine(std::min(y * 2 + 1, in_height - 1)));
+        uint16_t *line = reinterpret_cast<uint16_t *>(out.scanLine(y));
+
+        for (size_t x = 0; x < (size_t)out.width(); x++) {
+            size_t x1 = std::min(x * 2, in_width - 1) * N;
+            size_t x2 = std::min(x * 2 + 1, in_width - 1) * N;
+            for (size_t i = 0; i < N; i++) {
+                line[x * N + i] = ((uint32_t)a[x1 + i] + a[x2 + i] + b[x1 + i] + b[x2 + i] + 2) / 4;
+            }
+        }
+    }
+}
+
+QImage ImagePyramid::downsample(const QImage &image) {
+    int width = std::max(image.width() / 2, 1);
+    int height = std::max(image.height() / 2, 1);
+
+    switch (image.format()) {
+        case QImage::Format_Grayscale16: {
+            QImage out(width, height, image.format());
+            box_filter<1>(image, out);
+            return out;
+        }
+        case QImage::Format_RGBX64:
+        case QImage::Format_RGBA64: {
+            QImage out(width, height, image.format());
+            box_filter<4>(image, out);
+            return out;
+        }
+        default:
+            return image.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+}
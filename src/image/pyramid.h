@@ -0,0 +1,57 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_IMAGE_PYRAMID_H_
+#define LEANHRPT_IMAGE_PYRAMID_H_
+
+#include <QImage>
+#include <algorithm>
+#include <vector>
+
+/**
+ * A chain of successively halved copies of an image
+ *
+ * Level 0 is the original image, every following level is a 2x2 box
+ * filtered copy of the previous one. Generation stops once the shortest
+ * side would drop below `min_size`.
+ */
+class ImagePyramid {
+   public:
+    ImagePyramid() = default;
+    ImagePyramid(const QImage &image, int min_size = 128);
+
+    /// Number of levels, including the original image
+    size_t levels() const { return m_levels.size(); }
+    /// Get a level, clamped to the coarsest one available
+    const QImage &level(size_t n) const { return m_levels[std::min(n, m_levels.size() - 1)]; }
+
+    /**
+     * Select the coarsest level that still has at least one pixel per screen pixel
+     *
+     * @param scale The number of screen pixels per full resolution pixel
+     */
+    static size_t level_for_scale(double scale);
+
+    /// Halve an image with a 2x2 box filter
+    static QImage downsample(const QImage &image);
+
+   private:
+    std::vector<QImage> m_levels;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_IMAGE_STRIPWRITER_H_
+#define LEANHRPT_IMAGE_STRIPWRITER_H_
+
+#include <QImage>
+
+/**
+ * Writes an image to disk a strip of rows at a time
+ *
+ * Used for images that are too big to hold in memory at once, only the
+ * current strip (and whatever the encoder keeps) is needed.
+ */
+class StripWriter {
+   public:
+    virtual ~StripWriter() = default;
+
+    /// Write the next rows of the image, top to bottom
+    virtual bool write(const QImage &strip) = 0;
+    /// Finish the file, fails if fewer rows than the height of the image were written
+    virtual bool close() = 0;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sunz.h"
+
+// Bound to references by std::min()
+const size_t SunzBuffer::TILE_ROWS;
+
+SunzBuffer::SunzBuffer(size_t width, size_t height, Generator generator, Format format, size_t budget)
+    : m_width(width), m_height(height), m_format(format), m_generator(generator), m_budget(budget) {}
+
+SunzBuffer::SunzBuffer(const SunzBuffer &other)
+    : m_width(other.m_width),
+      m_height(other.m_height),
+      m_format(other.m_format),
+      m_generator(other.m_generator),
+      m_budget(other.m_budget) {
+    // Tiles are never modified so they can be shared
+    std::lock_guard<std::mutex> lock(other.m_mutex);
+    m_tiles = other.m_tiles;
+    m_lru = other.m_lru;
+}
+
+SunzBuffer::Row SunzBuffer::row(size_t y) const {
+    y = std::min(y, m_height - 1);
+    size_t i = y / TILE_ROWS;
+    size_t offset = (y % TILE_ROWS) * m_width;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_tiles.find(i);
+    if (it != m_tiles.end()) {
+        m_lru.remove(i);
+        m_lru.push_front(i);
+        return Row(it->second, offset, m_width);
+    }
+    auto pending = m_pending.find(i);
+    if (pending != m_pending.end()) {
+        std::shared_future<std::shared_ptr<Tile>> future = pending->second;
+        lock.unlock();
+        return Row(future.get(), offset, m_width);
+    }
+
+    // Calculate the tile without holding the lock, so other tiles can be read (or calculated) in the meantime
+    std::promise<std::shared_ptr<Tile>> promise;
+    m_pending[i] = promise.get_future().share();
+    lock.unlock();
+
+    std::shared_ptr<Tile> tile;
+    try {
+        size_t rows = std::min(TILE_ROWS, m_height - i * TILE_ROWS);
+        std::vector<float> values(rows * m_width);
+        m_generator(i * TILE_ROWS, rows, values.data());
+
+        tile = std::make_shared<Tile>(m_format, TILE_ROWS * m_width);
+        for (size_t j = 0; j < values.size(); j++) {
+            tile->set(j, values[j]);
+        }
+    } catch (...) {
+        lock.lock();
+        m_pending.erase(i);
+        lock.unlock();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    lock.lock();
+    m_pending.erase(i);
+    m_tiles[i] = tile;
+    m_lru.push_front(i);
+
+    // Evict tiles, anything still being read stays alive until its rows are released
+    size_t used = m_lru.size() * tile->bytes();
+    while (used > m_budget && m_lru.size() > 1) {
+        m_tiles.erase(m_lru.back());
+        m_lru.pop_back();
+        used -= tile->bytes();
+    }
+    lock.unlock();
+
+    promise.set_value(tile);
+    return Row(tile, offset, m_width);
+}
+
+size_t SunzBuffer::bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t bytes = 0;
+    for (auto &tile : m_tiles) {
+        bytes += tile.second->bytes();
+    }
+    return bytes;
+}
@@ -0,0 +1,135 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_IMAGE_SUNZ_H_
+#define LEANHRPT_IMAGE_SUNZ_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Per-pixel solar zenith angles (in radians) of an image
+ *
+ * The angles are stored in tiles of `TILE_ROWS` full width rows, which are
+ * only calculated (by a generator) when they are first accessed and are kept
+ * under a memory budget, evicting the least recently used tiles.
+ *
+ * Values can either be stored as floats or quantized to 16 bits over 0-pi,
+ * which halves the memory used while still having a resolution of ~0.003
+ * degrees.
+ *
+ * Thread safe.
+ */
+class SunzBuffer {
+    struct Tile;
+
+   public:
+    enum class Format { Float, UInt16 };
+    /// Fills `rows` rows starting at row `y` into `out`, which is row major
+    using Generator = std::function<void(size_t y, size_t rows, float *out)>;
+
+    static const size_t TILE_ROWS = 64;
+
+    /// An empty buffer
+    SunzBuffer() : m_width(0), m_height(0), m_format(Format::Float), m_budget(0) {}
+    /// `budget` is the maximum number of bytes kept in memory
+    SunzBuffer(size_t width, size_t height, Generator generator, Format format = Format::Float,
+               size_t budget = 64 * 1024 * 1024);
+    SunzBuffer(const SunzBuffer &other);
+
+    /// A single row, keeps the tile it is in alive
+    class Row {
+       public:
+        /// An invalid row, only useful to be assigned to
+        Row() = default;
+
+        /// Get a value, the position is clamped to the row
+        float operator[](size_t x) const {
+            x = std::min(x, width - 1);
+            return tile->format == Format::Float ? tile->f[offset + x] : (float)tile->q[offset + x] * SCALE;
+        }
+
+       private:
+        friend class SunzBuffer;
+        Row(std::shared_ptr<const Tile> tile, size_t offset, size_t width) : tile(tile), offset(offset), width(width) {}
+
+        std::shared_ptr<const Tile> tile;
+        size_t offset = 0;
+        size_t width = 0;
+    };
+
+    /// Get a row, calculating it if needed, `y` is clamped to the buffer
+    Row row(size_t y) const;
+    /// Get a single value, use `row()` when reading many
+    float at(size_t y, size_t x) const { return row(y)[x]; }
+
+    size_t width() const { return m_width; }
+    size_t height() const { return m_height; }
+    Format format() const { return m_format; }
+    bool empty() const { return m_width == 0 || m_height == 0; }
+    /// Memory currently used by the values
+    size_t bytes() const;
+
+   private:
+    static constexpr float SCALE = M_PI / 65535.0;
+
+    struct Tile {
+        Format format;
+        std::vector<float> f;
+        std::vector<uint16_t> q;
+
+        Tile(Format format, size_t size) : format(format) {
+            if (format == Format::Float) {
+                f.resize(size);
+            } else {
+                q.resize(size);
+            }
+        }
+        void set(size_t i, float value) {
+            if (format == Format::Float) {
+                f[i] = value;
+            } else {
+                q[i] = std::round(std::min(std::max(value, 0.0f), (float)M_PI) / SCALE);
+            }
+        }
+        size_t bytes() const { return f.size() * sizeof(float) + q.size() * sizeof(uint16_t); }
+    };
+
+    size_t m_width;
+    size_t m_height;
+    Format m_format;
+    Generator m_generator;
+    size_t m_budget;
+
+    mutable std::mutex m_mutex;
+    mutable std::map<size_t, std::shared_ptr<Tile>> m_tiles;
+    // Tiles being calculated, without the lock held, other readers of them wait on the future
+    mutable std::map<size_t, std::shared_future<std::shared_ptr<Tile>>> m_pending;
+    // Most recently used first
+    mutable std::list<size_t> m_lru;
+};
+
+#endif
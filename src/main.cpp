@@ -39,10 +39,30 @@ int main(int argc, char *argv[]) {
     parser.addOption({{"f", "flip"}, "Flip the image"});
     parser.addOption({{"m", "map"}, "Path to a shapefile", "path"});
     parser.addOption({{"l", "landmark"}, "Path to a landmarks file", "path"});
+    parser.addOption({"stream", "Decode from a live source: \"-\" for stdin, tcp://host:port, a FIFO or a growing file", "source"});
+    parser.addOption({"satellite", "Satellite being received when streaming, e.g. NOAA-19", "name"});
+    parser.addOption({"protocol", "Protocol used when streaming (hrpt, gac, gac-reverse, dsb, ahrpt, meteor-hrpt, lrpt, fy-hrpt)",
+                      "protocol"});
+    parser.addOption({"format", "Format of the stream (raw, cadu, vcdu, raw16, hrp, tip)", "format"});
+    parser.addOption({"interval", "Seconds between live previews when streaming (default 5)", "seconds"});
+    parser.addOption({"timeout", "Seconds a growing file can be idle before it is considered finished (default 10)", "seconds"});
+    parser.addOption({"batch", "Process every file in a directory, or listed in a file", "path"});
+    parser.addOption({"workers", "Number of passes processed at the same time in batch mode", "n"});
+    parser.addOption({"watch", "Keep watching the batch directory for new files"});
+    parser.addOption({"memory", "Memory budget in MiB for images being rendered at the same time (default 2048)", "MiB"});
+    parser.addOption({"l1a", "Also save the decoded data as an L1a archive, which can be loaded instead of the recording"});
+    parser.addOption({"sync", "Also save sync telemetry (lock and loss offsets, sync word bit errors, frame rate) as JSON"});
+    parser.addOption({"png-level", "PNG compression level from 0 (fastest) to 9 (smallest), default 6", "level"});
+    parser.addOption({"geolocation", "Also save the latitude/longitude of every nth pixel as a binary grid (unflipped)", "n"});
+    parser.addOption({"mosaic", "Project every file (and --batch) into one image per output, rule is nadir, zenith or newest",
+                      "rule"});
+    parser.addOption({"crs", "CRS of mosaics (equirectangular, mercator, north-polar, south-polar)", "crs"});
+    parser.addOption({"resolution", "Resolution of mosaics in km per pixel (default 1)", "km"});
+    parser.addOption({"stats", "Write the time spent in (and throughput of) every stage, and event counters, as JSON", "file"});
     parser.addPositionalArgument("file", "filename");
     parser.process(app);
 
-    if (parser.positionalArguments().isEmpty()) {
+    if (parser.positionalArguments().isEmpty() && !parser.isSet("stream") && !parser.isSet("batch") && !parser.isSet("mosaic")) {
         MainWindow window;
         window.show();
         return app.exec();
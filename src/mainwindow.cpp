@@ -21,6 +21,7 @@
 #include <QCloseEvent>
 #include <QDropEvent>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QMimeData>
 #include <QProgressBar>
 #include <QPushButton>
@@ -28,6 +29,7 @@
 #include <QtConcurrent/QtConcurrent>
 
 #include "decoders/decoder.h"
+#include "image/png.h"
 #include "map.h"
 #include "projectdialog.h"
 #include "protocol/timestamp.h"
@@ -35,6 +37,9 @@
 #include "util.h"
 #include "geometry.h"
 
+// Images larger than this get a downsampled preview while the full resolution image is rendered
+#define PREVIEW_PIXELS (1024 * 1024)
+
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     ui = new Ui::MainWindow;
     ui->setupUi(this);
@@ -44,6 +49,15 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     ui->channelView->setScene(scene);
     ui->compositeView->setScene(scene);
     ui->presetView->setScene(scene);
+    display_item = new QTiledImageItem;
+    scene->addItem(display_item);
+
+    previewWatcher = new QFutureWatcher<DisplayResult>(this);
+    displayWatcher = new QFutureWatcher<DisplayResult>(this);
+    QFutureWatcher<DisplayResult>::connect(previewWatcher, &QFutureWatcher<DisplayResult>::finished, this,
+                                           [this]() { showDisplayResult(previewWatcher->result()); });
+    QFutureWatcher<DisplayResult>::connect(displayWatcher, &QFutureWatcher<DisplayResult>::finished, this,
+                                           [this]() { showDisplayResult(displayWatcher->result()); });
 
     // Keyboard shortcuts
     zoomIn = new QShortcut(QKeySequence(Qt::CTRL | Qt::Key_Plus), this);
@@ -105,8 +119,19 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
     setState(WindowState::Idle);
 
+    stats_view = new QStatsView(this);
+    stats_view->closed = [this]() {
+        ui->actionStatistics->setChecked(false);
+        stats::enable(false);
+    };
+
     project_diag = new ProjectDialog(this);
     ProjectDialog::connect(project_diag, &ProjectDialog::get_viewport, [this]() -> QImage {
+        // Make sure the newest full resolution image is used, even if it hasn't been shown yet
+        displayWatcher->waitForFinished();
+        if (displayWatcher->future().resultCount() != 0) {
+            showDisplayResult(displayWatcher->result());
+        }
         QImage copy(display);
         compositors[sensor]->equalise(copy, selectedEqualization, clip_limit, ui->brightnessOnly->isChecked());
         compositors[sensor]->enable_map = false;
@@ -124,7 +149,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
         size_t height = compositors[sensor]->height();
         size_t y = round((double)height / (double)width * (double)n);
 
-        return proj->calculate_gcps(timestamps[sensor], y, n, sensor, sat, width);
+        return *geolocation->gcps(sensor, width, y, n);
     });
     ProjectDialog::connect(project_diag, &ProjectDialog::map_shapefile, [this]() -> QString { return map_shapefile; });
     ProjectDialog::connect(project_diag, &ProjectDialog::landmark_file, [this]() -> QString { return landmark_file; });
@@ -195,7 +220,10 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     }
 }
 
-MainWindow::~MainWindow() { delete ui; }
+MainWindow::~MainWindow() {
+    delete ui;
+    delete geolocation;
+}
 
 void MainWindow::closeEvent(QCloseEvent *event) {
     if (savingImage) {
@@ -237,6 +265,10 @@ void MainWindow::closeEvent(QCloseEvent *event) {
         }
     }
 
+    display_generation++;
+    previewWatcher->waitForFinished();
+    displayWatcher->waitForFinished();
+
     for (const auto &compositor : compositors) {
         delete compositor.second;
     }
@@ -264,6 +296,7 @@ void MainWindow::setState(WindowState state) {
     ui->actionSave_Current_Image->setEnabled(state == WindowState::Finished);
     ui->actionSave_Current_Image_Corrected->setEnabled(state == WindowState::Finished);
     ui->actionSave_GCP_File->setEnabled(state == WindowState::Finished && have_tles);
+    ui->actionSave_Geolocation_Grid->setEnabled(state == WindowState::Finished && have_tles);
     zoomIn->setEnabled(state == WindowState::Finished);
     zoomOut->setEnabled(state == WindowState::Finished);
 }
@@ -283,7 +316,7 @@ void MainWindow::populateChannelSelectors(size_t channels) {
 
 void MainWindow::on_actionOpen_triggered() {
     QString filename = QFileDialog::getOpenFileName(
-        this, "Open File", "", "Supported formats (*.bin *.cadu *.raw16 *.hrp *.vcdu *.tip *.dec);;All files (*)");
+        this, "Open File", "", "Supported formats (*.bin *.cadu *.raw16 *.hrp *.vcdu *.tip *.dec *.l1a);;All files (*)");
 
     if (!filename.isEmpty()) {
         decodeWatcher->setFuture(QtConcurrent::run([=]() { startDecode(filename.toStdString()); }));
@@ -293,36 +326,53 @@ void MainWindow::on_actionOpen_triggered() {
 void MainWindow::startDecode(std::string filename) {
     QApplication::setOverrideCursor(Qt::WaitCursor);
     // Fingerprint
-    scene->clear();
+    QMetaObject::invokeMethod(this, [this]() { display_item->setImage(QImage()); });
     setState(WindowState::Decoding);
     ui->contrastLimitApply->setEnabled(false);
     status->setText("Fingerprinting");
 
-    fingerprinter = new Fingerprint;
-    FileType type;
+    // Archives have already been decoded
+    L1aArchive archive;
     Protocol protocol;
-    std::tie(sat, type, protocol) = fingerprinter->file(filename,fingerprinterSuggestion);
-    if (sat == SatID::Unknown) {
+    Data data;
+    std::vector<Imager> imagers;
+    if (L1aArchive::is_archive(filename)) {
+        archive = L1aArchive::open(filename);
+        if (archive.empty() || archive.imagers().empty()) {
+            sat = SatID::Unknown;
+            return;
+        }
+        sat = archive.satellite();
+        protocol = archive.protocol();
+        data = archive.metadata();
+        imagers = archive.imagers();
+    } else {
+        fingerprinter = new Fingerprint;
+        FileType type;
+        std::tie(sat, type, protocol) = fingerprinter->file(filename,fingerprinterSuggestion);
+        if (sat == SatID::Unknown) {
+            delete fingerprinter;
+            fingerprinter = nullptr;
+            return;
+        }
         delete fingerprinter;
         fingerprinter = nullptr;
-        return;
-    }
-    delete fingerprinter;
-    fingerprinter = nullptr;
-    SatelliteInfo satellite = satellite_info.at(sat);
 
-    // Decode
-    status->setText(QString("Decoding %1...").arg(QString::fromStdString(filename)));
-    decoder = Decoder::make(protocol, sat);
-    decoder->decodeFile(filename, type);
-    if (clean_up) {
-        sat = SatID::Unknown;
-        delete decoder;
-        decoder = nullptr;
-        return;
-    }
+        // Decode
+        status->setText(QString("Decoding %1...").arg(QString::fromStdString(filename)));
+        decoder = Decoder::make(protocol, sat);
+        decoder->decodeFile(filename, type);
+        if (clean_up) {
+            sat = SatID::Unknown;
+            delete decoder;
+            decoder = nullptr;
+            return;
+        }
 
-    Data data = decoder->get();
+        data = decoder->get();
+        for (auto &sensor_data : data.imagers) imagers.push_back(sensor_data.first);
+    }
+    SatelliteInfo satellite = satellite_info.at(sat);
 
     for (auto action : sensor_actions) {
         sensor_select->removeAction(action.second);
@@ -334,37 +384,35 @@ void MainWindow::startDecode(std::string filename) {
     for (auto compositor : compositors) {
         delete compositor.second;
     }
-    for (auto sensor2 : data.imagers) {
-        SensorInfo info = sensor_info.at(sensor2.first);
+    for (Imager imager : imagers) {
+        SensorInfo info = sensor_info.at(imager);
         QAction *action = new QAction(QString::fromStdString(info.name));
         action->setCheckable(true);
         sensor_actions.insert({info.name, action});
         sensor_select->addAction(action);
         ui->menuSensor->addAction(action);
 
-        compositors[sensor2.first] = new ImageCompositor;
-        compositors[sensor2.first]->ch3a = data.ch3a;
-        compositors[sensor2.first]->import(sensor2.second, sat, sensor2.first, data.caldata, protocol == Protocol::GACReverse);
+        compositors[imager] = new ImageCompositor;
+        compositors[imager]->ch3a = data.ch3a;
+        if (archive.empty()) {
+            compositors[imager]->import(data.imagers.at(imager), sat, imager, data.caldata, protocol == Protocol::GACReverse);
+        } else {
+            compositors[imager]->import(archive, imager, protocol == Protocol::GACReverse);
+        }
         float sum = 0.0;
         for (const bool &x : data.ch3a) {
             sum += x;
         }
-        compositors[sensor2.first]->has_ch3a = (sum / (float)data.ch3a.size() > 0.5f);
+        compositors[imager]->has_ch3a = (sum / (float)data.ch3a.size() > 0.5f);
     }
 
     if (compositors.count(satellite.default_imager)) {
         default_sensor = sensor = satellite.default_imager;
     } else {
-        default_sensor = sensor = (*data.imagers.begin()).first;
+        default_sensor = sensor = imagers.front();
     }
     sensor_actions.at(sensor_info.at(sensor).name)->setChecked(true);
 
-    have_tles = false;
-    if (tle_manager.catalog_by_norad.count((int)sat)) {
-        proj = new Projector(tle_manager.catalog_by_norad[(int)sat]);
-        have_tles = true;
-    }
-
     timestamps = data.timestamps;
 
     // Anomaly detection and interpolation
@@ -378,10 +426,19 @@ void MainWindow::startDecode(std::string filename) {
         timestamp = filter_timestamps(timestamp);
     }
 
+    delete geolocation;
+    geolocation = nullptr;
+    have_tles = false;
+    if (tle_manager.catalog_by_norad.count((int)sat)) {
+        geolocation = new PassGeolocation(tle_manager.catalog_by_norad[(int)sat], sat, timestamps);
+        have_tles = true;
+    }
+
     for (auto &sensor : timestamps) {
+        // Quantized to save memory, the resolution is still far beyond what IR blend or expressions need
         if (have_tles)
             compositors[sensor.first]->sunz =
-                proj->calculate_sunz(sensor.second, sensor.first, sat, compositors[sensor.first]->width());
+                geolocation->sunz(sensor.first, compositors[sensor.first]->width(), SunzBuffer::Format::UInt16);
     }
 
     if (timestamps.count(sensor) && timestamps.at(sensor).size() > 0) {
@@ -389,7 +446,7 @@ void MainWindow::startDecode(std::string filename) {
     }
 
     if (have_tles && timestamps.at(default_sensor).size() > 0) {
-        ui->actionFlip->setChecked(proj->is_northbound(timestamps.at(default_sensor)));
+        ui->actionFlip->setChecked(geolocation->is_northbound(default_sensor));
     }
 
     delete decoder;
@@ -433,7 +490,7 @@ void MainWindow::decodeFinished() {
     ui->actionEnable_Overlay->setChecked(false);
     ui->actionIR_Blend->setChecked(false);
     ui->actionEnable_Map->setChecked(false);
-    ui->actionIR_Blend->setEnabled(compositors.at(sensor)->sunz.size() != 0 && sensor != Imager::MHS && sensor != Imager::MTVZA &&
+    ui->actionIR_Blend->setEnabled(compositors.at(sensor)->has_sunz() && sensor != Imager::MHS && sensor != Imager::MTVZA &&
                                    sensor != Imager::HIRS);
 }
 
@@ -522,16 +579,7 @@ void MainWindow::setComposite(std::array<size_t, 3> channels) {
 void MainWindow::setEqualization(Equalization type) {
     // TODO make it so it doesnt re-apply correction with each equ
     selectedEqualization = type;
-    if (selectedEqualization == Equalization::None) {
-        QImage copy(display);
-        compositors[sensor]->postprocess(copy);
-        updateDisplay();
-    } else {
-        QImage copy(display);
-        ImageCompositor::equalise(copy, selectedEqualization, clip_limit, ui->brightnessOnly->isChecked());
-        compositors[sensor]->postprocess(copy);
-        updateDisplay();
-    }
+    updateDisplay();
 }
 
 void MainWindow::on_actionFlip_triggered() {
@@ -565,7 +613,7 @@ void MainWindow::on_groupProtocol_triggered() {
     // TODO remember the path to the current file instead of asking to reopen it 
 
     QString filename = QFileDialog::getOpenFileName(
-        this, "Open File", "", "Supported formats (*.bin *.cadu *.raw16 *.hrp *.vcdu *.tip *.dec);;All files (*)");
+        this, "Open File", "", "Supported formats (*.bin *.cadu *.raw16 *.hrp *.vcdu *.tip *.dec *.l1a);;All files (*)");
 
     if (!filename.isEmpty()) {
         decodeWatcher->setFuture(QtConcurrent::run([=]() { startDecode(filename.toStdString()); }));
@@ -578,6 +626,11 @@ void MainWindow::on_actionIR_Blend_triggered() {
     updateDisplay();
 }
 
+void MainWindow::on_actionStatistics_triggered() {
+    stats::enable(ui->actionStatistics->isChecked());
+    stats_view->setVisible(ui->actionStatistics->isChecked());
+}
+
 void MainWindow::on_imageTabs_currentChanged(int index) {
     QGraphicsView *tabs[] = {ui->channelView, ui->compositeView, ui->presetView};
     tabs[index]->horizontalScrollBar()->setValue(tabs[previousTabIndex]->horizontalScrollBar()->value());
@@ -587,51 +640,107 @@ void MainWindow::on_imageTabs_currentChanged(int index) {
     updateDisplay();
 }
 
-void MainWindow::get_source(QImage &image) {
-    switch (ui->imageTabs->currentIndex()) {
+MainWindow::DisplaySettings MainWindow::displaySettings() {
+    DisplaySettings settings;
+    settings.sat = sat;
+    settings.sensor = sensor;
+    settings.tab = ui->imageTabs->currentIndex();
+    settings.channel = selectedChannel;
+    settings.composite = selectedComposite;
+    settings.equalization = selectedEqualization;
+    settings.clip_limit = clip_limit;
+    settings.brightness_only = ui->brightnessOnly->isChecked();
+    settings.correct = ui->actionCorrect->isChecked();
+
+    if (settings.tab == 2) {
+        Preset preset = selected_presets.at(ui->presetSelector->currentText().toStdString());
+
+        settings.expression = preset.expression;
+        if (preset.overrides.count(sensor)) {
+            settings.expression = preset.overrides.at(sensor);
+        }
+    }
+
+    return settings;
+}
+
+void MainWindow::get_source(ImageCompositor &compositor, const DisplaySettings &settings, QImage &image, size_t level) {
+    switch (settings.tab) {
         case 0:
-            compositors.at(sensor)->getChannel(image, selectedChannel);
+            compositor.getChannel(image, settings.channel, level);
             break;
         case 1:
-            compositors.at(sensor)->getComposite(image, selectedComposite);
+            compositor.getComposite(image, settings.composite, level);
             break;
-        case 2: {
-            Preset preset = selected_presets.at(ui->presetSelector->currentText().toStdString());
-
-            std::string expression = preset.expression;
-            if (preset.overrides.count(sensor)) {
-                expression = preset.overrides.at(sensor);
-            }
-            compositors.at(sensor)->getExpression(image, expression);
+        case 2:
+            compositor.getExpression(image, settings.expression, level);
             break;
-        }
         default:
             throw std::runtime_error("invalid tab index");
     }
 }
 
-void MainWindow::updateDisplay() {
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    get_source(display);
-    if (selectedEqualization == Equalization::None) {
-        QImage copy(display);
-        compositors[sensor]->postprocess(copy);
-            if (ui->actionCorrect->isChecked()){
-                copy = correct_geometry(copy, sat, sensor, compositors[sensor]->width());
-            }
-        displayQImage(scene, copy);
-    } else {
-        QImage copy(display);
-        ImageCompositor::equalise(copy, selectedEqualization, clip_limit, ui->brightnessOnly->isChecked());
-        compositors[sensor]->postprocess(copy);
-            if (ui->actionCorrect->isChecked()){
-                copy = correct_geometry(copy, sat, sensor, compositors[sensor]->width());
-            }
-        displayQImage(scene, copy);
+MainWindow::DisplayResult MainWindow::renderDisplay(ImageCompositor compositor, const DisplaySettings &settings,
+                                                    size_t generation, size_t level) {
+    DisplayResult abandoned = {generation, level, QImage(), ImagePyramid()};
+
+    // Jobs can sit in the pool for a while, so check before starting as well
+    if (compositor.cancelled()) return abandoned;
+    QImage source;
+    get_source(compositor, settings, source, level);
+    if (compositor.cancelled()) return abandoned;
+
+    QImage image(source);
+    if (settings.equalization != Equalization::None) {
+        ImageCompositor::equalise(image, settings.equalization, settings.clip_limit, settings.brightness_only);
     }
+    if (compositor.cancelled()) return abandoned;
 
-    ui->gradient->setEnabled(display.format() == QImage::Format_Grayscale16);
-    QApplication::restoreOverrideCursor();
+    compositor.postprocess(image, false, level);
+    if (settings.correct) {
+        image = correct_geometry(image, settings.sat, settings.sensor, compositor.width(level));
+    }
+    if (compositor.cancelled()) return abandoned;
+
+    ImagePyramid pyramid(image);
+    if (compositor.cancelled()) return abandoned;
+
+    return {generation, level, source, pyramid};
+}
+
+void MainWindow::showDisplayResult(const DisplayResult &result) {
+    if (result.generation != display_generation || result.image.levels() == 0) return;
+    // The preview lost the race against the full resolution image
+    if (result.level != 0 && displayed_generation == result.generation) return;
+
+    if (result.level == 0) {
+        display = result.source;
+        displayed_generation = result.generation;
+    }
+    display_item->setPyramid(result.image, 1 << result.level);
+    scene->setSceneRect(display_item->boundingRect());
+    ui->gradient->setEnabled(result.source.format() == QImage::Format_Grayscale16);
+}
+
+void MainWindow::updateDisplay() {
+    size_t generation = ++display_generation;
+    DisplaySettings settings = displaySettings();
+    ImageCompositor &compositor = *compositors.at(sensor);
+
+    // Render from a copy so the compositor can keep being modified in the meantime,
+    // the channels themselves are implicitly shared so this is cheap
+    ImageCompositor snapshot(compositor);
+    snapshot.setCancellation([this, generation]() { return display_generation != generation; });
+
+    // Large images get a coarse preview first, which the full resolution image replaces once rendered
+    size_t level = 0;
+    while (level + 1 < compositor.levels() && compositor.width(level) * compositor.height(level) > PREVIEW_PIXELS) {
+        level++;
+    }
+    if (level != 0) {
+        previewWatcher->setFuture(QtConcurrent::run([=]() { return renderDisplay(snapshot, settings, generation, level); }));
+    }
+    displayWatcher->setFuture(QtConcurrent::run([=]() { return renderDisplay(snapshot, settings, generation, 0); }));
 }
 
 QString MainWindow::getDefaultFilename() {
@@ -665,13 +774,14 @@ void MainWindow::saveCurrentImage() {
 
     savingImage = true;
     QApplication::setOverrideCursor(Qt::WaitCursor);
+    DisplaySettings settings = displaySettings();
     QtConcurrent::run(
-        [this](QString filename, bool corrected) {
-            QImage image(compositors[sensor]->width(), compositors[sensor]->height(), QImage::Format_RGBX64);
-            get_source(image);
-            ImageCompositor::equalise(image, selectedEqualization, clip_limit, ui->brightnessOnly->isChecked());
-            compositors[sensor]->postprocess(image, corrected);
-            image.save(filename);
+        [this, settings](QString filename, bool corrected) {
+            QImage image;
+            get_source(*compositors[settings.sensor], settings, image);
+            ImageCompositor::equalise(image, settings.equalization, settings.clip_limit, settings.brightness_only);
+            compositors[settings.sensor]->postprocess(image, corrected);
+            save_image(image, filename);
 
             savingImage = false;
             QApplication::restoreOverrideCursor();
@@ -692,13 +802,13 @@ void MainWindow::saveAllChannels() {
             for (size_t i = 0; i < compositors.at(sensor)->channels(); i++) {
                 status->setText(QString("Saving channel %1...").arg(i + 1));
                 compositors.at(sensor)->getChannel(channel, i + 1);
-                channel.save(QString("%1/%2_%3_%4_%5.png")
-                                 .arg(directory)
-                                 .arg(QString::fromStdString(satellite_info.at(sat).name))
-                                 .arg(QString::fromStdString(sensor_info.at(sensor).name))
-                                 .arg(QDateTime::fromSecsSinceEpoch(pass_timestamp, Qt::UTC).toString("yyyyMMdd-hhmmss"))
-                                 .arg(i + 1),
-                             "PNG");
+                QString filename = QString("%1/%2_%3_%4_%5.png")
+                                       .arg(directory)
+                                       .arg(QString::fromStdString(satellite_info.at(sat).name))
+                                       .arg(QString::fromStdString(sensor_info.at(sensor).name))
+                                       .arg(QDateTime::fromSecsSinceEpoch(pass_timestamp, Qt::UTC).toString("yyyyMMdd-hhmmss"))
+                                       .arg(i + 1);
+                PngWriter::save(channel, filename.toStdString());
             }
 
             status->setText("Done");
@@ -719,10 +829,34 @@ void MainWindow::save_gcp() {
                        .arg(QDateTime::fromSecsSinceEpoch(pass_timestamp, Qt::UTC).toString("yyyyMMdd-hhmmss"));
     QString filename = QFileDialog::getSaveFileName(this, "Save GCP File", name, "GCP (*.gcp)");
     if (filename.isEmpty()) return;
-    double width = compositors[sensor]->width();
-    double height = compositors[sensor]->height();
-    proj->save_gcp_file(timestamps[sensor], (double)height / (double)width * 21.0, 21, sensor, sat, filename.toStdString(),
-                        width);
+    Projector::save_gcp_file(*geolocation->gcps(sensor, compositors[sensor]->width()), filename.toStdString());
+}
+
+void MainWindow::save_geolocation_grid() {
+    if (tle_manager.catalog.size() == 0) {
+        QMessageBox::warning(this, "Error", "No TLEs loaded, cannot save geolocation.", QMessageBox::Ok);
+        return;
+    }
+
+    bool ok;
+    int decimation = QInputDialog::getInt(this, "Save Geolocation Grid", "Geolocate every nth pixel:", 1, 1, 64, 1, &ok);
+    if (!ok) return;
+
+    QString name = QString("%1_%2_%3.geo")
+                       .arg(QString::fromStdString(satellite_info.at(sat).name))
+                       .arg(QString::fromStdString(sensor_info.at(sensor).name))
+                       .arg(QDateTime::fromSecsSinceEpoch(pass_timestamp, Qt::UTC).toString("yyyyMMdd-hhmmss"));
+    QString filename = QFileDialog::getSaveFileName(this, "Save Geolocation Grid", name, "Geolocation Grid (*.geo)");
+    if (filename.isEmpty()) return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    GeolocationGrid grid = geolocation->grid(sensor, compositors[sensor]->width(), decimation);
+    bool saved = grid.latitude.size() != 0 && Projector::save_grid_file(grid, filename.toStdString());
+    QApplication::restoreOverrideCursor();
+
+    if (!saved) {
+        QMessageBox::warning(this, "Error", "Could not save geolocation grid.", QMessageBox::Ok);
+    }
 }
 
 void MainWindow::on_presetSelector_textActivated(QString text) {
@@ -815,14 +949,10 @@ void MainWindow::on_actionEnable_Map_triggered() {
         return;
     }
 
-    size_t yn = (double)compositors[sensor]->height() / (double)compositors[sensor]->width() * 21.0;
-    size_t xn = 21;
-    auto points = proj->calculate_gcps(timestamps[sensor], yn, xn, sensor, sat, compositors[sensor]->width());
-
-    std::vector<QLineF> shapefile = map::read_shapefile(map_shapefile.toStdString());
-    std::array<std::vector<QLineF>, 36 * 18> buckets = map::index_line_segments(shapefile);
+    map::SegmentIndex index = map::load_shapefile(map_shapefile.toStdString());
     compositors[sensor]->map_color = map_color;
-    compositors[sensor]->overlay = map::warp_to_pass(buckets, points, xn);
+    compositors[sensor]->overlay =
+        *geolocation->map_overlay(sensor, compositors[sensor]->width(), map_shapefile.toStdString(), index);
     compositors[sensor]->enable_map = true;
 
     updateDisplay();
@@ -835,13 +965,10 @@ void MainWindow::on_actionEnable_Landmarks_triggered() {
         return;
     }
 
-    size_t yn = (double)compositors[sensor]->height() / (double)compositors[sensor]->width() * 21.0;
-    size_t xn = 21;
-    auto points = proj->calculate_gcps(timestamps[sensor], yn, xn, sensor, sat, compositors[sensor]->width());
-
     std::vector<Landmark> landmarks = map::read_landmarks(landmark_file.toStdString());
     compositors[sensor]->landmark_color = landmark_color;
-    compositors[sensor]->landmarks = map::warp_to_pass(landmarks, points, xn);
+    compositors[sensor]->landmarks =
+        *geolocation->landmarks(sensor, compositors[sensor]->width(), landmark_file.toStdString(), landmarks);
     compositors[sensor]->enable_landmarks = true;
 
     updateDisplay();
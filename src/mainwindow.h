@@ -30,6 +30,7 @@
 #include <QString>
 #include <QUrl>
 #include <array>
+#include <atomic>
 
 #include "config/gradient.h"
 #include "config/preset.h"
@@ -37,8 +38,11 @@
 #include "fingerprint.h"
 #include "image/compositor.h"
 #include "network.h"
+#include "passgeolocation.h"
 #include "projectdialog.h"
 #include "projection.h"
+#include "qt/qstatsview.h"
+#include "qt/qtiledimageitem.h"
 #include "satinfo.h"
 
 QT_BEGIN_NAMESPACE
@@ -64,6 +68,7 @@ Licensed under GPL-3.0.\
 <li><a href=\"https://github.com/beltoforion/muparser\">muparser</a> - Licensed under BSD 2-Clause \"Simplified\"</li>\
 <li><a href=\"https://github.com/la1k/libpredict\">libpredict</a> - Licensed under GPL-2.0</li>\
 <li><a href=\"https://github.com/OSGeo/shapelib\">shapelib</a> - Licensed under GPL-2.0</li>\
+<li><a href=\"https://zlib.net\">zlib</a> - Licensed under the zlib license</li>\
 <li>Parts of <a href=\"https://github.com/Digitelektro/MeteorDemod\">MeteorDemod</a> - Licensed under MIT</li>\
 <li>Parts of <a href=\"https://github.com/airbreather/Gavaghan.Geodesy\">Gavaghan.Geodesy</a> - Public domain</li>\
 </ul>"
@@ -87,6 +92,7 @@ class MainWindow : public QMainWindow {
     std::map<Imager, ImageCompositor *> compositors;
     QImage display;
     QGraphicsScene *scene;
+    QTiledImageItem *display_item;
 
     // Presets
     void reloadPresets();
@@ -109,7 +115,8 @@ class MainWindow : public QMainWindow {
     // Orbit information
     ProjectDialog *project_diag;
     TLEManager tle_manager;
-    Projector *proj;
+    // Only valid if `have_tles` is set
+    PassGeolocation *geolocation = nullptr;
     bool have_tles;
     QColorDialog *color_dialog;
     QColorDialog *landmark_color_dialog;
@@ -135,20 +142,47 @@ class MainWindow : public QMainWindow {
     // Gradients
     GradientManager *gradient_manager;
 
+    // Statistics are only collected while the panel is open
+    QStatsView *stats_view;
+
     // Internal
     void incrementZoom(int amount);
     void startDecode(std::string filename);
     void decodeFinished();
-    void get_source(QImage &image);
     void updateDisplay();
     void populateChannelSelectors(size_t channels);
 
-    // Sets the contents of a QGraphicsScene to a QImage
-    static void displayQImage(QGraphicsScene *scene, QImage &image) {
-        scene->clear();
-        scene->setSceneRect(0, 0, image.width(), image.height());
-        scene->addPixmap(QPixmap::fromImage(image, Qt::NoFormatConversion));
+    // Display rendering, the settings are captured on the GUI thread so rendering can happen on any thread
+    struct DisplaySettings {
+        SatID sat;
+        Imager sensor;
+        int tab;
+        size_t channel;
+        std::array<size_t, 3> composite;
+        std::string expression;
+        Equalization equalization;
+        float clip_limit;
+        bool brightness_only;
+        bool correct;
+    };
+    struct DisplayResult {
+        size_t generation;
+        size_t level;
+        // Both are empty if the job was abandoned, the pyramid is built on the worker so the GUI thread only swaps it in
+        QImage source;
+        ImagePyramid image;
     };
+    // Every display update bumps the generation, jobs from older generations are abandoned
+    std::atomic<size_t> display_generation{0};
+    // Generation of the last full resolution image shown
+    size_t displayed_generation = 0;
+    QFutureWatcher<DisplayResult> *previewWatcher;
+    QFutureWatcher<DisplayResult> *displayWatcher;
+    DisplaySettings displaySettings();
+    void showDisplayResult(const DisplayResult &result);
+    static void get_source(ImageCompositor &compositor, const DisplaySettings &settings, QImage &image, size_t level = 0);
+    static DisplayResult renderDisplay(ImageCompositor compositor, const DisplaySettings &settings, size_t generation,
+                                       size_t level);
 
     // Channel
     void setChannel(int sensor_channel);
@@ -169,6 +203,7 @@ class MainWindow : public QMainWindow {
 
     // GCP Saving
     void save_gcp();
+    void save_geolocation_grid();
     std::map<Imager, std::vector<double>> timestamps;
     double pass_timestamp;
 
@@ -181,6 +216,7 @@ class MainWindow : public QMainWindow {
     void on_actionSave_Current_Image_triggered() { saveCurrentImage(); };
     void on_actionSave_All_Channels_triggered() { saveAllChannels(); };
     void on_actionSave_GCP_File_triggered() { save_gcp(); };
+    void on_actionSave_Geolocation_Grid_triggered() { save_geolocation_grid(); };
     // menuGeo
     void on_actionProjector_triggered() { project_diag->show(); };
     void on_actionMap_Shapefile_triggered();
@@ -193,6 +229,7 @@ class MainWindow : public QMainWindow {
     void on_actionFlip_triggered();
     void on_actionCorrect_triggered();
     void on_actionIR_Blend_triggered();
+    void on_actionStatistics_triggered();
     void on_groupProtocol_triggered();
     // menuHelp
     void on_actionDocumentation_triggered() { QDesktopServices::openUrl(QUrl("https://github.com/Xerbo/LeanHRPT-Decode/wiki")); };
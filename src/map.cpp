@@ -20,15 +20,22 @@
 
 #include <shapefil.h>
 
+#include <QDateTime>
 #include <QFile>
+#include <QFileInfo>
 #include <QPainter>
 #include <QPolygonF>
+#include <QSaveFile>
 #include <QTransform>
-#include <set>
+#include <cmath>
+#include <cstring>
 
 #include "geo/crs.h"
+#include "stats.h"
 #include "util.h"
 
+static stats::Stage project_stage("project");
+
 bool map::verify_shapefile(std::string filename) {
     SHPHandle shapefile = SHPOpen(filename.c_str(), "rb");
     if (shapefile == NULL) {
@@ -93,21 +100,202 @@ std::vector<Landmark> map::read_landmarks(std::string filename) {
     return landmarks;
 }
 
-std::array<std::vector<QLineF>, 36 * 18> map::index_line_segments(const std::vector<QLineF> &line_segments) {
-    std::array<std::vector<QLineF>, 36 * 18> buckets;
+// Round outwards when narrowing so that boxes still contain their segments
+static float round_down(double x) {
+    float f = x;
+    return f > x ? std::nextafter(f, -INFINITY) : f;
+}
+static float round_up(double x) {
+    float f = x;
+    return f < x ? std::nextafter(f, INFINITY) : f;
+}
+
+map::SegmentIndex::SegmentIndex(const std::vector<QLineF> &segments, Source source, size_t node_size) {
+    node_size = std::max<size_t>(node_size, 2);
+    size_t n = segments.size();
+
+    // Sort-Tile-Recursive: sort into vertical slices by x, then sort each slice by y
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    auto center = [&segments](size_t i) { return segments[i].center(); };
+
+    size_t leaves = (n + node_size - 1) / node_size;
+    size_t slices = std::max<size_t>(std::ceil(std::sqrt((double)leaves)), 1);
+    size_t slice_size = node_size * ((leaves + slices - 1) / slices);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return center(a).x() < center(b).x(); });
+    for (size_t i = 0; i < n; i += slice_size) {
+        std::sort(order.begin() + i, order.begin() + std::min(i + slice_size, n),
+                  [&](size_t a, size_t b) { return center(a).y() < center(b).y(); });
+    }
+
+    std::vector<float> lines;
+    std::vector<Box> boxes;
+    std::vector<uint64_t> levels = {0};
+    lines.reserve(n * 4);
+    boxes.reserve(n + n / (node_size - 1) + 1);
+    for (size_t i : order) {
+        const QLineF &line = segments[i];
+        lines.insert(lines.end(), {(float)line.x1(), (float)line.y1(), (float)line.x2(), (float)line.y2()});
+        boxes.push_back({round_down(std::min(line.x1(), line.x2())), round_down(std::min(line.y1(), line.y2())),
+                         round_up(std::max(line.x1(), line.x2())), round_up(std::max(line.y1(), line.y2()))});
+    }
+
+    // Build every level above until there is a single root
+    size_t start = 0;
+    size_t count = n;
+    while (n != 0) {
+        levels.push_back(boxes.size());
+        if (count == 1) break;
+
+        for (size_t i = 0; i < count; i += node_size) {
+            Box box = boxes[start + i];
+            for (size_t j = i + 1; j < std::min(i + node_size, count); j++) {
+                const Box &child = boxes[start + j];
+                box = {std::min(box.x0, child.x0), std::min(box.y0, child.y0), std::max(box.x1, child.x1),
+                       std::max(box.y1, child.y1)};
+            }
+            boxes.push_back(box);
+        }
+
+        start += count;
+        count = boxes.size() - start;
+    }
+    if (n == 0) levels.push_back(0);
+
+    Header header = {};
+    std::memcpy(header.magic, "LHRPTMAP", sizeof(header.magic));
+    header.version = 2;
+    header.node_size = node_size;
+    header.source_size = source.size;
+    header.source_modified = source.modified;
+    header.source_hash = source.hash;
+    header.segments = n;
+    header.boxes = boxes.size();
+    header.levels = levels.size();
+
+    auto buffer = std::make_shared<std::vector<char>>(sizeof(Header) + lines.size() * sizeof(float) +
+                                                      boxes.size() * sizeof(Box) + levels.size() * sizeof(uint64_t));
+    char *ptr = buffer->data();
+    auto write = [&ptr](const void *data, size_t size) {
+        std::memcpy(ptr, data, size);
+        ptr += size;
+    };
+    write(&header, sizeof(Header));
+    write(lines.data(), lines.size() * sizeof(float));
+    write(boxes.data(), boxes.size() * sizeof(Box));
+    write(levels.data(), levels.size() * sizeof(uint64_t));
+
+    attach(buffer, buffer->data(), buffer->size());
+}
+
+bool map::SegmentIndex::attach(std::shared_ptr<const void> storage, const char *data, size_t size) {
+    static_assert(sizeof(Header) == 64, "Header layout changed");
+    static_assert(sizeof(Box) == 4 * sizeof(float), "Box layout changed");
+
+    if (size < sizeof(Header)) return false;
+    const Header *header = (const Header *)data;
+    if (std::memcmp(header->magic, "LHRPTMAP", sizeof(header->magic)) != 0 || header->version != 2 ||
+        header->node_size < 2 || header->levels < 2) {
+        return false;
+    }
+
+    // Everything is naturally aligned as long as the buffer is
+    size_t segments = sizeof(Header);
+    size_t boxes = segments + header->segments * 4 * sizeof(float);
+    size_t levels = boxes + header->boxes * sizeof(Box);
+    if (header->segments > size || header->boxes > size || header->levels > size ||
+        levels + header->levels * sizeof(uint64_t) != size) {
+        return false;
+    }
+
+    // Make sure queries can't go out of bounds
+    const uint64_t *offsets = (const uint64_t *)(data + levels);
+    if (offsets[0] != 0 || offsets[1] != header->segments || offsets[header->levels - 1] != header->boxes) return false;
+    for (size_t i = 1; i < header->levels; i++) {
+        if (offsets[i] < offsets[i - 1]) return false;
+    }
+
+    m_storage = std::move(storage);
+    m_data = data;
+    m_bytes = size;
+    m_header = header;
+    m_segments = (const float *)(data + segments);
+    m_boxes = (const Box *)(data + boxes);
+    m_levels = offsets;
+    return true;
+}
+
+bool map::SegmentIndex::save(const std::string &filename) const {
+    if (m_data == nullptr) return false;
+
+    // Written to a temporary file first so that a partially written index is never opened
+    QSaveFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    if (file.write(m_data, m_bytes) != (qint64)m_bytes) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+map::SegmentIndex map::SegmentIndex::open(const std::string &filename) {
+    auto file = std::make_shared<QFile>(QString::fromStdString(filename));
+    if (!file->open(QIODevice::ReadOnly)) return SegmentIndex();
+
+    // The mapping stays valid for as long as the file is open
+    size_t size = file->size();
+    const char *data = (const char *)file->map(0, size);
+    SegmentIndex index;
+    if (data == nullptr || !index.attach(file, data, size)) return SegmentIndex();
+    return index;
+}
+
+map::SegmentIndex map::index_line_segments(const std::vector<QLineF> &line_segments) { return SegmentIndex(line_segments); }
+
+// 64 bit FNV-1a of a file
+static uint64_t hash_file(const QString &filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return 0;
+
+    uint64_t hash = 0xcbf29ce484222325;
+    std::vector<char> buffer(1024 * 1024);
+    qint64 n;
+    while ((n = file.read(buffer.data(), buffer.size())) > 0) {
+        for (qint64 i = 0; i < n; i++) {
+            hash = (hash ^ (uint8_t)buffer[i]) * 0x100000001b3;
+        }
+    }
 
-    for (const auto &segment : line_segments) {
-        QPointF center = segment.center();
-        int lon = (center.x() + 180) / 10;
-        int lat = (center.y() + 90) / 10;
-        buckets[lat * 36 + lon].push_back(segment);
+    return hash;
+}
+
+map::SegmentIndex map::load_shapefile(std::string filename) {
+    QString shp = QString::fromStdString(filename);
+    QFileInfo info(shp);
+    if (!info.exists()) return SegmentIndex();
+    std::string cache = filename + ".lhmap";
+
+    // Unchanged size and modification time is enough, otherwise fall back to checking the contents
+    // (which catches files that have been copied or touched)
+    SegmentIndex::Source source = {(uint64_t)info.size(), info.lastModified().toMSecsSinceEpoch(), 0};
+    SegmentIndex index = SegmentIndex::open(cache);
+    if (index.source().size == source.size) {
+        if (index.source().modified == source.modified) return index;
+
+        source.hash = hash_file(shp);
+        if (index.source().hash == source.hash) return index;
     }
 
-    return buckets;
+    if (source.hash == 0) source.hash = hash_file(shp);
+    // Drop the mapping before the file is replaced
+    index = SegmentIndex(read_shapefile(filename), source);
+    // Not being able to write the cache (e.g. a read only directory) isn't a problem
+    index.save(cache);
+    return index;
 }
 
-std::vector<QLineF> map::warp_to_pass(const std::array<std::vector<QLineF>, 36 * 18> &buckets,
-                                      const std::vector<std::pair<xy, Geodetic>> &points, size_t xn) {
+std::vector<QLineF> map::warp_to_pass(const SegmentIndex &index, const std::vector<std::pair<xy, Geodetic>> &points,
+                                      size_t xn) {
     std::vector<QLineF> warped;
 
     for (size_t y = 0; y < points.size() / xn - 1; y++) {
@@ -125,29 +313,16 @@ std::vector<QLineF> map::warp_to_pass(const std::array<std::vector<QLineF>, 36 *
             QRectF bounds = geo.boundingRect();
             if (bounds.width() > 180) continue;
 
-            // Find out what "buckets" are required for this polygon
-            std::set<size_t> indices;
-            for (int y = (bounds.top() + 90) / 10; y <= (bounds.bottom() + 90) / 10; y++)
-                for (int x = (bounds.left() + 180) / 10; x <= (bounds.right() + 180) / 10; x++) {
-                    indices.insert(y * 36 + x);
-                }
-
             // Create the transformation
             QTransform trans;
             if (!QTransform::quadToQuad(geo, pixels, trans)) continue;
 
-            // Warp lines within the selected buckets
-            for (size_t indice : indices) {
-                for (size_t i = 0; i < buckets[indice].size(); i++) {
-                    QLineF line = buckets[indice][i];
-
-                    if (geo.containsPoint(line.center(), Qt::OddEvenFill)) {
-                        QPointF p1 = buckets[indice][i].p1();
-                        QPointF p2 = buckets[indice][i].p2();
-                        warped.push_back(QLineF(trans.map(p1), trans.map(p2)));
-                    }
+            // Warp lines that are centered within the polygon
+            index.query(bounds, [&](const QLineF &line) {
+                if (geo.containsPoint(line.center(), Qt::OddEvenFill)) {
+                    warped.push_back(QLineF(trans.map(line.p1()), trans.map(line.p2())));
                 }
-            }
+            });
         }
     }
 
@@ -197,153 +372,475 @@ static QPointF px2r(QPointF x, QSize range) { return QPointF(px2r(x.x(), range.w
 static double r2px(double x, double range) { return x * range - 0.5; }
 static QPointF r2px(QPointF x, QSize range) { return QPointF(r2px(x.x(), range.width()), r2px(x.y(), range.height())); }
 
-QImage map::project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
-                    QRectF bounds) {
-    double xa = bounds.width();
-    double xb = bounds.x();
-    double ya = bounds.height();
-    double yb = bounds.y();
+namespace {
+// Bilinearly sample an RGBA64 image, anything outside of the image or partially transparent is transparent
+inline QRgba64 sample(const uchar *bits, qsizetype stride, int width, int height, double x, double y) {
+    if (!(x >= 0.0 && y >= 0.0 && x <= width - 1 && y <= height - 1)) return QRgba64::fromRgba64(0);
+
+    int x0 = x;
+    int y0 = y;
+    double fx = x - x0;
+    double fy = y - y0;
+    int x1 = fx > 0.0 ? x0 + 1 : x0;
+    int y1 = fy > 0.0 ? y0 + 1 : y0;
+
+    const QRgba64 *a = (const QRgba64 *)(bits + y0 * stride);
+    const QRgba64 *b = (const QRgba64 *)(bits + y1 * stride);
+    double w[4] = {(1.0 - fx) * (1.0 - fy), fx * (1.0 - fy), (1.0 - fx) * fy, fx * fy};
+    QRgba64 p[4] = {a[x0], a[x1], b[x0], b[x1]};
+
+    double c[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < 4; i++) {
+        c[0] += p[i].red() * w[i];
+        c[1] += p[i].green() * w[i];
+        c[2] += p[i].blue() * w[i];
+        c[3] += p[i].alpha() * w[i];
+    }
+    if (std::lround(c[3]) != 65535) return QRgba64::fromRgba64(0);
+
+    return QRgba64::fromRgba64(std::lround(c[0]), std::lround(c[1]), std::lround(c[2]), 65535);
+}
 
-    QImage warped(resolution, QImage::Format_RGBA64);
-    warped.fill(Qt::transparent);
+// Azimuthal equidistant coordinates around a pole, from radians
+inline QPointF azimuthal(double lon, double lat, bool north) {
+    double r = (lat + M_PI_2) / M_PI;
+    if (north) r = 1.0 - r;
+    return QPointF(cos(lon) * r, sin(lon) * r);
+}
 
+// Round a pixel coordinate into range without overflowing on infinities
+inline int clamp_px(double x, int max) { return std::max(0.0, std::min(x, (double)max)); }
+}  // namespace
+
+map::Projection::Projection(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn,
+                            QSize resolution, transform::CRS crs, QRectF bounds)
+    : m_source(image.convertToFormat(QImage::Format_RGBA64)), m_size(resolution), m_crs(crs), m_bounds(bounds) {
     int height = resolution.height();
     int width = resolution.width();
+    if (width == 0 || height == 0 || xn < 2 || points.size() < xn * 2) return;
+
+    bool cylindrical = crs == transform::CRS::Equirectangular || crs == transform::CRS::Mercator;
+    // Output pixels from/to geodetic coordinates in radians
+    auto to_pixel = [&](double lon, double lat) {
+        transform::XY xy = transform::forward(transform::Geo(lon, lat), crs);
+        return QPointF(r2px((xy.x() - bounds.x()) / bounds.width(), width),
+                       r2px((xy.y() - bounds.y()) / bounds.height(), height));
+    };
+    // How far to move a cell to draw it 360 degrees to the west
+    m_wrap = width / bounds.width();
+    m_copies = cylindrical ? 2 : 1;
+
+    size_t yn = points.size() / xn;
+    m_cells.resize((yn - 1) * (xn - 1));
 
 #pragma omp parallel for
-    for (size_t y = 0; y < points.size() / xn - 1; y++) {
+    for (size_t y = 0; y < yn - 1; y++) {
         for (size_t x = 0; x < xn - 1; x++) {
+            Cell &cell = m_cells[y * (xn - 1) + x];
+
             //                     top left      top right     bottom right  bottom left
             size_t vertices[4] = {(y + 0) * xn + x + 0, (y + 0) * xn + x + 1, (y + 1) * xn + x + 1, (y + 1) * xn + x + 0};
 
             QPolygonF px, geo;
             for (size_t vertex : vertices) {
-                geo << QPointF(points[vertex].second.longitude * RAD2DEG, points[vertex].second.latitude * RAD2DEG);
+                geo << QPointF(points[vertex].second.longitude, points[vertex].second.latitude);
                 px << QPointF(points[vertex].first.first, points[vertex].first.second);
             }
 
             // West/east unwrapping
-            if (geo.boundingRect().width() > 180.0) {
+            if (geo.boundingRect().width() > M_PI) {
                 for (size_t i = 0; i < 4; i++) {
-                    if (geo[i].x() < 0.0) geo[i].rx() += 360.0;
+                    if (geo[i].x() < 0.0) geo[i].rx() += 2.0 * M_PI;
                 }
             }
-            QRectF bounds = geo.boundingRect();
-
-            // Project as rectangular for non polar regions
-            if (fabs(bounds.center().y()) < 88.0) {
-                // Create the transformation
-                QTransform trans;
-                if (!QTransform::quadToQuad(geo, px, trans)) continue;
+            QRectF rect = geo.boundingRect();
+            double center = rect.center().y() * RAD2DEG;
+            bool north = center > 0.0;
+
+            // Cells far from the center of a polar projection are heavily curved, so they are drawn like the poles
+            // of cylindrical projections
+            bool far_side = (crs == transform::CRS::North_Polar && !north) || (crs == transform::CRS::South_Polar && north);
+            bool far = far_side && rect.width() > 4.0 * DEG2RAD;
+            for (QPointF corner : geo) cell.polar_quad << azimuthal(corner.x(), corner.y(), north);
+            bool pole = cell.polar_quad.containsPoint(QPointF(0.0, 0.0), Qt::OddEvenFill);
+            if (far_side && pole) far = true;
+
+            // Map straight from output pixels, apart from near the poles of cylindrical projections
+            if (cylindrical ? fabs(center) < 88.0 : !far) {
+                QPolygonF quad;
+                for (size_t i = 0; i < 4; i++) {
+                    cell.corners[i] = to_pixel(geo[i].x(), geo[i].y());
+                    quad << cell.corners[i];
+                }
 
-                // Fill all pixels
-                for (int i = r2px((bounds.top() - yb) / ya, height); i < r2px((bounds.bottom() - yb) / ya, height); i++)
-                    for (int j = r2px((bounds.left() - xb) / xa, width); j < r2px((bounds.right() - xb) / xa, width); j++) {
-                        if (i < 0 || i > height || j < 0 || j > width * 2) break;
+                QRectF box = quad.boundingRect();
+                if (std::isfinite(box.width()) && std::isfinite(box.height()) &&
+                    QTransform::quadToQuad(quad, px, cell.trans)) {
+                    cell.direct = true;
+                    cell.top = clamp_px(std::ceil(box.top()), height);
+                    cell.bottom = clamp_px(std::ceil(box.bottom()), height);
+                }
+            }
 
-                        QPointF point(px2r(j, width) * xa + xb, px2r(i, height) * ya + yb);
-                        if (geo.containsPoint(point, Qt::OddEvenFill)) {
-                            QPointF pixel = trans.map(point);
-                            QPoint out(j % width, (height - 1) - i);
+            if (cylindrical ? fabs(center) > 86.0 : far) {
+                cell.north = north;
+                if (!QTransform::quadToQuad(cell.polar_quad, px, cell.polar_trans)) continue;
+                cell.polar = true;
 
-                            warped.setPixelColor(out, lerp2(image, pixel));
-                        }
+                // Distance of the cell from the pole, edges are straight in polar coordinates so the closest
+                // point can be in the middle of an edge
+                double inner = 1.0;
+                double outer = 0.0;
+                for (size_t i = 0; i < 4; i++) {
+                    QPointF a = cell.polar_quad[i];
+                    QPointF b = cell.polar_quad[(i + 1) % 4];
+                    QPointF d = b - a;
+                    double t = std::max(0.0, std::min(1.0, -QPointF::dotProduct(a, d) / QPointF::dotProduct(d, d)));
+                    QPointF closest = a + d * t;
+                    inner = std::min(inner, std::hypot(closest.x(), closest.y()));
+                    outer = std::max(outer, std::hypot(a.x(), a.y()));
+                }
+                if (pole) inner = 0.0;
+                double low = north ? 90.0 - outer * 180.0 : inner * 180.0 - 90.0;
+                double high = north ? 90.0 - inner * 180.0 : outer * 180.0 - 90.0;
+                // Without the pole, the cell spans the same longitudes as its corners
+                bool everywhere = pole || rect.width() >= M_PI;
+
+                if (cylindrical) {
+                    // Only within 4 degrees of the pole, rows only depend on latitude and columns only on longitude
+                    low = north ? std::max(low, 86.0) : low;
+                    high = north ? high : std::min(high, -86.0);
+                    cell.polar_top = clamp_px(std::ceil(to_pixel(0.0, high * DEG2RAD).y()), height);
+                    cell.polar_bottom = clamp_px(std::ceil(to_pixel(0.0, low * DEG2RAD).y()), height);
+                    cell.polar_left = everywhere ? NAN : to_pixel(rect.left(), 0.0).x();
+                    cell.polar_right = everywhere ? NAN : to_pixel(rect.right(), 0.0).x();
+                } else {
+                    // Bounding box of the outline of the cell in the output
+                    double west = everywhere ? -M_PI : rect.left();
+                    double east = everywhere ? M_PI : rect.right();
+                    QPolygonF outline;
+                    for (size_t i = 0; i <= 128; i++) {
+                        double lon = west + (east - west) * i / 128.0;
+                        outline << to_pixel(lon, low * DEG2RAD) << to_pixel(lon, high * DEG2RAD);
                     }
+                    QRectF box = outline.boundingRect();
+                    cell.polar_top = clamp_px(std::floor(box.top()) - 1.0, height);
+                    cell.polar_bottom = clamp_px(std::ceil(box.bottom()) + 2.0, height);
+                    cell.polar_left = std::floor(box.left()) - 1.0;
+                    cell.polar_right = std::ceil(box.right()) + 2.0;
+                }
             }
+        }
+    }
+}
 
-            // Project as azimuthal equidistant for polar regions
-            // This is less efficient as every pixel has to be checked
-            if (fabs(bounds.center().y()) > 86.0) {
-                bool north = bounds.center().y() > 0.0;
+transform::Geo map::Projection::to_geo(int x, int y) const {
+    double width = m_size.width();
+    double height = m_size.height();
+    return transform::reverse(transform::XY(px2r(x, width) * m_bounds.width() + m_bounds.x(),
+                                            px2r(y, height) * m_bounds.height() + m_bounds.y()),
+                              m_crs);
+}
+
+template <typename F>
+void map::Projection::rasterize(int top, int bottom, F pixel) const {
+    int width = m_size.width();
+    double wrap = m_wrap;
+    size_t copies = m_copies;
+
+    for (const Cell &cell : m_cells) {
+        if (cell.direct && cell.top < bottom && cell.bottom > top) {
+            const QTransform &t = cell.trans;
 
-                // Convert to azimuthal equidistant
-                QPolygonF polar;
+            for (int y = std::max(cell.top, top); y < std::min(cell.bottom, bottom); y++) {
+                // Where the center of this row crosses the edges of the cell
+                double crossings[4];
+                size_t n = 0;
                 for (size_t i = 0; i < 4; i++) {
-                    double lon = geo[i].x() * DEG2RAD;
-                    double lat = (geo[i].y() + 90.0) / 180.0;
-                    if (north) lat = 1.0 - lat;
+                    QPointF a = cell.corners[i];
+                    QPointF b = cell.corners[(i + 1) % 4];
+                    if ((a.y() <= y) != (b.y() <= y)) {
+                        crossings[n++] = a.x() + (y - a.y()) * (b.x() - a.x()) / (b.y() - a.y());
+                    }
+                }
+                std::sort(crossings, crossings + n);
+
+                // Spans between pairs of crossings are inside the cell (even-odd rule). Unwrapped cells
+                // also cover the west of the image, 360 degrees along
+                for (size_t i = 0; i + 1 < n; i += 2) {
+                    for (size_t copy = 0; copy < copies; copy++) {
+                        double shift = copy * wrap;
+                        if (copy == 1 && crossings[i + 1] < width - 0.5) continue;
+
+                        int x0 = std::max((int)std::ceil(crossings[i] - shift), 0);
+                        int x1 = std::min((int)std::ceil(crossings[i + 1] - shift), width);
+                        if (x0 >= x1) continue;
+
+                        // Walk the span incrementally in homogeneous coordinates
+                        double u = t.m11() * (x0 + shift) + t.m21() * y + t.dx();
+                        double v = t.m12() * (x0 + shift) + t.m22() * y + t.dy();
+                        double w = t.m13() * (x0 + shift) + t.m23() * y + t.m33();
+
+                        for (int x = x0; x < x1; x++) {
+                            pixel(x, y, u / w, v / w);
+                            u += t.m11();
+                            v += t.m12();
+                            w += t.m13();
+                        }
+                    }
+                }
+            }
+        }
 
-                    polar << QPointF(cos(lon) * lat, sin(lon) * lat);
+        // Polar cells are only a few degrees tall, so each pixel within their bounds is just checked
+        if (cell.polar && cell.polar_top < bottom && cell.polar_bottom > top) {
+            for (int y = std::max(cell.polar_top, top); y < std::min(cell.polar_bottom, bottom); y++) {
+                for (size_t copy = 0; copy < copies; copy++) {
+                    double shift = copy * wrap;
+                    bool everywhere = std::isnan(cell.polar_left);
+                    int x0 = everywhere ? 0 : clamp_px(std::ceil(cell.polar_left - shift), width);
+                    int x1 = everywhere ? width : clamp_px(std::ceil(cell.polar_right - shift), width);
+
+                    for (int x = x0; x < x1; x++) {
+                        transform::Geo geo = to_geo(x, y);
+                        QPointF point = azimuthal(geo.x(), geo.y(), cell.north);
+                        if (cell.polar_quad.containsPoint(point, Qt::OddEvenFill)) {
+                            QPointF source = cell.polar_trans.map(point);
+                            pixel(x, y, source.x(), source.y());
+                        }
+                    }
+                    if (everywhere) break;
                 }
+            }
+        }
+    }
+}
 
-                // Create the transformation
-                QTransform trans;
-                if (!QTransform::quadToQuad(polar, px, trans)) continue;
+void map::Projection::render(QImage &strip, int top) const {
+    stats::Timer timer(project_stage);
+    timer.bytes(strip.sizeInBytes());
+    strip.fill(Qt::transparent);
+    int bottom = std::min(top + strip.height(), m_size.height());
+
+    const QImage &source = m_source;
+    const uchar *src = source.constBits();
+    qsizetype src_stride = source.bytesPerLine();
+    uchar *dst = strip.bits();
+    qsizetype dst_stride = strip.bytesPerLine();
+
+    // Each band of output rows is only ever written by one thread, within a band cells are drawn in order
+    const int band_size = 16;
+    int bands = (bottom - top + band_size - 1) / band_size;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < bands; band++) {
+        int band_top = top + band * band_size;
+        int band_bottom = std::min(band_top + band_size, bottom);
+
+        rasterize(band_top, band_bottom, [&](int x, int y, double u, double v) {
+            QRgba64 *out = (QRgba64 *)(dst + (y - top) * dst_stride);
+            out[x] = sample(src, src_stride, source.width(), source.height(), u, v);
+        });
+    }
+}
 
-                int offset = north ? 86 : -90;
-                for (int i = r2px((offset - yb) / ya, height); i < r2px(((offset + 4) - yb) / ya, height); i++)
-                    for (int j = r2px((-180 - xb) / xa, width); j < r2px((180 - xb) / xa, width); j++) {
-                        if (i < 0 || i > height || j < 0 || j > width) break;
+QImage map::Projection::render() const {
+    QImage image(m_size, QImage::Format_RGBA64);
+    render(image, 0);
+    return image;
+}
 
-                        double lon = px2r(j, width) * xa + xb;
-                        double lat = px2r(i, height) * ya + yb;
-                        lon *= DEG2RAD;
-                        lat = (lat + 90.0) / 180.0;
-                        if (north) lat = 1.0 - lat;
+QImage map::project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
+                    transform::CRS crs, QRectF bounds) {
+    return Projection(image, points, xn, resolution, crs, bounds).render();
+}
 
-                        QPointF point(cos(lon) * lat, sin(lon) * lat);
-                        if (polar.containsPoint(point, Qt::OddEvenFill)) {
-                            QPointF pixel = trans.map(point);
-                            QPoint out(j, (height - 1) - i);
+map::Mosaic::Mosaic(QSize resolution, transform::CRS crs, QRectF bounds, Rule rule)
+    : m_size(resolution), m_crs(crs), m_bounds(bounds), m_rule(rule) {}
+
+void map::Mosaic::add(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, double timestamp,
+                      const std::vector<float> &satz) {
+    Pass pass;
+    pass.projection.reset(new Projection(image, points, xn, m_size, m_crs, m_bounds));
+    pass.timestamp = timestamp;
+
+    if (m_rule == Rule::Zenith && satz.size() == (size_t)image.width()) {
+        pass.score = satz;
+    } else if (m_rule != Rule::Newest) {
+        // Distance from the center of the scan, 0 to 1
+        double center = (image.width() - 1) / 2.0;
+        pass.score.resize(image.width());
+        for (int x = 0; x < image.width(); x++) {
+            pass.score[x] = std::abs(x - center) / std::max(center, 1.0);
+        }
+        // On the same scale as zenith angles, assuming a typical 55 degree scan
+        if (m_rule == Rule::Zenith) {
+            for (float &score : pass.score) score *= 68.0f;
+        }
+    }
 
-                            warped.setPixelColor(out, lerp2(image, pixel));
-                        }
-                    }
-            }
+    m_passes.push_back(std::move(pass));
+}
+
+void map::Mosaic::render(QImage &strip, int top) const {
+    stats::Timer timer(project_stage);
+    timer.bytes(strip.sizeInBytes());
+    strip.fill(Qt::transparent);
+    int width = m_size.width();
+    int bottom = std::min(top + strip.height(), m_size.height());
+    if (bottom <= top) return;
+
+    uchar *dst = strip.bits();
+    qsizetype dst_stride = strip.bytesPerLine();
+    std::vector<float> scores((size_t)(bottom - top) * width, INFINITY);
+
+    double newest = -INFINITY;
+    for (const Pass &pass : m_passes) newest = std::max(newest, pass.timestamp);
+
+    // Same banding as `Projection::render()`, every pass is drawn into a band before moving onto the next one
+    const int band_size = 16;
+    int bands = (bottom - top + band_size - 1) / band_size;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < bands; band++) {
+        int band_top = top + band * band_size;
+        int band_bottom = std::min(band_top + band_size, bottom);
+
+        for (const Pass &pass : m_passes) {
+            const QImage &source = pass.projection->m_source;
+            const uchar *src = source.constBits();
+            qsizetype src_stride = source.bytesPerLine();
+            float age = newest - pass.timestamp;
+
+            pass.projection->rasterize(band_top, band_bottom, [&](int x, int y, double u, double v) {
+                float score = pass.score.empty() ? age : pass.score[clamp_px(std::lround(u), source.width() - 1)];
+                float &best = scores[(size_t)(y - top) * width + x];
+                if (!(score < best)) return;
+
+                QRgba64 value = sample(src, src_stride, source.width(), source.height(), u, v);
+                if (value.alpha() == 0) return;
+
+                ((QRgba64 *)(dst + (y - top) * dst_stride))[x] = value;
+                best = score;
+            });
         }
     }
+}
 
-    return warped;
+QImage map::Mosaic::render() const {
+    QImage image(m_size, QImage::Format_RGBA64);
+    render(image, 0);
+    return image;
 }
 
-void map::add_overlay(QImage &image, std::vector<QLineF> &line_segments, QColor color, transform::CRS crs, QRectF bounds) {
+std::vector<QLineF> map::overlay_lines(const SegmentIndex &line_segments, transform::CRS crs, QRectF bounds, QSize size) {
     double xa = bounds.width();
     double xb = bounds.x();
     double ya = bounds.height();
     double yb = bounds.y();
+    QRect rect(QPoint(0, 0), size);
 
-    QPainter painter(&image);
-    painter.setPen(color);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    for (const QLineF &line : line_segments) {
+    std::vector<QLineF> lines;
+    for (size_t i = 0; i < line_segments.size(); i++) {
+        QLineF line = line_segments.segment(i);
         QPointF p1 = transform::forward(deg2rad(line.p1()), crs);
         QPointF p2 = transform::forward(deg2rad(line.p2()), crs);
 
-        p1.rx() = r2px((p1.x() - xb) / xa, image.width());
-        p2.rx() = r2px((p2.x() - xb) / xa, image.width());
-        p1.ry() = r2px((p1.y() - yb) / ya, image.height());
-        p2.ry() = r2px((p2.y() - yb) / ya, image.height());
+        p1.rx() = r2px((p1.x() - xb) / xa, size.width());
+        p2.rx() = r2px((p2.x() - xb) / xa, size.width());
+        p1.ry() = r2px((p1.y() - yb) / ya, size.height());
+        p2.ry() = r2px((p2.y() - yb) / ya, size.height());
 
-        if (image.rect().contains(p1.toPoint()) && image.rect().contains(p2.toPoint())) {
-            painter.drawLine(p1, p2);
+        if (rect.contains(p1.toPoint()) && rect.contains(p2.toPoint())) {
+            lines.push_back(QLineF(p1, p2));
         }
     }
+
+    return lines;
+}
+
+void map::add_overlay(QImage &strip, const std::vector<QLineF> &lines, QColor color, int top) {
+    QPainter painter(&strip);
+    painter.setPen(color);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(0, -top);
+
+    // Allow for antialiasing
+    double low = top - 1.0;
+    double high = top + strip.height() + 1.0;
+    for (const QLineF &line : lines) {
+        if (std::max(line.y1(), line.y2()) < low || std::min(line.y1(), line.y2()) > high) continue;
+        painter.drawLine(line);
+    }
 }
 
-void map::add_landmarks(QImage &image, const std::vector<Landmark> &landmarks, QColor color, transform::CRS crs, QRectF bounds) {
+void map::add_overlay(QImage &image, const SegmentIndex &line_segments, QColor color, transform::CRS crs, QRectF bounds) {
+    add_overlay(image, overlay_lines(line_segments, crs, bounds, image.size()), color, 0);
+}
+
+void map::add_landmarks(QImage &strip, const std::vector<Landmark> &landmarks, QColor color, transform::CRS crs, QRectF bounds,
+                        QSize size, int top) {
     double xa = bounds.width();
     double xb = bounds.x();
     double ya = bounds.height();
     double yb = bounds.y();
 
-    QPainter painter(&image);
+    QPainter painter(&strip);
     painter.setBrush(QBrush(color, Qt::SolidPattern));
     painter.setPen(color);
     painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(0, -top);
     QFont font = painter.font();
     font.setPixelSize(10);
     painter.setFont(font);
 
     for (const Landmark &landmark : landmarks) {
         QPointF p1 = transform::forward(deg2rad(landmark.geo), crs);
-        p1.rx() = r2px((p1.x() - xb) / xa, image.width());
-        p1.ry() = r2px((p1.y() - yb) / ya, image.height());
+        p1.rx() = r2px((p1.x() - xb) / xa, size.width());
+        p1.ry() = r2px((p1.y() - yb) / ya, size.height());
+        if (p1.y() + 250 < top || p1.y() > top + strip.height()) continue;
 
         painter.drawText(p1.x() - 500, p1.y(), 1000, 250, Qt::AlignHCenter, landmark.text);
     }
 }
 
+void map::add_landmarks(QImage &image, const std::vector<Landmark> &landmarks, QColor color, transform::CRS crs, QRectF bounds) {
+    add_landmarks(image, landmarks, color, crs, bounds, image.size(), 0);
+}
+
+// `Projection` and `Mosaic` render the same way
+template <typename T>
+static bool write_strips_of(const T &output, const map::StripOverlays &overlays, StripWriter &writer) {
+    QSize size = output.size();
+
+    const size_t strip_bytes = 64 * 1024 * 1024;
+    int rows = std::max<int>(strip_bytes / (size.width() * sizeof(QRgba64)), 16);
+    QImage strip(size.width(), std::min(rows, size.height()), QImage::Format_RGBA64);
+
+    for (int top = 0; top < size.height(); top += rows) {
+        if (top + strip.height() > size.height()) {
+            strip = QImage(size.width(), size.height() - top, QImage::Format_RGBA64);
+        }
+
+        output.render(strip, top);
+        if (!overlays.lines.empty()) map::add_overlay(strip, overlays.lines, overlays.map_color, top);
+        if (!overlays.landmarks.empty()) {
+            map::add_landmarks(strip, overlays.landmarks, overlays.landmark_color, output.crs(), output.bounds(), size, top);
+        }
+        if (!writer.write(strip)) return false;
+    }
+
+    return writer.close();
+}
+
+bool map::write_strips(const Projection &projection, const StripOverlays &overlays, StripWriter &writer) {
+    return write_strips_of(projection, overlays, writer);
+}
+
+bool map::write_strips(const Mosaic &mosaic, const StripOverlays &overlays, StripWriter &writer) {
+    return write_strips_of(mosaic, overlays, writer);
+}
+
 QRectF map::bounds(const std::vector<std::pair<xy, Geodetic>> &points) {
     QPointF min(180, 90);
     QPointF max(-180, -90);
@@ -373,44 +870,3 @@ QRectF map::bounds_crs(const std::vector<std::pair<xy, Geodetic>> &points, trans
 
     return QRectF(min, max);
 }
-
-QImage map::reproject(const QImage &image, transform::CRS crs, QRectF source_bounds, QRectF target_bounds) {
-    if (crs == transform::CRS::Equirectangular) {
-        return image;
-    }
-
-    double xa = source_bounds.width() * DEG2RAD;
-    double xb = source_bounds.x() * DEG2RAD;
-    double ya = source_bounds.height() * DEG2RAD;
-    double yb = source_bounds.y() * DEG2RAD;
-    double xa2 = target_bounds.width();
-    double xb2 = target_bounds.x();
-    double ya2 = target_bounds.height();
-    double yb2 = target_bounds.y();
-
-    QImage projected(image.width(), image.width() * (double)target_bounds.height() / (double)target_bounds.width(),
-                     image.format());
-    projected.fill(Qt::transparent);
-
-#pragma omp parallel for
-    for (size_t y = 0; y < (size_t)projected.height(); y++) {
-        for (size_t x = 0; x < (size_t)projected.width(); x++) {
-            double x2 = px2r(x, projected.width()) * xa2 + xb2;
-            double y2 = px2r(y, projected.height()) * ya2 + yb2;
-            transform::Geo point = transform::reverse(transform::XY(x2, y2), crs);
-
-            point.rx() = (point.x() - xb) / xa;
-            point.ry() = (point.y() - yb) / ya;
-            point.rx() = point.x() * M_PI * 2.0 - M_PI;
-            point.ry() = point.y() * M_PI - M_PI_2;
-            point = transform::forward(point, transform::CRS::Equirectangular);
-            point.rx() = r2px(point.x(), image.width());
-            point.ry() = r2px(point.y(), image.height());
-            if (point.x() > 0 && point.x() < image.width() - 1 && point.y() > 0 && point.y() < image.height() - 1) {
-                projected.setPixelColor(x, y, lerp2(image, point));
-            }
-        }
-    }
-
-    return projected;
-}
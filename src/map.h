@@ -21,11 +21,18 @@
 
 #include <QImage>
 #include <QLineF>
+#include <QPolygonF>
+#include <QRectF>
+#include <QTransform>
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "geo/crs.h"
+#include "image/stripwriter.h"
 #include "projection.h"
 
 struct Landmark {
@@ -34,6 +41,110 @@ struct Landmark {
 };
 
 namespace map {
+/**
+ * A packed R-tree of line segments
+ *
+ * Built bottom up with Sort-Tile-Recursive packing, so every node (apart from
+ * the last on each level) is full and the whole tree is stored in flat
+ * arrays. Level 0 holds the bounding box of every segment, every level above
+ * holds the bounding boxes of `node_size` nodes from the level below.
+ *
+ * The index lives in a single buffer which is also its file format: a 64
+ * byte header, the segments (4 float32 each, in the same order as level 0),
+ * the bounding boxes (4 float32 each, rounded outwards) and the offset of
+ * every level (uint64). Saved indexes are memory mapped when opened, so
+ * loading them doesn't copy or parse anything. Copies share the buffer.
+ */
+class SegmentIndex {
+   public:
+    struct Box {
+        float x0, y0, x1, y1;
+        bool intersects(const QRectF &rect) const {
+            return x0 <= rect.right() && x1 >= rect.left() && y0 <= rect.bottom() && y1 >= rect.top();
+        }
+    };
+    /// What the index was built from, used to check if a saved index is out of date
+    struct Source {
+        uint64_t size;
+        int64_t modified;
+        uint64_t hash;
+    };
+
+    SegmentIndex() = default;
+    SegmentIndex(const std::vector<QLineF> &segments, Source source = {0, 0, 0}, size_t node_size = 16);
+
+    /// Call `callback` with every segment whose bounding box overlaps `rect`
+    template <typename F>
+    void query(const QRectF &rect, F callback) const {
+        if (size() == 0) return;
+
+        // (level, node) pairs
+        std::vector<std::pair<size_t, size_t>> stack;
+        size_t top = m_header->levels - 2;
+        for (size_t i = 0; i < level_size(top); i++) {
+            stack.push_back({top, i});
+        }
+
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            if (!m_boxes[m_levels[node.first] + node.second].intersects(rect)) continue;
+
+            if (node.first == 0) {
+                callback(segment(node.second));
+                continue;
+            }
+
+            size_t end = std::min((node.second + 1) * m_header->node_size, level_size(node.first - 1));
+            for (size_t i = node.second * m_header->node_size; i < end; i++) {
+                stack.push_back({node.first - 1, i});
+            }
+        }
+    }
+
+    /// Number of segments
+    size_t size() const { return m_header ? m_header->segments : 0; }
+    /// Get a segment, the order has no meaning
+    QLineF segment(size_t i) const {
+        return QLineF(m_segments[i * 4], m_segments[i * 4 + 1], m_segments[i * 4 + 2], m_segments[i * 4 + 3]);
+    }
+    Source source() const {
+        return m_header ? Source{m_header->source_size, m_header->source_modified, m_header->source_hash} : Source();
+    }
+
+    /// Save the index
+    bool save(const std::string &filename) const;
+    /// Open (memory map) a saved index, the index is empty if it fails
+    static SegmentIndex open(const std::string &filename);
+
+   private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_size;
+        uint64_t source_size;
+        int64_t source_modified;
+        uint64_t source_hash;
+        uint64_t segments;
+        uint64_t boxes;
+        uint64_t levels;
+    };
+
+    // Point into a buffer, checking that it is valid
+    bool attach(std::shared_ptr<const void> storage, const char *data, size_t size);
+    size_t level_size(size_t level) const { return m_levels[level + 1] - m_levels[level]; }
+
+    // Keeps the buffer alive (a vector or a memory mapped file)
+    std::shared_ptr<const void> m_storage;
+    const char *m_data = nullptr;
+    size_t m_bytes = 0;
+    const Header *m_header = nullptr;
+    const float *m_segments = nullptr;
+    const Box *m_boxes = nullptr;
+    // Offset of every level in `m_boxes`, followed by the total number of boxes
+    const uint64_t *m_levels = nullptr;
+};
+
 // Checks that a Shapefile is readable and supported (Polyline/Polygon)
 bool verify_shapefile(std::string filename);
 
@@ -42,24 +153,174 @@ std::vector<QLineF> read_shapefile(std::string filename);
 // Read a landmark CSV file
 std::vector<Landmark> read_landmarks(std::string filename);
 
-// Sort line segments into 10x10 "buckets"
-std::array<std::vector<QLineF>, 36 * 18> index_line_segments(const std::vector<QLineF> &line_segments);
+// Build a spatial index of line segments
+SegmentIndex index_line_segments(const std::vector<QLineF> &line_segments);
+/**
+ * Read and index a Shapefile
+ *
+ * The index is compiled into a file next to the Shapefile (`.lhmap`) and
+ * memory mapped on later calls, as long as the Shapefile hasn't changed.
+ */
+SegmentIndex load_shapefile(std::string filename);
 
 // Warp an (indexed) map to fit a pass based off a point grid
-std::vector<QLineF> warp_to_pass(const std::array<std::vector<QLineF>, 36 * 18> &buckets,
-                                 const std::vector<std::pair<xy, Geodetic>> &points, size_t xn);
+std::vector<QLineF> warp_to_pass(const SegmentIndex &index, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn);
 std::vector<Landmark> warp_to_pass(const std::vector<Landmark> &landmarks, const std::vector<std::pair<xy, Geodetic>> &points,
                                    size_t xn);
 
-// Project a pass into Rectangular projection
-QImage project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
-               QRectF bounds);
+/**
+ * Projects a pass straight into a CRS
+ *
+ * Every cell of the point grid is rasterized directly into the output, there
+ * is no intermediate equirectangular image. The output can be rendered in
+ * horizontal strips, so images far larger than memory can be streamed to disk.
+ */
+class Projection {
+   public:
+    /// @param bounds Bounds of the output in the XY space of `crs` (see `bounds_crs()`)
+    Projection(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
+               transform::CRS crs, QRectF bounds);
+
+    /// Render output rows starting at `top` into `strip`, which has to be RGBA64 and as wide as the output
+    void render(QImage &strip, int top) const;
+    /// Render the entire output
+    QImage render() const;
+    /// Size of the output
+    QSize size() const { return m_size; }
+    transform::CRS crs() const { return m_crs; }
+    QRectF bounds() const { return m_bounds; }
 
-QImage reproject(const QImage &image, transform::CRS crs, QRectF source_bounds, QRectF target_bounds);
+   private:
+    friend class Mosaic;
 
-// Render a map overlay on an image with Rectangular projection
-void add_overlay(QImage &image, std::vector<QLineF> &line_segments, QColor color, transform::CRS crs, QRectF bounds);
+    // A cell of the GCP grid, prepared for rasterization
+    struct Cell {
+        // Corners in output pixels, scanned with the even-odd rule
+        std::array<QPointF, 4> corners;
+        // Maps output pixels to source image pixels
+        QTransform trans;
+        bool direct = false;
+        // Output rows covered, [top, bottom)
+        int top, bottom;
+
+        // Cells at the poles of cylindrical projections (or the far side of polar ones) are mapped through
+        // azimuthal equidistant coordinates
+        bool polar = false;
+        bool north;
+        QPolygonF polar_quad;
+        QTransform polar_trans;
+        int polar_top, polar_bottom;
+        // Columns covered (before wrapping), NaN if every column is
+        double polar_left, polar_right;
+    };
+
+    // Geodetic coordinates (in radians) of the center of an output pixel
+    transform::Geo to_geo(int x, int y) const;
+    // Call `pixel(x, y, u, v)` for every output pixel in rows [top, bottom) covered by the pass, with the source image
+    // coordinates it maps to. Cells are visited in order, so later cells overwrite earlier ones
+    template <typename F>
+    void rasterize(int top, int bottom, F pixel) const;
+
+    QImage m_source;
+    QSize m_size;
+    transform::CRS m_crs;
+    QRectF m_bounds;
+    std::vector<Cell> m_cells;
+    // How far to move a cell to draw it 360 degrees to the west, and if that is needed at all
+    double m_wrap = 0.0;
+    size_t m_copies = 1;
+};
+
+/**
+ * Projects several passes into the same output
+ *
+ * Every pass is rasterized like a `Projection` and each output pixel is taken
+ * from whichever pass covering it scores best by the selected `Rule`. Passes
+ * are drawn one after another into each band of rows, so the only memory
+ * needed beyond the source images is a score per pixel of the strip being
+ * rendered.
+ */
+class Mosaic {
+   public:
+    enum class Rule {
+        /// Closest to the center of the scan
+        Nadir,
+        /// Lowest satellite zenith angle, same as `Nadir` for passes without one
+        Zenith,
+        /// Most recent pass
+        Newest,
+    };
+
+    /// @param bounds Bounds of the output in the XY space of `crs` (see `bounds_crs()`)
+    Mosaic(QSize resolution, transform::CRS crs, QRectF bounds, Rule rule);
+
+    /**
+     * Add a pass
+     *
+     * @param timestamp When the pass was received, in seconds
+     * @param satz Satellite zenith angle of every column of `image`, can be empty
+     */
+    void add(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, double timestamp,
+             const std::vector<float> &satz = {});
+
+    /// Render output rows starting at `top` into `strip`, which has to be RGBA64 and as wide as the output
+    void render(QImage &strip, int top) const;
+    /// Render the entire output
+    QImage render() const;
+    /// Size of the output
+    QSize size() const { return m_size; }
+    transform::CRS crs() const { return m_crs; }
+    QRectF bounds() const { return m_bounds; }
+    /// Number of passes added
+    size_t passes() const { return m_passes.size(); }
+
+   private:
+    struct Pass {
+        std::unique_ptr<Projection> projection;
+        double timestamp;
+        // Score of every source column (lower is better), empty for the `Newest` rule
+        std::vector<float> score;
+    };
+
+    QSize m_size;
+    transform::CRS m_crs;
+    QRectF m_bounds;
+    Rule m_rule;
+    std::vector<Pass> m_passes;
+};
+
+/// Project a pass straight into a CRS, see `Projection`
+QImage project(const QImage &image, const std::vector<std::pair<xy, Geodetic>> &points, size_t xn, QSize resolution,
+               transform::CRS crs, QRectF bounds);
+
+// Render a map overlay on a projected image
+void add_overlay(QImage &image, const SegmentIndex &line_segments, QColor color, transform::CRS crs, QRectF bounds);
 void add_landmarks(QImage &image, const std::vector<Landmark> &landmarks, QColor color, transform::CRS crs, QRectF bounds);
+// Project a map overlay into the pixels of an image of `size`, to be drawn onto strips of it
+std::vector<QLineF> overlay_lines(const SegmentIndex &line_segments, transform::CRS crs, QRectF bounds, QSize size);
+// Draw projected overlay lines or landmarks onto a strip of an image of `size`, starting at row `top`
+void add_overlay(QImage &strip, const std::vector<QLineF> &lines, QColor color, int top);
+void add_landmarks(QImage &strip, const std::vector<Landmark> &landmarks, QColor color, transform::CRS crs, QRectF bounds,
+                   QSize size, int top);
+
+/// Overlays drawn onto every strip by `write_strips()`, nothing is drawn for empty ones
+struct StripOverlays {
+    /// From `overlay_lines()`
+    std::vector<QLineF> lines;
+    QColor map_color;
+    std::vector<Landmark> landmarks;
+    QColor landmark_color;
+};
+
+/**
+ * Render an output in strips, draw overlays onto them and write them to `writer`
+ *
+ * Only one strip is held in memory at once.
+ *
+ * @return If every strip was written and `writer` was closed
+ */
+bool write_strips(const Projection &projection, const StripOverlays &overlays, StripWriter &writer);
+bool write_strips(const Mosaic &mosaic, const StripOverlays &overlays, StripWriter &writer);
 
 // Calculate bounds of a pass, height is inverted
 QRectF bounds(const std::vector<std::pair<xy, Geodetic>> &points);
@@ -0,0 +1,120 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "passgeolocation.h"
+
+const std::vector<double> &PassGeolocation::timestamps_of(Imager sensor) const {
+    static const std::vector<double> empty;
+    auto it = timestamps.find(sensor);
+    return it == timestamps.end() ? empty : it->second;
+}
+
+std::shared_ptr<const PassGeolocation::GCPs> PassGeolocation::_gcps(Imager sensor, size_t width, size_t pointsy,
+                                                                    size_t pointsx) {
+    if (pointsy == 0) {
+        pointsy = default_rows(width, height(sensor));
+    }
+
+    auto key = std::make_tuple(sensor, width, pointsy, pointsx);
+    auto it = gcp_cache.find(key);
+    if (it != gcp_cache.end()) {
+        return it->second;
+    }
+
+    auto points =
+        std::make_shared<const GCPs>(projector.calculate_gcps(timestamps_of(sensor), pointsy, pointsx, sensor, sat, width));
+    gcp_cache[key] = points;
+    return points;
+}
+
+std::shared_ptr<const PassGeolocation::GCPs> PassGeolocation::gcps(Imager sensor, size_t width, size_t pointsy, size_t pointsx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return _gcps(sensor, width, pointsy, pointsx);
+}
+
+GeolocationGrid PassGeolocation::grid(Imager sensor, size_t width, size_t decimation) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return projector.calculate_grid(timestamps_of(sensor), sensor, sat, width, decimation);
+}
+
+std::shared_ptr<const SunzBuffer> PassGeolocation::sunz(Imager sensor, size_t width, SunzBuffer::Format format) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto key = std::make_tuple(sensor, width, format);
+    auto it = sunz_cache.find(key);
+    if (it != sunz_cache.end()) {
+        return it->second;
+    }
+
+    auto sunz = std::make_shared<const SunzBuffer>(projector.calculate_sunz(timestamps_of(sensor), sensor, sat, width, format));
+    sunz_cache[key] = sunz;
+    return sunz;
+}
+
+std::shared_ptr<const std::vector<float>> PassGeolocation::satellite_zenith(Imager sensor, size_t width) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto key = std::make_tuple(sensor, width);
+    auto it = satz_cache.find(key);
+    if (it != satz_cache.end()) {
+        return it->second;
+    }
+
+    auto satz = std::make_shared<const std::vector<float>>(projector.satellite_zenith(timestamps_of(sensor), sensor, sat, width));
+    satz_cache[key] = satz;
+    return satz;
+}
+
+std::shared_ptr<const std::vector<QLineF>> PassGeolocation::map_overlay(Imager sensor, size_t width, const std::string &key,
+                                                                        const map::SegmentIndex &index) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto _key = std::make_tuple(sensor, width, key);
+    auto it = map_cache.find(_key);
+    if (it != map_cache.end()) {
+        return it->second;
+    }
+
+    auto points = _gcps(sensor, width, 0, 21);
+    auto overlay = std::make_shared<const std::vector<QLineF>>(
+        points->empty() ? std::vector<QLineF>() : map::warp_to_pass(index, *points, 21));
+    map_cache[_key] = overlay;
+    return overlay;
+}
+
+std::shared_ptr<const std::vector<Landmark>> PassGeolocation::landmarks(Imager sensor, size_t width, const std::string &key,
+                                                                        const std::vector<Landmark> &landmarks) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto _key = std::make_tuple(sensor, width, key);
+    auto it = landmark_cache.find(_key);
+    if (it != landmark_cache.end()) {
+        return it->second;
+    }
+
+    auto points = _gcps(sensor, width, 0, 21);
+    auto warped = std::make_shared<const std::vector<Landmark>>(
+        points->empty() ? std::vector<Landmark>() : map::warp_to_pass(landmarks, *points, 21));
+    landmark_cache[_key] = warped;
+    return warped;
+}
+
+bool PassGeolocation::is_northbound(Imager sensor) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !timestamps_of(sensor).empty() && projector.is_northbound(timestamps_of(sensor));
+}
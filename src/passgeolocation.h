@@ -0,0 +1,109 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_PASSGEOLOCATION_H_
+#define LEANHRPT_PASSGEOLOCATION_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "map.h"
+#include "projection.h"
+
+/**
+ * Geolocation of a single pass, computed on demand and cached
+ *
+ * Everything here only depends on the satellite, the imager and its
+ * timestamps, so it is calculated once and then shared between every output
+ * (and thread) that needs it. All functions are thread safe.
+ */
+class PassGeolocation {
+   public:
+    using GCPs = std::vector<std::pair<xy, Geodetic>>;
+
+    /**
+     * @param tle The TLE of the satellite
+     * @param timestamps Timestamps of every imager, already filtered
+     */
+    PassGeolocation(std::pair<std::string, std::string> tle, SatID sat, std::map<Imager, std::vector<double>> timestamps)
+        : projector(tle), sat(sat), timestamps(std::move(timestamps)) {}
+
+    /// Number of GCP rows used for an image of a certain size with 21 columns, shared by all overlays
+    static size_t default_rows(size_t width, size_t height) { return (double)height / (double)width * 21.0; }
+
+    /**
+     * Get a GCP grid of an imager
+     *
+     * @param pointsy Number of rows, 0 for `default_rows()`
+     * @return The grid, which is empty if the imager can't be geolocated
+     */
+    std::shared_ptr<const GCPs> gcps(Imager sensor, size_t width, size_t pointsy = 0, size_t pointsx = 21);
+
+    /**
+     * Geolocation of every `decimation`th pixel of an imager, see `Projector::calculate_grid()`
+     *
+     * Grids can be huge so they aren't cached.
+     */
+    GeolocationGrid grid(Imager sensor, size_t width, size_t decimation = 1);
+
+    /// Per-pixel solar zenith angle of an imager, empty if it can't be geolocated
+    std::shared_ptr<const SunzBuffer> sunz(Imager sensor, size_t width, SunzBuffer::Format format = SunzBuffer::Format::Float);
+
+    /// @copydoc Projector::satellite_zenith
+    std::shared_ptr<const std::vector<float>> satellite_zenith(Imager sensor, size_t width);
+
+    /**
+     * Warp a map to fit an imager
+     *
+     * @param key Identifies `index` (e.g. the path of the shapefile) for caching
+     */
+    std::shared_ptr<const std::vector<QLineF>> map_overlay(Imager sensor, size_t width, const std::string &key,
+                                                           const map::SegmentIndex &index);
+    /// @copydoc map_overlay
+    std::shared_ptr<const std::vector<Landmark>> landmarks(Imager sensor, size_t width, const std::string &key,
+                                                           const std::vector<Landmark> &landmarks);
+
+    /// @copydoc Projector::is_northbound
+    bool is_northbound(Imager sensor);
+
+    /// Timestamps of an imager
+    const std::vector<double> &timestamps_of(Imager sensor) const;
+
+   private:
+    size_t height(Imager sensor) const { return timestamps_of(sensor).size(); }
+
+    std::mutex mutex;
+    Projector projector;
+    SatID sat;
+    std::map<Imager, std::vector<double>> timestamps;
+
+    std::map<std::tuple<Imager, size_t, size_t, size_t>, std::shared_ptr<const GCPs>> gcp_cache;
+    std::map<std::tuple<Imager, size_t, SunzBuffer::Format>, std::shared_ptr<const SunzBuffer>> sunz_cache;
+    std::map<std::tuple<Imager, size_t>, std::shared_ptr<const std::vector<float>>> satz_cache;
+    std::map<std::tuple<Imager, size_t, std::string>, std::shared_ptr<const std::vector<QLineF>>> map_cache;
+    std::map<std::tuple<Imager, size_t, std::string>, std::shared_ptr<const std::vector<Landmark>>> landmark_cache;
+
+    // Same as `gcps()` but the mutex must already be locked
+    std::shared_ptr<const GCPs> _gcps(Imager sensor, size_t width, size_t pointsy, size_t pointsx);
+};
+
+#endif
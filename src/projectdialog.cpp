@@ -22,6 +22,8 @@
 #include <QMessageBox>
 #include <QtConcurrent/QtConcurrent>
 
+#include "image/geotiff.h"
+#include "image/png.h"
 #include "map.h"
 #include "qt/ui_projectdialog.h"
 
@@ -32,8 +34,13 @@ ProjectDialog::ProjectDialog(QWidget *parent) : QDialog(parent) {
     scene = new QGraphicsScene(this);
     ui->projectionPreview->setScene(scene);
 
-    render_finished = new QFutureWatcher<void>(this);
-    QFutureWatcher<void>::connect(render_finished, &QFutureWatcher<void>::finished, [=]() { ui->render->setEnabled(true); });
+    render_finished = new QFutureWatcher<bool>(this);
+    QFutureWatcher<bool>::connect(render_finished, &QFutureWatcher<bool>::finished, [=]() {
+        ui->render->setEnabled(true);
+        if (!render_finished->result()) {
+            QMessageBox::warning(this, "Error", "Could not save projected image.", QMessageBox::Ok);
+        }
+    });
 
     for (const std::string &crs : transform::CRS_NAMES) {
         ui->projection->addItem(QString::fromStdString(crs));
@@ -96,11 +103,10 @@ QSize ProjectDialog::calculate_dimensions(size_t resolution) {
 }
 
 QImage ProjectDialog::render(QSize dimensions) {
-    QImage image = map::project(get_viewport(), get_points(31), 31, dimensions, bounds);
-    image = map::reproject(image, crs, bounds, target_bounds);
+    QImage image = map::project(get_viewport(), get_points(31), 31, dimensions, crs, target_bounds);
 
     if (map_enable()) {
-        std::vector<QLineF> map = map::read_shapefile(map_shapefile().toStdString());
+        map::SegmentIndex map = map::load_shapefile(map_shapefile().toStdString());
         map::add_overlay(image, map, map_color(), crs, target_bounds);
     }
     if (landmark_enable()) {
@@ -111,6 +117,22 @@ QImage ProjectDialog::render(QSize dimensions) {
     return image;
 }
 
+bool ProjectDialog::render(QSize dimensions, StripWriter &writer) {
+    map::Projection projection(get_viewport(), get_points(31), 31, dimensions, crs, target_bounds);
+
+    map::StripOverlays overlays;
+    if (map_enable()) {
+        overlays.lines = map::overlay_lines(map::load_shapefile(map_shapefile().toStdString()), crs, target_bounds, dimensions);
+        overlays.map_color = map_color();
+    }
+    if (landmark_enable()) {
+        overlays.landmarks = map::read_landmarks(landmark_file().toStdString());
+        overlays.landmark_color = landmark_color();
+    }
+
+    return map::write_strips(projection, overlays, writer);
+}
+
 void ProjectDialog::on_preview_clicked() {
     QImage image = render(calculate_dimensions(1000));
     scene->clear();
@@ -121,9 +143,20 @@ void ProjectDialog::on_preview_clicked() {
 
 void ProjectDialog::on_render_clicked() {
     QSize dimensions = calculate_dimensions(0);
-    if (dimensions.width() * dimensions.height() > 64000000) {
+
+    QString filename = QFileDialog::getSaveFileName(
+        this, "Save Projected Image",
+        QString("%1_%2.png").arg(default_filename()).arg(QString::fromStdString(transform::CRS_NAMES[(size_t)crs])),
+        "PNG (*.png);;GeoTIFF (*.tif *.tiff);;JPEG (*.jpg *.jpeg);;WEBP (*.webp);;BMP (*.bmp)");
+    if (filename.isEmpty()) return;
+
+    // PNGs and GeoTIFFs are rendered and written in strips, everything else needs the whole image in memory
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    bool geotiff = suffix == "tif" || suffix == "tiff";
+    bool strips = geotiff || suffix == "png";
+    if (!strips && (qint64)dimensions.width() * dimensions.height() > 64000000) {
         QMessageBox confirm;
-        confirm.setText(QString("Generating a large (%1x%2) image, this may cause slowdowns/crashes!")
+        confirm.setText(QString("Generating a large (%1x%2) image, this may cause slowdowns/crashes! Saving as PNG avoids this.")
                             .arg(dimensions.width())
                             .arg(dimensions.height()));
         confirm.setStandardButtons(QMessageBox::Cancel | QMessageBox::Ok);
@@ -134,20 +167,23 @@ void ProjectDialog::on_render_clicked() {
         }
     }
 
-    QString filename = QFileDialog::getSaveFileName(
-        this, "Save Projected Image",
-        QString("%1_%2.png").arg(default_filename()).arg(QString::fromStdString(transform::CRS_NAMES[(size_t)crs])),
-        "PNG (*.png);;JPEG (*.jpg *.jpeg);;WEBP (*.webp);;BMP (*.bmp)");
-    if (filename.isEmpty()) return;
-
-    QFuture<void> future = QtConcurrent::run([=]() {
-        QImage image = render(dimensions);
-        if (crs == transform::CRS::Equirectangular) {
+    QFuture<bool> future = QtConcurrent::run([=]() {
+        // GeoTIFFs carry their own georeferencing
+        if (crs == transform::CRS::Equirectangular && !geotiff) {
             QFileInfo fi(filename);
             write_wld_file(fi.absolutePath() + "/" + fi.completeBaseName() + ".wld");
             write_pam_file(filename + ".aux.xml", transform::CRS_EPSG_NAMES[(size_t)crs]);
         }
-        image.save(filename);
+
+        if (geotiff) {
+            GeoTiffWriter writer(filename.toStdString(), dimensions, crs, target_bounds);
+            return render(dimensions, writer);
+        } else if (strips) {
+            PngWriter writer(filename.toStdString(), dimensions);
+            return render(dimensions, writer);
+        } else {
+            return render(dimensions).save(filename);
+        }
     });
 
     render_finished->setFuture(future);
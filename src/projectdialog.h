@@ -27,6 +27,7 @@
 #include <QTimer>
 
 #include "geo/crs.h"
+#include "image/stripwriter.h"
 #include "projection.h"
 #include "satinfo.h"
 
@@ -45,8 +46,11 @@ class ProjectDialog : public QDialog {
    private:
     Ui::ProjectDialog *ui;
     QGraphicsScene *scene;
-    QFutureWatcher<void> *render_finished;
+    // If the image was written
+    QFutureWatcher<bool> *render_finished;
     QImage render(QSize dimensions);
+    // Render and write the image in strips, for images too large to fit in memory
+    bool render(QSize dimensions, StripWriter &writer);
     QSize calculate_dimensions(size_t resolution);
     void write_wld_file(QString filename);
     void write_pam_file(QString filename, std::string srs);
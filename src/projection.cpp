@@ -21,6 +21,7 @@
 #include <QLocale>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <map>
 
@@ -33,46 +34,77 @@ static double str2double(std::string str) {
     return l.toDouble(QString::fromStdString(str));
 }
 
+// Grid files are little endian whatever the host is
+static void put_le(std::vector<char> &out, uint32_t x) {
+    for (size_t i = 0; i < 4; i++) {
+        out.push_back((char)(x >> (i * 8)));
+    }
+}
+
+static bool write_plane(std::filebuf &file, const std::vector<float> &plane) {
+    // In chunks, so a whole plane is never copied
+    const size_t chunk = 65536;
+    std::vector<char> out;
+    for (size_t i = 0; i < plane.size(); i += chunk) {
+        out.clear();
+        for (size_t j = i; j < std::min(i + chunk, plane.size()); j++) {
+            uint32_t bits;
+            std::memcpy(&bits, &plane[j], sizeof(bits));
+            put_le(out, bits);
+        }
+        if (file.sputn(out.data(), out.size()) != (std::streamsize)out.size()) return false;
+    }
+    return true;
+}
+
+bool Projector::load_params(Imager sensor, SatID sat, ScanParams &params) {
+    std::shared_ptr<const Config> proj_info = Config::cached("projection.ini");
+    std::string name = satellite_info.at(sat).name + "_" + sensor_info.at(sensor).name;
+    if (!proj_info->sections.count(name)) {
+        return false;
+    }
+
+    auto section = proj_info->sections.at(name);
+    params.fov = str2double(section["fov"]);
+    params.yaw = str2double(section["yaw"]);
+    params.roll = str2double(section["roll"]);
+    params.pitch = str2double(section["pitch"]);
+    params.pitchscale = str2double(section["pitchscale"]);
+    params.toffset = str2double(section["toffset"]);
+    params.curved = section["curved"] == "true";
+    return true;
+}
+
+std::pair<Geodetic, double> Projector::satellite_state(double timestamp, const ScanParams &params) {
+    struct predict_position orbit = ephemeris.predict(timestamp);
+
+    struct predict_position a = ephemeris.predict(timestamp - 0.05);
+    struct predict_position b = ephemeris.predict(timestamp + 0.05);
+    double azimuth = deg2rad(90) - CalculateGeodeticCurve(WGS84, Geodetic(a), Geodetic(b)).Azimuth;
+    if (azimuth < -M_PI) {
+        azimuth += deg2rad(params.yaw);
+    } else {
+        azimuth -= deg2rad(params.yaw);
+    }
+
+    return {Geodetic(orbit), azimuth};
+}
+
 std::vector<std::pair<xy, Geodetic>> Projector::calculate_gcps(const std::vector<double> &timestamps, size_t pointsy,
                                                                size_t pointsx, Imager sensor, SatID sat, size_t width) {
     std::vector<std::pair<xy, Geodetic>> gcps;
 
-    if (timestamps.size() == 0) {
+    ScanParams params;
+    if (timestamps.size() == 0 || !load_params(sensor, sat, params)) {
         return gcps;
     }
 
-    Config proj_info("projection.ini");
-    if (!proj_info.sections.count(satellite_info.at(sat).name + "_" + sensor_info.at(sensor).name)) {
-        return gcps;
-    }
-    auto params = proj_info.sections.at(satellite_info.at(sat).name + "_" + sensor_info.at(sensor).name);
-    double fov = str2double(params["fov"]);
-    double yaw = str2double(params["yaw"]);
-    double roll = str2double(params["roll"]);
-    double pitch = str2double(params["pitch"]);
-    double pitchscale = str2double(params["pitchscale"]);
-    double toffset = str2double(params["toffset"]);
-    bool curved = params["curved"] == "true";
-
     for (size_t j = 0; j < pointsy; j++) {
         size_t i = (double)j / double(pointsy - 1) * double(timestamps.size() - 1);
-        double timestamp = timestamps[i] + toffset;
-
-        struct predict_position orbit = predictor.predict(timestamp);
+        auto state = satellite_state(timestamps[i] + params.toffset, params);
 
-        double azimuth;
-        {
-            struct predict_position a = predictor.predict(timestamp - 0.05);
-            struct predict_position b = predictor.predict(timestamp + 0.05);
-            azimuth = deg2rad(90) - CalculateGeodeticCurve(WGS84, Geodetic(a), Geodetic(b)).Azimuth;
-            if (azimuth < -M_PI) {
-                azimuth += deg2rad(yaw);
-            } else {
-                azimuth -= deg2rad(yaw);
-            }
-        }
-
-        auto scan = calculate_scan(Geodetic(orbit), azimuth, fov, roll, pitch, pitchscale, curved, pointsx);
+        auto scan = calculate_scan(state.first, state.second, params.fov, params.roll, params.pitch, params.pitchscale,
+                                   params.curved, pointsx);
         for (auto &point : scan) {
             gcps.push_back(std::make_pair(std::make_pair(point.first * double(width - 1), (double)i), point.second));
         }
@@ -81,10 +113,73 @@ std::vector<std::pair<xy, Geodetic>> Projector::calculate_gcps(const std::vector
     return gcps;
 }
 
+GeolocationGrid Projector::calculate_grid(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width,
+                                          size_t decimation) {
+    GeolocationGrid grid;
+    decimation = std::max<size_t>(decimation, 1);
+
+    ScanParams params;
+    if (timestamps.size() == 0 || width < 2 || !load_params(sensor, sat, params)) {
+        return grid;
+    }
+
+    grid.image_width = width;
+    grid.image_height = timestamps.size();
+    grid.decimation = decimation;
+    grid.width = (grid.image_width - 1) / decimation + 1;
+    grid.height = (grid.image_height - 1) / decimation + 1;
+    grid.latitude.resize(grid.width * grid.height);
+    grid.longitude.resize(grid.width * grid.height);
+
+    // Position of every column within the scan
+    std::vector<double> positions(grid.width);
+    for (size_t x = 0; x < grid.width; x++) {
+        positions[x] = double(x * decimation) / double(width - 1);
+    }
+
+    // Orbit predictions aren't thread safe (but are cheap), so get them all first
+    std::vector<std::pair<Geodetic, double>> states;
+    states.reserve(grid.height);
+    for (size_t y = 0; y < grid.height; y++) {
+        states.push_back(satellite_state(timestamps[y * decimation] + params.toffset, params));
+    }
+
+#pragma omp parallel for
+    for (size_t y = 0; y < grid.height; y++) {
+        auto scan = calculate_scan(states[y].first, states[y].second, params.fov, params.roll, params.pitch, params.pitchscale,
+                                   params.curved, positions);
+        for (size_t x = 0; x < grid.width; x++) {
+            grid.latitude[y * grid.width + x] = scan[x].second.latitude * RAD2DEG;
+            grid.longitude[y * grid.width + x] = std::remainder(scan[x].second.longitude * RAD2DEG, 360.0);
+        }
+    }
+
+    return grid;
+}
+
+bool Projector::save_grid_file(const GeolocationGrid &grid, std::string filename) {
+    std::vector<char> header(8);
+    std::memcpy(header.data(), "LHRPTGEO", 8);
+    for (size_t value : {(size_t)GeolocationGrid::FORMAT_VERSION, grid.width, grid.height, grid.decimation, grid.image_width,
+                         grid.image_height}) {
+        put_le(header, value);
+    }
+    header.resize(sizeof(GeolocationGrid::Header), 0);
+
+    std::filebuf file;
+    if (!file.open(filename, std::ios::out | std::ios::binary)) return false;
+
+    bool ok = file.sputn(header.data(), header.size()) == (std::streamsize)header.size() && write_plane(file, grid.latitude) &&
+              write_plane(file, grid.longitude);
+    return file.close() != nullptr && ok;
+}
+
 void Projector::save_gcp_file(const std::vector<double> &timestamps, size_t pointsy, size_t pointsx, Imager sensor, SatID sat,
                               std::string filename, size_t width) {
-    auto gcps = calculate_gcps(timestamps, pointsy, pointsx, sensor, sat, width);
+    save_gcp_file(calculate_gcps(timestamps, pointsy, pointsx, sensor, sat, width), filename);
+}
 
+void Projector::save_gcp_file(const std::vector<std::pair<xy, Geodetic>> &gcps, std::string filename) {
     std::filebuf file;
     if (!file.open(filename, std::ios::out)) return;
     std::ostream stream(&file);
@@ -99,77 +194,143 @@ void Projector::save_gcp_file(const std::vector<double> &timestamps, size_t poin
     file.close();
 }
 
-std::vector<float> Projector::calculate_sunz(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width) {
-    const size_t pointsx = 21;
-    const size_t pointsy = (double)timestamps.size() / (double)width * 21.0;
-    auto gcps = calculate_gcps(timestamps, pointsy, pointsx, sensor, sat, width);
-    if (gcps.size() == 0) return {};
-
-    std::vector<float> sunz(pointsy * pointsx);
-    for (size_t i = 0; i < gcps.size(); i++) {
-        double y = gcps[i].first.second;
-        double lon = gcps[i].second.longitude;
-        double lat = gcps[i].second.latitude;
-        double timestamp = timestamps[y];
-
-        // UNIX to Julian date
-        predict_julian_date_t prediction_time = (timestamp / 86400.0) - 3651.0;
-        predict_observer_t observer = {"", lat, lon, 0};
+SunzBuffer Projector::calculate_sunz(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width,
+                                     SunzBuffer::Format format) {
+    ScanParams params;
+    if (timestamps.size() == 0 || width < 2 || !load_params(sensor, sat, params)) {
+        return SunzBuffer();
+    }
+    size_t height = timestamps.size();
 
-        struct predict_observation observation;
-        predict_observe_sun(&observer, prediction_time, &observation);
+    // Everything the generator needs, shared between copies of it
+    struct Scan {
+        std::vector<double> timestamps;
+        std::vector<double> rolls;
+        std::vector<double> pitches;
+        std::vector<std::pair<Geodetic, double>> states;
+    };
+    auto scan = std::make_shared<Scan>();
+    scan->timestamps = timestamps;
 
-        // Elevation to zenith
-        sunz[i] = deg2rad(90.0) - observation.elevation;
+    // The look angles of each pixel are the same on every line
+    std::vector<double> positions(width);
+    for (size_t x = 0; x < width; x++) {
+        positions[x] = (double)x / double(width - 1);
     }
+    scan_angles(params.fov, params.roll, params.pitch, params.pitchscale, params.curved, positions, scan->rolls, scan->pitches);
 
-    // Interpolate points to the full image size
-    size_t height = timestamps.size();
-    std::vector<float> full_sunz(height * width);
+    // Orbit predictions aren't thread safe (but are cheap), so get them all now
+    scan->states.reserve(height);
     for (size_t y = 0; y < height; y++) {
-        for (size_t x = 0; x < width; x++) {
-            double y2 = (double)y / double(height - 1) * (pointsy - 1);
-            double x2 = (double)x / double(width - 1) * (pointsx - 1);
+        scan->states.push_back(satellite_state(timestamps[y] + params.toffset, params));
+    }
+
+    auto generator = [scan, width](size_t y0, size_t rows, float *out) {
+#pragma omp parallel
+        {
+            std::vector<double> latitudes(width), longitudes(width);
 
-            float a = lerp<float>(sunz[floor(y2) * pointsx + floor(x2)], sunz[floor(y2) * pointsx + ceil(x2)], fmod(x2, 1.0));
-            float b = lerp<float>(sunz[ceil(y2) * pointsx + floor(x2)], sunz[ceil(y2) * pointsx + ceil(x2)], fmod(x2, 1.0));
-            full_sunz[y * width + x] = lerp<float>(a, b, fmod(y2, 1.0));
+#pragma omp for
+            for (size_t y = y0; y < y0 + rows; y++) {
+                los_to_earth(scan->states[y].first, scan->rolls.data(), scan->pitches.data(), scan->states[y].second, width,
+                             latitudes.data(), longitudes.data());
+
+                // The sun barely moves during a line
+                std::array<double, 3> sun = Ephemeris::sun_vector(scan->timestamps[y]);
+                float *line = &out[(y - y0) * width];
+                for (size_t x = 0; x < width; x++) {
+                    // Dot product with the surface normal
+                    double cos_lat = cos(latitudes[x]);
+                    double cos_zenith = cos_lat * cos(longitudes[x]) * sun[0] + cos_lat * sin(longitudes[x]) * sun[1] +
+                                        sin(latitudes[x]) * sun[2];
+                    line[x] = acos(std::min(std::max(cos_zenith, -1.0), 1.0));
+                }
+            }
         }
-    }
+    };
 
-    return full_sunz;
+    return SunzBuffer(width, height, generator, format);
 }
 
-std::vector<std::pair<double, Geodetic>> Projector::calculate_scan(const Geodetic &position, double azimuth, double fov,
-                                                                   double roll, double pitch, double pitchscale, bool curved,
-                                                                   size_t n) {
-    std::vector<std::pair<double, Geodetic>> scan;
+void Projector::scan_angles(double fov, double roll, double pitch, double pitchscale, bool curved,
+                            const std::vector<double> &positions, std::vector<double> &rolls, std::vector<double> &pitches) {
+    rolls.resize(positions.size());
+    pitches.resize(positions.size());
 
-    for (size_t i = 0; i < n; i++) {
+    for (size_t i = 0; i < positions.size(); i++) {
         // The angle that the sensor is pointing at
-        double sensor_angle = (double)i / double(n - 1) * 2.0 - 1.0;
+        double sensor_angle = positions[i] * 2.0 - 1.0;
         double _pitch = pitch;
         if (curved) {
             _pitch *= sqrt(1.0 - pow(sensor_angle * pitchscale, 2.0));
         }
-        sensor_angle *= fov * DEG2RAD;
 
-        // The position that the sensor is looking at
-        Geodetic point = los_to_earth(position, sensor_angle + deg2rad(roll), deg2rad(_pitch), azimuth);
+        rolls[i] = sensor_angle * fov * DEG2RAD + deg2rad(roll);
+        pitches[i] = deg2rad(_pitch);
+    }
+}
+
+std::vector<std::pair<double, Geodetic>> Projector::calculate_scan(const Geodetic &position, double azimuth, double fov,
+                                                                   double roll, double pitch, double pitchscale, bool curved,
+                                                                   size_t n) {
+    std::vector<double> positions(n);
+    for (size_t i = 0; i < n; i++) {
+        positions[i] = (double)i / double(n - 1);
+    }
+    return calculate_scan(position, azimuth, fov, roll, pitch, pitchscale, curved, positions);
+}
+
+std::vector<std::pair<double, Geodetic>> Projector::calculate_scan(const Geodetic &position, double azimuth, double fov,
+                                                                   double roll, double pitch, double pitchscale, bool curved,
+                                                                   const std::vector<double> &positions) {
+    size_t n = positions.size();
+    std::vector<double> rolls, pitches, latitudes(n), longitudes(n);
+    scan_angles(fov, roll, pitch, pitchscale, curved, positions, rolls, pitches);
+
+    // The positions that the sensor is looking at
+    los_to_earth(position, rolls.data(), pitches.data(), azimuth, n, latitudes.data(), longitudes.data());
 
-        // Create a list of points and their respective coordinates
-        scan.push_back({(double)i / double(n - 1), point});
+    // Create a list of points and their respective coordinates
+    std::vector<std::pair<double, Geodetic>> scan;
+    scan.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        scan.push_back({positions[i], Geodetic(latitudes[i], longitudes[i], 0)});
     }
 
     return scan;
 }
 
+std::vector<float> Projector::satellite_zenith(const std::vector<double> &timestamps, Imager sensor, SatID sat,
+                                               size_t width) {
+    ScanParams params;
+    if (timestamps.size() == 0 || width < 2 || !load_params(sensor, sat, params)) {
+        return {};
+    }
+
+    std::vector<double> positions(width), rolls, pitches;
+    for (size_t x = 0; x < width; x++) {
+        positions[x] = (double)x / double(width - 1);
+    }
+    scan_angles(params.fov, params.roll, params.pitch, params.pitchscale, params.curved, positions, rolls, pitches);
+
+    double height = satellite_state(timestamps[timestamps.size() / 2] + params.toffset, params).first.altitude;
+    std::vector<float> zenith(width);
+    for (size_t x = 0; x < width; x++) {
+        // Angle between the line of sight and nadir, then the same angle seen from the ground
+        double look = acos(cos(rolls[x]) * cos(pitches[x]));
+        double sine = std::min((EARTH_RADIUS + height) / EARTH_RADIUS * sin(look), 1.0);
+        zenith[x] = asin(sine) * RAD2DEG;
+    }
+
+    return zenith;
+}
+
 bool Projector::is_northbound(const std::vector<double> &timestamps) {
     double lower_quartile = timestamps[timestamps.size() / 4 * 1];
     double upper_quartile = timestamps[timestamps.size() / 4 * 3];
 
-    struct predict_position a = predictor.predict(lower_quartile);
-    struct predict_position b = predictor.predict(upper_quartile);
+    struct predict_position a = ephemeris.predict(lower_quartile);
+    struct predict_position b = ephemeris.predict(upper_quartile);
     double azimuth = CalculateGeodeticCurve(WGS84, Geodetic(a), Geodetic(b)).Azimuth;
 
     return azimuth > M_PI * 1.5;
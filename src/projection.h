@@ -20,11 +20,13 @@
 #define LEANHRPT_PROJECTION_H_
 
 #include <cmath>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
+#include "ephemeris.h"
 #include "geo/geodetic.h"
-#include "orbit.h"
+#include "image/sunz.h"
 #include "satinfo.h"
 #include "util.h"
 
@@ -42,9 +44,43 @@ inline double sat2earth_angle(double radius, double height, double angle) {
 }
 }  // namespace geo
 
+/**
+ * Geolocation of every (or every nth) pixel of an image
+ *
+ * When saved the file is made up of a 64 byte `Header` followed by a
+ * latitude and then a longitude plane. Both planes are `height` rows of
+ * `width` float32 values in degrees, so they can be memory mapped directly.
+ * Everything is little endian, whatever the byte order of the machine that
+ * wrote it. Grid point (x, y) is pixel (x*decimation, y*decimation).
+ */
+struct GeolocationGrid {
+    // Not `VERSION`, which is the version of the program
+    static const uint32_t FORMAT_VERSION = 1;
+    struct Header {
+        // "LHRPTGEO"
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t decimation;
+        uint32_t image_width;
+        uint32_t image_height;
+        uint32_t reserved[8];
+    };
+    static_assert(sizeof(Header) == 64, "Header must be 64 bytes");
+
+    size_t width = 0;
+    size_t height = 0;
+    size_t decimation = 1;
+    size_t image_width = 0;
+    size_t image_height = 0;
+    std::vector<float> latitude;
+    std::vector<float> longitude;
+};
+
 class Projector {
    public:
-    Projector(std::pair<std::string, std::string> tle) : predictor(tle) {}
+    Projector(std::pair<std::string, std::string> tle) : ephemeris(tle) {}
 
     /**
      * Create a GCP grid
@@ -59,7 +95,39 @@ class Projector {
      */
     void save_gcp_file(const std::vector<double> &timestamps, size_t pointsy, size_t pointsx, Imager sensor, SatID sat,
                        std::string filename, size_t width);
-    std::vector<float> calculate_sunz(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width);
+    /// @copydoc save_gcp_file
+    static void save_gcp_file(const std::vector<std::pair<xy, Geodetic>> &gcps, std::string filename);
+    /**
+     * Geolocate every `decimation`th pixel of an image, in parallel
+     *
+     * @return The grid, empty if the imager can't be geolocated
+     */
+    GeolocationGrid calculate_grid(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width,
+                                   size_t decimation = 1);
+    /// Saves a grid in the binary format described in `GeolocationGrid`
+    static bool save_grid_file(const GeolocationGrid &grid, std::string filename);
+
+    /**
+     * Calculate the solar zenith angle of every pixel
+     *
+     * Angles are calculated lazily (in parallel) as they are accessed. Every
+     * pixel is geolocated, while the position of the sun is only calculated
+     * once per line.
+     *
+     * @return The angles, empty if the imager can't be geolocated
+     */
+    SunzBuffer calculate_sunz(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width,
+                              SunzBuffer::Format format = SunzBuffer::Format::Float);
+
+    /**
+     * Satellite zenith angle (in degrees) of every column of an imager
+     *
+     * This only depends on the scan angle and the altitude of the satellite,
+     * which barely changes over a pass, so it is calculated once at the middle.
+     *
+     * @return The angles, empty if the imager can't be geolocated
+     */
+    std::vector<float> satellite_zenith(const std::vector<double> &timestamps, Imager sensor, SatID sat, size_t width);
 
     /**
      * If the provided timestamps represent a northbound pass
@@ -69,10 +137,32 @@ class Projector {
     bool is_northbound(const std::vector<double> &timestamps);
 
    private:
+    // Parameters from projection.ini
+    struct ScanParams {
+        double fov;
+        double yaw;
+        double roll;
+        double pitch;
+        double pitchscale;
+        double toffset;
+        bool curved;
+    };
+    static bool load_params(Imager sensor, SatID sat, ScanParams &params);
+    // Position and azimuth of the satellite
+    std::pair<Geodetic, double> satellite_state(double timestamp, const ScanParams &params);
+
     std::vector<std::pair<double, Geodetic>> calculate_scan(const Geodetic &position, double azimuth, double fov, double roll,
                                                             double pitch, double pitchscale, bool curved, size_t n);
+    // Roll and pitch of the sensor at positions within the scan (0-1)
+    static void scan_angles(double fov, double roll, double pitch, double pitchscale, bool curved,
+                            const std::vector<double> &positions, std::vector<double> &rolls, std::vector<double> &pitches);
+    // Same as above but with explicit positions within the scan (0-1)
+    static std::vector<std::pair<double, Geodetic>> calculate_scan(const Geodetic &position, double azimuth, double fov,
+                                                                   double roll, double pitch, double pitchscale, bool curved,
+                                                                   const std::vector<double> &positions);
 
-    OrbitPredictor predictor;
+    // Predictions are cached, so the (many) predictions needed for dense grids are cheap
+    Ephemeris ephemeris;
 };
 
 #endif
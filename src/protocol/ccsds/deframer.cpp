@@ -22,6 +22,8 @@
 #include <cstring>
 #include <stdexcept>
 
+#include "stats.h"
+
 // Slightly modified from Oleg's original values
 const unsigned int stateThresholds[4] = {0, 2, 6, 16};
 
@@ -32,6 +34,11 @@ const unsigned int stateThresholds[4] = {0, 2, 6, 16};
 #define FRAME_SIZE 8192
 #define FRAME_SIZE_BYTES (FRAME_SIZE / 8)
 
+static stats::Stage deframe_stage("deframe");
+static stats::Counter frames_found("deframe/frames");
+static stats::Counter bit_slips("deframe/slips");
+static stats::Counter inversions("deframe/inversions");
+
 namespace ccsds {
 Deframer::Deframer()
     : shifter(0),
@@ -71,6 +78,11 @@ void Deframer::startWriting() {
     writingData = true;
 }
 
+void Deframer::syncFound(asm_t syncword) {
+    syncTelemetry.sync(std::bitset<ASM_SIZE>(shifter ^ syncword).count());
+    startWriting();
+}
+
 void Deframer::enterState(SyncMachineState newState) {
     goodFrames = 0;
     badFrames = 0;
@@ -79,6 +91,9 @@ void Deframer::enterState(SyncMachineState newState) {
 
 bool Deframer::work(const uint8_t *in, uint8_t *out, size_t len) {
     bool complete_frame = false;
+    stats::Timer timer(deframe_stage);
+    timer.bytes(len);
+    uint64_t offset = syncTelemetry.input(len);
 
     for (unsigned int i = 0; i < len; i++) {
         for (int j = 7; j >= 0; j--) {
@@ -106,6 +121,8 @@ bool Deframer::work(const uint8_t *in, uint8_t *out, size_t len) {
                     skip = ASM_SIZE;
                     complete_frame = true;
                     std::memcpy(out, frameBuffer, FRAME_SIZE_BYTES);
+                    frames_found.add();
+                    syncTelemetry.frame(offset + i);
                 }
 
                 if (state != SyncMachineState::State1) continue;
@@ -122,18 +139,24 @@ bool Deframer::work(const uint8_t *in, uint8_t *out, size_t len) {
                 case SyncMachineState::State0:
                     if (asmCompare(shifter, ASM)) {
                         enterState(SyncMachineState::State2);
-                        startWriting();
+                        syncFound(ASM);
+                        syncTelemetry.event(SyncTelemetry::EventType::Lock, offset + i);
+                        if (syncTelemetry.frames != 0) bit_slips.add();
                     } else if (asmCompare(shifter, INVERSE_ASM)) {
                         invert = !invert;
                         enterState(SyncMachineState::State2);
-                        startWriting();
+                        syncFound(INVERSE_ASM);
+                        syncTelemetry.event(SyncTelemetry::EventType::Lock, offset + i);
+                        syncTelemetry.event(SyncTelemetry::EventType::Inversion, offset + i);
+                        inversions.add();
+                        if (syncTelemetry.frames != 0) bit_slips.add();
                     }
                     break;
                 // Allow up to 2 bit errors, if we check 5 frames without success go back to State0
                 // assuming we have lost all lock
                 case SyncMachineState::State1:
                     if (asmCompare(shifter, ASM)) {
-                        startWriting();
+                        syncFound(ASM);
                         badFrames = 0;
                         enterState(SyncMachineState::State2);
                     } else {
@@ -141,13 +164,14 @@ bool Deframer::work(const uint8_t *in, uint8_t *out, size_t len) {
                         goodFrames = 0;
                         if (badFrames == 5) {
                             enterState(SyncMachineState::State0);
+                            syncTelemetry.event(SyncTelemetry::EventType::Loss, offset + i);
                         }
                     }
                     break;
                 // Intermediate state between the strict State0 and lenient State3
                 case SyncMachineState::State2:
                     if (asmCompare(shifter, ASM)) {
-                        startWriting();
+                        syncFound(ASM);
                         goodFrames++;
                         badFrames = 0;
                         if (goodFrames == 5) {
@@ -164,7 +188,7 @@ bool Deframer::work(const uint8_t *in, uint8_t *out, size_t len) {
                 // Assume fully locked, allow a very high level of errors
                 case SyncMachineState::State3:
                     if (asmCompare(shifter, ASM)) {
-                        startWriting();
+                        syncFound(ASM);
                     } else {
                         enterState(SyncMachineState::State2);
                     }
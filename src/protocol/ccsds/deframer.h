@@ -22,6 +22,8 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "protocol/telemetry.h"
+
 namespace ccsds {
 enum class SyncMachineState { State0, State1, State2, State3 };
 
@@ -33,6 +35,9 @@ class Deframer {
     Deframer();
     ~Deframer();
     bool work(const uint8_t *in, uint8_t *out, size_t len);
+    const SyncTelemetry &telemetry() const { return syncTelemetry; }
+    /// Set the nominal rate of the input, for placing frames in time in the telemetry
+    void setInputRate(double bytes_per_second) { syncTelemetry.byte_rate = bytes_per_second; }
 
    private:
     asm_t shifter;
@@ -51,7 +56,9 @@ class Deframer {
     bool invert;
     unsigned int badFrames;
     unsigned int goodFrames;
+    SyncTelemetry syncTelemetry;
 
+    void syncFound(asm_t syncword);
     void startWriting();
     void enterState(SyncMachineState newState);
     int skip;
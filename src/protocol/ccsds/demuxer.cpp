@@ -21,16 +21,30 @@
 #include <cstring>
 #include <iostream>
 
+#include "stats.h"
+
 #define HEADER_LEN 6
 
+static stats::Stage demux_stage("demux");
+static stats::Counter packets_found("demux/packets");
+// Packets cut short by the start of another
+static stats::Counter packets_dropped("demux/dropped");
+static stats::Counter invalid_fhps("demux/invalid");
+
 namespace ccsds {
 std::vector<uint8_t> SimpleDemuxer::work(const uint8_t *in) {
+    stats::Timer timer(demux_stage);
+    timer.bytes(mpdu_size);
+
     std::vector<uint8_t> packet;
     uint16_t fhp = (in[fhp_offset] << 8 | in[fhp_offset + 1]) & 0b11111111111;
     const uint8_t *data = &in[fhp_offset + 2];
 
     // Exit immediately if the FHP is invalid
-    if (fhp > mpdu_size && fhp != 2047) return packet;
+    if (fhp > mpdu_size && fhp != 2047) {
+        invalid_fhps.add();
+        return packet;
+    }
 
     // MPDU with just data, no CPPDU header
     if (writingData && fhp == 2047) {
@@ -42,6 +56,7 @@ std::vector<uint8_t> SimpleDemuxer::work(const uint8_t *in) {
         writingData = false;
         packet = packetBuffer;
         packetBuffer.clear();
+        packets_found.add();
     }
     // A new CPPDU frame
     if (!writingData && fhp != 2047) {
@@ -53,6 +68,9 @@ std::vector<uint8_t> SimpleDemuxer::work(const uint8_t *in) {
 }
 
 std::vector<std::vector<uint8_t>> Demuxer::work(const uint8_t *in) {
+    stats::Timer timer(demux_stage);
+    timer.bytes(mpdu_size);
+
     std::vector<std::vector<uint8_t>> packets;
 
     while (true) {
@@ -60,6 +78,7 @@ std::vector<std::vector<uint8_t>> Demuxer::work(const uint8_t *in) {
 
         if (state == DemuxerStatus::PARSED) {
             packets.push_back(packet);
+            packets_found.add();
         } else if (state == DemuxerStatus::PROCEED) {
             break;
         }
@@ -72,7 +91,10 @@ DemuxerStatus Demuxer::internal_work(const uint8_t *in) {
     const uint8_t *data = &in[fhp_offset + 2];
 
     // Exit immediately if the FHP is invalid
-    if (fhp > mpdu_size && fhp != 2047) return DemuxerStatus::PROCEED;
+    if (fhp > mpdu_size && fhp != 2047) {
+        invalid_fhps.add();
+        return DemuxerStatus::PROCEED;
+    }
 
     size_t bytes_left = 0;
     bool jump_idle = (fhp != 2047 && offset == 0);
@@ -120,6 +142,7 @@ DemuxerStatus Demuxer::internal_work(const uint8_t *in) {
             std::copy(data + offset, data + mpdu_size, packet.begin() + HEADER_LEN + frag_offset);
             frag_offset += mpdu_size - offset;
             offset = 0;
+            if (jump_idle) packets_dropped.add();
             state = jump_idle ? DemuxerState::IDLE : DemuxerState::DATA;
             return jump_idle ? DemuxerStatus::FRAGMENT : DemuxerStatus::PROCEED;
     }
@@ -22,6 +22,15 @@
 #include <cstring>
 #include <stdexcept>
 
+#include "stats.h"
+
+namespace {
+stats::Stage deframe_stage("deframe");
+stats::Counter frames_found("deframe/frames");
+stats::Counter bit_slips("deframe/slips");
+stats::Counter inversions("deframe/inversions");
+}  // namespace
+
 // Constructor
 template <typename ASM_T, ASM_T ASM, unsigned int ASM_SIZE, unsigned int FRAME_SIZE>
 ArbitraryDeframer<ASM_T, ASM, ASM_SIZE, FRAME_SIZE>::ArbitraryDeframer(unsigned int incorrectBitThreshold, bool checkInverted)
@@ -66,12 +75,32 @@ void ArbitraryDeframer<ASM_T, ASM, ASM_SIZE, FRAME_SIZE>::startWriting() {
     bufferBitPosition = 0;
     bitsWritten = 0;
     writingData = true;
+    bitsSearched = 0;
+}
+
+template <typename ASM_T, ASM_T ASM, unsigned int ASM_SIZE, unsigned int FRAME_SIZE>
+void ArbitraryDeframer<ASM_T, ASM, ASM_SIZE, FRAME_SIZE>::syncFound(uint64_t offset, ASM_T syncword) {
+    // Found before where it should have been
+    if (locked && bitsSearched != ASM_SIZE) {
+        locked = false;
+        syncTelemetry.event(SyncTelemetry::EventType::Loss, offset);
+    }
+    if (!locked) {
+        // Reacquiring lock after frames have already been found is a slip
+        if (syncTelemetry.frames != 0) bit_slips.add();
+        syncTelemetry.event(SyncTelemetry::EventType::Lock, offset);
+        locked = true;
+    }
+    syncTelemetry.sync(std::bitset<ASM_SIZE>(shifter ^ syncword).count());
 }
 
 // Work function
 template <typename ASM_T, ASM_T ASM, unsigned int ASM_SIZE, unsigned int FRAME_SIZE>
 bool ArbitraryDeframer<ASM_T, ASM, ASM_SIZE, FRAME_SIZE>::work(const uint8_t *data, uint8_t *out, unsigned int len) {
     bool complete_frame = false;
+    stats::Timer timer(deframe_stage);
+    timer.bytes(len);
+    uint64_t offset = syncTelemetry.input(len);
 
     for (size_t i = 0; i < len; i++) {
         for (int j = 7; j >= 0; j--) {
@@ -99,17 +128,29 @@ bool ArbitraryDeframer<ASM_T, ASM, ASM_SIZE, FRAME_SIZE>::work(const uint8_t *da
 
                     complete_frame = 1;
                     std::memcpy(out, frameBuffer, FRAME_SIZE / 8);
+                    frames_found.add();
+                    syncTelemetry.frame(offset + i);
 
                     continue;
                 }
             }
 
             if (!writingData) {
+                bitsSearched++;
+                if (locked && bitsSearched > ASM_SIZE) {
+                    locked = false;
+                    syncTelemetry.event(SyncTelemetry::EventType::Loss, offset + i);
+                }
+
                 if (fuzzyBitCompare(shifter, ASM, incorrectBitThreshold)) {
+                    syncFound(offset + i, ASM);
                     startWriting();
                 } else if (checkInverted && fuzzyBitCompare(shifter, ~ASM, incorrectBitThreshold)) {
+                    syncFound(offset + i, ~ASM);
                     startWriting();
                     invert = !invert;
+                    inversions.add();
+                    syncTelemetry.event(SyncTelemetry::EventType::Inversion, offset + i);
                 }
             }
         }
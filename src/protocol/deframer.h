@@ -22,12 +22,17 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "telemetry.h"
+
 template <typename ASM_T, ASM_T ASM, unsigned int ASM_SIZE, unsigned int FRAME_SIZE>
 class ArbitraryDeframer {
    public:
     ArbitraryDeframer(unsigned int incorrectBitThreshold = 10, bool checkInverted = false);
     ~ArbitraryDeframer();
     bool work(const uint8_t *data, uint8_t *out, unsigned int len);
+    const SyncTelemetry &telemetry() const { return syncTelemetry; }
+    /// Set the nominal rate of the input, for placing frames in time in the telemetry
+    void setInputRate(double bytes_per_second) { syncTelemetry.byte_rate = bytes_per_second; }
 
    private:
     uint8_t *frameBuffer;
@@ -47,6 +52,12 @@ class ArbitraryDeframer {
     unsigned int bitsWritten = 0;
     bool writingData = false;
     bool invert = false;
+
+    // Lock is lost when the next sync word doesn't directly follow the previous frame
+    bool locked = false;
+    unsigned int bitsSearched = 0;
+    SyncTelemetry syncTelemetry;
+    void syncFound(uint64_t offset, ASM_T syncword);
     void startWriting();
     bool fuzzyBitCompare(ASM_T a, ASM_T b, size_t threshold);
 };
@@ -0,0 +1,84 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_PROTOCOL_TELEMETRY_H_
+#define LEANHRPT_PROTOCOL_TELEMETRY_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Frame synchronisation of a deframer over a pass
+ *
+ * Kept so a bad decode can be put down to the signal (lock being lost, sync
+ * words with lots of bit errors, fewer frames per second of input than the
+ * protocol sends) or to the software (frames being found slowly while
+ * processing) after the fact.
+ */
+struct SyncTelemetry {
+    enum class EventType { Lock, Loss, Inversion };
+    struct Event {
+        EventType type;
+        /// Offset of the byte it was detected in, counted from the start of the deframer's input (not necessarily the file)
+        uint64_t offset;
+    };
+
+    std::vector<Event> events;
+    /// Number of sync words found with n bit errors, indexed by n
+    std::vector<uint64_t> asm_errors;
+    /// Nominal rate of the deframer's input in bytes per second, 0 if unknown
+    double byte_rate = 0.0;
+    /// Frames found in each second of input, placed by their offset at `byte_rate` (empty if it's unknown)
+    std::vector<uint64_t> frames_per_second;
+    /// Frames found in each (wall clock) second since the deframer was first given data
+    std::vector<uint64_t> frames_per_processing_second;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+
+    /// Called once per `work()` with the length of the input, returns the offset of its first byte
+    uint64_t input(size_t len) {
+        auto now = std::chrono::steady_clock::now();
+        if (bytes == 0) d_start = now;
+        d_second = std::chrono::duration_cast<std::chrono::seconds>(now - d_start).count();
+
+        uint64_t offset = bytes;
+        bytes += len;
+        return offset;
+    }
+    void event(EventType type, uint64_t offset) { events.push_back({type, offset}); }
+    void sync(size_t errors) { count(asm_errors, errors); }
+    /// A frame ending in the byte at `offset` was found
+    void frame(uint64_t offset) {
+        if (byte_rate > 0.0) count(frames_per_second, offset / byte_rate);
+        count(frames_per_processing_second, d_second);
+        frames++;
+    }
+
+   private:
+    static void count(std::vector<uint64_t> &histogram, size_t i) {
+        if (histogram.size() <= i) histogram.resize(i + 1);
+        histogram[i]++;
+    }
+
+    std::chrono::steady_clock::time_point d_start;
+    size_t d_second = 0;
+};
+
+#endif
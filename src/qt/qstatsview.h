@@ -0,0 +1,95 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_QT_QSTATSVIEW_H_
+#define LEANHRPT_QT_QSTATSVIEW_H_
+
+#include <QHeaderView>
+#include <QTableWidget>
+#include <QTimer>
+#include <array>
+#include <functional>
+
+#include "stats.h"
+
+/// A table of everything recorded by `stats`, refreshed every second while it's shown
+class QStatsView : public QTableWidget {
+   public:
+    QStatsView(QWidget *parent = nullptr) : QTableWidget(parent) {
+        setWindowFlags(Qt::Tool);
+        setWindowTitle("Statistics");
+        setColumnCount(4);
+        setHorizontalHeaderLabels({"Name", "Count", "Time (s)", "MB/s"});
+        horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+        verticalHeader()->hide();
+        setEditTriggers(QAbstractItemView::NoEditTriggers);
+        resize(480, 400);
+
+        timer.setInterval(1000);
+        QObject::connect(&timer, &QTimer::timeout, [this]() { refresh(); });
+    }
+
+    /// Called when the window is closed
+    std::function<void()> closed;
+
+    void refresh() {
+        stats::Report report = stats::report();
+        setRowCount(report.stages.size() + report.counters.size());
+
+        int row = 0;
+        for (const stats::StageReport &stage : report.stages) {
+            set_row(row++, stage.name, QString::number(stage.calls), QString::number(stage.seconds, 'f', 3),
+                    stage.bytes ? QString::number(stage.mb_per_s(), 'f', 1) : "");
+        }
+        for (const stats::CounterReport &counter : report.counters) {
+            set_row(row++, counter.name, QString::number(counter.value), "", "");
+        }
+    }
+
+   private:
+    QTimer timer;
+
+    void set_row(int row, const std::string &name, QString count, QString seconds, QString throughput) {
+        std::array<QString, 4> cells = {QString::fromStdString(name), count, seconds, throughput};
+        for (int i = 0; i < 4; i++) {
+            QTableWidgetItem *cell = item(row, i);
+            if (cell == nullptr) {
+                cell = new QTableWidgetItem;
+                if (i != 0) cell->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                setItem(row, i, cell);
+            }
+            cell->setText(cells[i]);
+        }
+    }
+
+    virtual void showEvent(QShowEvent *event) override {
+        refresh();
+        timer.start();
+        QTableWidget::showEvent(event);
+    }
+    virtual void hideEvent(QHideEvent *event) override {
+        timer.stop();
+        QTableWidget::hideEvent(event);
+    }
+    virtual void closeEvent(QCloseEvent *event) override {
+        if (closed) closed();
+        QTableWidget::closeEvent(event);
+    }
+};
+
+#endif
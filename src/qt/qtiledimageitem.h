@@ -0,0 +1,104 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_QT_QTILEDIMAGEITEM
+#define LEANHRPT_QT_QTILEDIMAGEITEM
+
+#include <QCache>
+#include <QGraphicsItem>
+#include <QPainter>
+#include <QPixmap>
+#include <QStyleOptionGraphicsItem>
+#include <cmath>
+#include <utility>
+
+#include "image/pyramid.h"
+
+/**
+ * A QGraphicsItem that displays an image in tiles
+ *
+ * Only the tiles that intersect the exposed area are converted to pixmaps,
+ * and they are taken from the pyramid level that matches the current zoom.
+ * An image can also be set from a coarser level (for example a quick
+ * preview), in which case `scale` says how many item pixels one of its
+ * pixels covers.
+ */
+class QTiledImageItem : public QGraphicsItem {
+   public:
+    QTiledImageItem(QGraphicsItem *parent = nullptr) : QGraphicsItem(parent), tiles(64 * 1024) {
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    }
+
+    void setImage(const QImage &image, int scale = 1) { setPyramid(ImagePyramid(image), scale); }
+    /// Set an image from an already built pyramid, so building it can be done off the GUI thread
+    void setPyramid(ImagePyramid image, int scale = 1) {
+        prepareGeometryChange();
+        pyramid = std::move(image);
+        d_scale = scale;
+        tiles.clear();
+        update();
+    }
+
+    QRectF boundingRect() const override {
+        if (pyramid.levels() == 0) return QRectF();
+        const QImage &image = pyramid.level(0);
+        return QRectF(0, 0, image.width() * d_scale, image.height() * d_scale);
+    }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, [[maybe_unused]] QWidget *widget) override {
+        if (pyramid.levels() == 0 || pyramid.level(0).isNull()) return;
+
+        double scale = option->levelOfDetailFromTransform(painter->worldTransform()) * d_scale;
+        size_t n = std::min(ImagePyramid::level_for_scale(scale), pyramid.levels() - 1);
+        const QImage &image = pyramid.level(n);
+
+        // Item pixels per tile
+        double factor = (double)(d_scale << n) * TILE_SIZE;
+        QRectF exposed = option->exposedRect & boundingRect();
+        int x0 = std::floor(exposed.left() / factor), x1 = std::ceil(exposed.right() / factor);
+        int y0 = std::floor(exposed.top() / factor), y1 = std::ceil(exposed.bottom() / factor);
+
+        for (int y = std::max(y0, 0); y < y1; y++) {
+            for (int x = std::max(x0, 0); x < x1; x++) {
+                QRect rect = QRect(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE) & image.rect();
+                if (rect.isEmpty()) continue;
+
+                quint64 key = ((quint64)n << 48) | ((quint64)y << 24) | (quint64)x;
+                QPixmap *tile = tiles.object(key);
+                if (tile == nullptr) {
+                    tile = new QPixmap(QPixmap::fromImage(image.copy(rect)));
+                    tiles.insert(key, tile, tile->width() * tile->height() * 4 / 1024);
+                }
+
+                double k = d_scale << n;
+                painter->drawPixmap(QRectF(rect.x() * k, rect.y() * k, rect.width() * k, rect.height() * k), *tile,
+                                    QRectF(tile->rect()));
+            }
+        }
+    }
+
+   private:
+    static const int TILE_SIZE = 256;
+
+    ImagePyramid pyramid;
+    int d_scale = 1;
+    // Cost is in KiB
+    QCache<quint64, QPixmap> tiles;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#include <map>
+#include <mutex>
+
+namespace stats {
+namespace detail {
+std::atomic<bool> enabled(false);
+}
+
+// Every stage and counter, they are never unregistered since they are all static
+struct Registry {
+    std::mutex mutex;
+    std::vector<Stage *> stages;
+    std::vector<Counter *> counters;
+
+    // Function local so that it exists before any (static) stage or counter is constructed
+    static Registry &get() {
+        static Registry registry;
+        return registry;
+    }
+
+    static void reset() {
+        Registry &registry = get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (Stage *stage : registry.stages) {
+            stage->d_calls = 0;
+            stage->d_nanoseconds = 0;
+            stage->d_bytes = 0;
+        }
+        for (Counter *counter : registry.counters) {
+            counter->d_value = 0;
+        }
+    }
+
+    static Report report() {
+        Registry &registry = get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        std::map<std::string, StageReport> stages;
+        for (Stage *stage : registry.stages) {
+            StageReport &report = stages.emplace(stage->d_name, StageReport{stage->d_name, 0, 0.0, 0}).first->second;
+            report.calls += stage->d_calls;
+            report.seconds += stage->d_nanoseconds / 1e9;
+            report.bytes += stage->d_bytes;
+        }
+        std::map<std::string, uint64_t> counters;
+        for (Counter *counter : registry.counters) {
+            counters[counter->d_name] += counter->d_value;
+        }
+
+        Report report;
+        for (auto &stage : stages) report.stages.push_back(stage.second);
+        for (auto &counter : counters) report.counters.push_back({counter.first, counter.second});
+        return report;
+    }
+};
+
+Counter::Counter(const char *name) : d_name(name) {
+    Registry &registry = Registry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.counters.push_back(this);
+}
+
+Stage::Stage(const char *name) : d_name(name) {
+    Registry &registry = Registry::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.stages.push_back(this);
+}
+
+void enable(bool enable) { detail::enabled = enable; }
+void reset() { Registry::reset(); }
+Report report() { return Registry::report(); }
+}  // namespace stats
@@ -0,0 +1,136 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEANHRPT_STATS_H_
+#define LEANHRPT_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Timing and counters for every stage of decoding and rendering
+ *
+ * Stages and counters are static objects that register themselves by name,
+ * objects with the same name (e.g. from different deframers) are added
+ * together in reports. Nothing is recorded until collection is enabled, until
+ * then timers and counters only cost a relaxed atomic load.
+ *
+ * Time is summed over every thread a stage runs on, so parallel stages can
+ * add up to more than the wall time. Stages can also nest, deframing happens
+ * within both fingerprinting and decoding.
+ */
+namespace stats {
+namespace detail {
+extern std::atomic<bool> enabled;
+}
+
+/// If statistics are being collected
+inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+/// Start (or stop) collecting statistics
+void enable(bool enable = true);
+/// Zero every stage and counter
+void reset();
+
+/// A count of events, e.g. frames found
+class Counter {
+   public:
+    explicit Counter(const char *name);
+    Counter(const Counter &) = delete;
+    Counter &operator=(const Counter &) = delete;
+
+    void add(uint64_t n = 1) {
+        if (enabled()) d_value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+   private:
+    friend struct Registry;
+    const char *d_name;
+    std::atomic<uint64_t> d_value{0};
+};
+
+/// How long a stage has taken, how many times it ran and how much data went through it
+class Stage {
+   public:
+    explicit Stage(const char *name);
+    Stage(const Stage &) = delete;
+    Stage &operator=(const Stage &) = delete;
+
+    void add(std::chrono::nanoseconds elapsed, uint64_t bytes) {
+        d_calls.fetch_add(1, std::memory_order_relaxed);
+        d_nanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+        d_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+   private:
+    friend struct Registry;
+    const char *d_name;
+    std::atomic<uint64_t> d_calls{0};
+    std::atomic<uint64_t> d_nanoseconds{0};
+    std::atomic<uint64_t> d_bytes{0};
+};
+
+/// Times the scope it's in, nothing is recorded if collection is disabled when it's created
+class Timer {
+   public:
+    explicit Timer(Stage &stage) : d_stage(enabled() ? &stage : nullptr) {
+        if (d_stage) d_start = clock::now();
+    }
+    ~Timer() {
+        if (d_stage) d_stage->add(clock::now() - d_start, d_bytes);
+    }
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    /// Count data that went through the stage, for throughput
+    void bytes(uint64_t n) { d_bytes += n; }
+
+   private:
+    using clock = std::chrono::steady_clock;
+    Stage *d_stage;
+    clock::time_point d_start;
+    uint64_t d_bytes = 0;
+};
+
+struct StageReport {
+    std::string name;
+    uint64_t calls;
+    double seconds;
+    uint64_t bytes;
+
+    /// 0 if no data was counted
+    double mb_per_s() const { return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0; }
+};
+struct CounterReport {
+    std::string name;
+    uint64_t value;
+};
+struct Report {
+    std::vector<StageReport> stages;
+    std::vector<CounterReport> counters;
+};
+
+/// Everything recorded so far, sorted by name
+Report report();
+/// Write a report as JSON
+bool save_report(const Report &report, const std::string &filename);
+}  // namespace stats
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * LeanHRPT Decode
+ * Copyright (C) 2021-2022 Xerbo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Kept apart from stats.cpp so that tools without Qt can use stages and counters
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include "stats.h"
+
+namespace stats {
+bool save_report(const Report &report, const std::string &filename) {
+    QJsonObject stages;
+    for (const StageReport &stage : report.stages) {
+        QJsonObject object;
+        object["calls"] = (double)stage.calls;
+        object["seconds"] = stage.seconds;
+        object["bytes"] = (double)stage.bytes;
+        object["mb_per_s"] = stage.mb_per_s();
+        stages[QString::fromStdString(stage.name)] = object;
+    }
+    QJsonObject counters;
+    for (const CounterReport &counter : report.counters) {
+        counters[QString::fromStdString(counter.name)] = (double)counter.value;
+    }
+
+    QSaveFile file(QString::fromStdString(filename));
+    QJsonDocument json(QJsonObject{{"stages", stages}, {"counters", counters}});
+    return file.open(QIODevice::WriteOnly) && file.write(json.toJson()) != -1 && file.commit();
+}
+}  // namespace stats